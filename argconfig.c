@@ -166,8 +166,12 @@ int argconfig_parse(int argc, char *argv[], const char *program_desc,
 			long_opts[option_index].name = s->option;
 			long_opts[option_index].has_arg = s->argument_type;
 
+			/* getopt stores an int through flag, which would
+			 * clobber the neighbours of a bool; CFG_NONE flags
+			 * are set byte-wide below instead */
 			if (s->argument_type == no_argument
-			    && s->default_value != NULL) {
+			    && s->default_value != NULL
+			    && s->config_type != CFG_NONE) {
 				value_addr = (void *)(char *)s->default_value;
 
 				long_opts[option_index].flag = value_addr;
@@ -216,7 +220,10 @@ int argconfig_parse(int argc, char *argv[], const char *program_desc,
 
 		s = &options[option_index];
 		value_addr = (void *)(char *)s->default_value;
-		if (s->config_type == CFG_STRING) {
+		if (s->config_type == CFG_NONE && s->argument_type == no_argument) {
+			if (value_addr)
+				*(uint8_t *)value_addr = 1;
+		} else if (s->config_type == CFG_STRING) {
 			*((char **)value_addr) = optarg;
 		} else if (s->config_type == CFG_SIZE) {
 			*((size_t *) value_addr) = strtol(optarg, &endptr, 0);
@@ -0,0 +1,652 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <ctype.h>
+#include <errno.h>
+
+#include "batch.h"
+#include "sed-opal.h"
+
+struct batch_cmd {
+	const char *name;
+	enum batch_kind kind;
+	const char *flags;		/* short options without an argument */
+	const char *secrets;		/* short options whose argument is masked */
+};
+
+static const struct batch_cmd batch_cmds[] = {
+	{ "sed-lock-state",	BATCH_LOCK,	"sc",	"p" },
+	{ "sed-save",		BATCH_SAVE,	"s",	"p" },
+	{ "sed-addusertolr",	BATCH_GRANT,	"sf",	"p" },
+	{ "sed-enable-user",	BATCH_GRANT,	"",	"p" },
+	{ "sed-setuplr",	BATCH_SETUPLR,	"srwag", "p" },
+	{ "sed-setpw",		BATCH_SETPW,	"s",	"na" },
+	{ "sed-shadow-mbr",	BATCH_MBR,	"e",	"p" },
+	{ "sed-mbr-done",	BATCH_MBR,	"d",	"p" },
+	{ "sed-load-mbr",	BATCH_WRITE,	"",	"p" },
+	{ "sed-eraselr",	BATCH_WRITE,	"sd",	"p" },
+	{ "sed-secure-eraselr",	BATCH_WRITE,	"sVd",	"p" },
+	{ "sed-ownership",	BATCH_DEVICE,	"",	"p" },
+	{ "sed-activatelsp",	BATCH_DEVICE,	"s",	"p" },
+	{ "sed-reverttper",	BATCH_DEVICE,	"",	"p" },
+	{ "sed-psid-revert",	BATCH_DEVICE,	"",	"" },
+	{ "sed-erase-batch",	BATCH_DEVICE,	"s",	"p" },
+	{ "sed-wipe",		BATCH_DEVICE,	"s",	"p" },
+	{ "sed-probe-layout",	BATCH_DEVICE,	"",	"" },
+	{ "sed-discovery",	BATCH_DEVICE,	"rk",	"" },
+	{ "sed-status",		BATCH_DEVICE,	"sj",	"p" },
+	{ "sed-relayout",	BATCH_DEVICE,	"srwt",	"p" },
+	{ NULL }
+};
+
+static const char * const batch_long_flags[] = {
+	"sum", "readLockEnabled", "writeLockEnabled", "cached", "transaction",
+	"probe", "align", "from-gpt", "verify", "discard", "secure", "throttle",
+	"idleIO", "refresh", "kernel", "json", "enable_mbr", "done", "dm",
+	"truncate", NULL
+};
+
+static const char * const batch_long_secrets[] = {
+	"password", "newUserPW", "authorityPW", NULL
+};
+
+static bool batch_in(const char * const *list, const char *name, size_t len)
+{
+	for (; *list; list++)
+		if (strlen(*list) == len && !strncmp(*list, name, len))
+			return true;
+	return false;
+}
+
+/* whitespace separated, '' and "" quote; the line is rewritten in place */
+static int batch_split(char *line, char ***argv, int *argc)
+{
+	char *r = line, *w = line, quote;
+	char **v = NULL, **nv;
+	int n = 0, alloc = 0;
+
+	for (;;) {
+		while (isspace((unsigned char)*r))
+			r++;
+		if (!*r || *r == '#')
+			break;
+		if (n + 1 >= alloc) {
+			alloc = alloc ? alloc * 2 : 16;
+			nv = realloc(v, alloc * sizeof(*v));
+			if (!nv) {
+				free(v);
+				return -ENOMEM;
+			}
+			v = nv;
+		}
+		v[n++] = w;
+		for (quote = 0; *r && (quote || !isspace((unsigned char)*r)); r++) {
+			if (!quote && (*r == '\'' || *r == '"'))
+				quote = *r;
+			else if (quote && *r == quote)
+				quote = 0;
+			else
+				*w++ = *r;
+		}
+		if (quote) {
+			free(v);
+			return -EINVAL;
+		}
+		if (*r)
+			r++;
+		*w++ = '\0';
+	}
+	if (v)
+		v[n] = NULL;
+	*argv = v;
+	*argc = n;
+	return 0;
+}
+
+/* "admin1", "user3" or a comma list of them */
+static __u32 batch_authorities(const char *users)
+{
+	const char *p = users;
+	__u32 mask = 0;
+	unsigned long n;
+	char *end;
+
+	while (p && *p) {
+		if (!strncasecmp(p, "admin", 5)) {
+			mask |= 1U << OPAL_ADMIN1;
+		} else if (!strncasecmp(p, "user", 4)) {
+			n = strtoul(p + 4, &end, 10);
+			if (end != p + 4 && n >= OPAL_USER1 && n <= OPAL_USER9)
+				mask |= 1U << n;
+		}
+		p = strchr(p, ',');
+		if (p)
+			p++;
+	}
+	return mask;
+}
+
+/* "1-5,8"; anything unparsable means every LR */
+static __u32 batch_lrs(const char *list)
+{
+	const char *p = list;
+	unsigned long first, last;
+	__u32 mask = 0;
+	char *end;
+
+	while (*p) {
+		first = last = strtoul(p, &end, 10);
+		if (end != p && *end == '-')
+			last = strtoul(end + 1, &end, 10);
+		if (end == p || (*end && *end != ',') || first > last ||
+		    last >= OPAL_MAX_LRS)
+			return (1U << OPAL_MAX_LRS) - 1;
+		for (; first <= last; first++)
+			mask |= 1U << first;
+		p = *end ? end + 1 : end;
+	}
+	return mask;
+}
+
+/* in Single User Mode a session on LR n is always User(n + 1)'s */
+static __u32 batch_sum_users(__u32 lrs)
+{
+	__u32 mask = 0;
+	unsigned int lr;
+
+	for (lr = 0; lr < OPAL_MAX_LRS; lr++)
+		if (lrs & (1U << lr))
+			mask |= 1U << (OPAL_USER1 + lr);
+	return mask;
+}
+
+static int batch_dev(struct batch *b, const char *path)
+{
+	unsigned int i;
+	char **d;
+
+	for (i = 0; i < b->nr_devs; i++)
+		if (!strcmp(b->devs[i], path))
+			return i;
+	d = realloc(b->devs, (b->nr_devs + 1) * sizeof(*d));
+	if (!d)
+		return -ENOMEM;
+	b->devs = d;
+	d[b->nr_devs] = strdup(path);
+	if (!d[b->nr_devs])
+		return -ENOMEM;
+	return b->nr_devs++;
+}
+
+static int batch_cmp_uint(const void *a, const void *b)
+{
+	unsigned int x = *(const unsigned int *)a, y = *(const unsigned int *)b;
+
+	return x < y ? -1 : x > y;
+}
+
+/*
+ * Work out what a command line touches from its options: the LRs (--lr),
+ * the authority it logs in as (--user, or --lspAuthority for setpw; with
+ * --sum the user the LRs belong to) and the devices, i.e. whatever isn't an
+ * option or an option's argument.
+ */
+static int batch_classify(struct batch *b, struct batch_op *op,
+			  const struct batch_cmd *cmd)
+{
+	const char *lr = NULL, *user = NULL, *lsp = NULL, *val, *name;
+	bool *mask, split = false, set = false, sum = false;
+	unsigned int lr_first = 0;
+	size_t len, tlen = 1;
+	int i, dev, c;
+	char *t;
+
+	mask = calloc(op->argc, sizeof(*mask));
+	op->devs = calloc(op->argc, sizeof(*op->devs));
+	if (!mask || !op->devs) {
+		free(mask);
+		return -ENOMEM;
+	}
+
+	for (i = 1; i < op->argc; i++) {
+		t = op->argv[i];
+		val = NULL;
+		if (t[0] != '-' || !t[1]) {
+			dev = batch_dev(b, t);
+			if (dev < 0) {
+				free(mask);
+				return dev;
+			}
+			op->devs[op->nr_devs++] = dev;
+			continue;
+		}
+		if (t[1] == '-') {
+			name = t + 2;
+			val = strchr(name, '=');
+			len = val ? (size_t)(val - name) : strlen(name);
+			if (val)
+				val++;
+			else if (!batch_in(batch_long_flags, name, len) && i + 1 < op->argc)
+				val = op->argv[++i];
+			if (val && batch_in(batch_long_secrets, name, len))
+				mask[i] = true;
+			c = 0;
+			if (len == 2 && !strncmp(name, "lr", 2))
+				c = 'l';
+			else if (len == 4 && !strncmp(name, "user", 4))
+				c = 'u';
+			else if (len == 12 && !strncmp(name, "lspAuthority", 12))
+				c = 'P';
+			else if (len == 5 && !strncmp(name, "split", 5))
+				c = 'n';
+			else if (len == 8 && !strncmp(name, "from-gpt", 8))
+				c = 'g';
+			else if (len == 3 && !strncmp(name, "set", 3))
+				set = true;
+			else if (len == 3 && !strncmp(name, "sum", 3))
+				sum = true;
+		} else {
+			c = t[1];
+			if (c == 's' && strchr(cmd->flags, c))
+				sum = true;
+			if (strchr(cmd->flags, c)) {
+				if (c != 'g' || op->kind != BATCH_SETUPLR)
+					continue;
+			} else {
+				if (t[2])
+					val = t + 2;
+				else if (i + 1 < op->argc)
+					val = op->argv[++i];
+				if (val && strchr(cmd->secrets, c))
+					mask[i] = true;
+			}
+			if (c == 'p' && op->kind == BATCH_SETPW)
+				c = 'P';
+		}
+		switch (c) {
+		case 'l':
+			lr = val;
+			break;
+		case 'u':
+			user = val;
+			break;
+		case 'P':
+			lsp = val;
+			break;
+		case 'n':
+			split = op->kind == BATCH_SETUPLR;
+			break;
+		case 'g':
+			split = op->kind == BATCH_SETUPLR;
+			break;
+		}
+	}
+	if (split && lr)
+		lr_first = strtoul(lr, NULL, 10);
+	if (split && !lr_first)
+		lr_first = 1;
+	if (set)
+		op->nr_devs = 0;
+	qsort(op->devs, op->nr_devs, sizeof(*op->devs), batch_cmp_uint);
+
+	op->objs = lr ? batch_lrs(lr) : 1;
+	if (split)
+		op->objs = ((1U << OPAL_MAX_LRS) - 1) & ~((1U << lr_first) - 1);
+	op->uses = user ? batch_authorities(user) : 1U << OPAL_ADMIN1;
+	if (sum)
+		op->uses = batch_sum_users(op->objs);
+	switch (op->kind) {
+	case BATCH_SETPW:
+		/* --lspAuthority picks the LR, and so the user, in SUM too */
+		op->uses = lsp ? batch_authorities(lsp) : 1U << OPAL_ADMIN1;
+		op->changes = user ? batch_authorities(user) : 0;
+		op->objs = 0;
+		break;
+	case BATCH_GRANT:
+		if (strcmp(cmd->name, "sed-enable-user"))
+			break;
+		op->changes = op->uses;
+		op->uses = 1U << OPAL_ADMIN1;
+		op->objs = 0;
+		break;
+	case BATCH_MBR:
+	case BATCH_WRITE:
+		if (strstr(cmd->name, "mbr"))
+			op->objs = BATCH_OBJ_MBR;
+		break;
+	case BATCH_DEVICE:
+		op->objs = op->uses = op->changes = BATCH_OBJ_ALL;
+		break;
+	default:
+		break;
+	}
+	op->sessions = op->nr_devs ? op->nr_devs : 1;
+	if (op->kind == BATCH_LOCK || op->kind == BATCH_SAVE ||
+	    op->kind == BATCH_SETUPLR || (op->kind == BATCH_GRANT && op->objs))
+		op->sessions *= __builtin_popcount(op->objs & ((1U << OPAL_MAX_LRS) - 1));
+
+	for (i = 0; i < op->argc; i++)
+		tlen += (mask[i] ? 3 : strlen(op->argv[i])) + 1;
+	op->text = malloc(tlen);
+	if (!op->text) {
+		free(mask);
+		return -ENOMEM;
+	}
+	op->text[0] = '\0';
+	for (i = 0; i < op->argc; i++) {
+		if (i)
+			strcat(op->text, " ");
+		strcat(op->text, mask[i] ? "***" : op->argv[i]);
+	}
+	free(mask);
+	return 0;
+}
+
+/*
+ * One sed-opal command line per line, with or without a leading "sed-opal";
+ * blank lines and '#' comments are skipped. Commands the planner doesn't
+ * know are refused rather than guessed at.
+ */
+int batch_load(FILE *f, struct batch *b)
+{
+	const struct batch_cmd *cmd;
+	struct batch_op *op, *ops;
+	unsigned int lineno = 0;
+	char *line = NULL;
+	size_t len = 0;
+	const char *prog;
+	int err = 0;
+
+	memset(b, 0, sizeof(*b));
+	while (getline(&line, &len, f) >= 0) {
+		lineno++;
+		ops = realloc(b->ops, (b->nr_ops + 1) * sizeof(*ops));
+		if (!ops) {
+			err = -ENOMEM;
+			break;
+		}
+		b->ops = ops;
+		op = &b->ops[b->nr_ops];
+		memset(op, 0, sizeof(*op));
+		op->line = lineno;
+		op->dropped_for = -1;
+		err = batch_split(line, &op->argv, &op->argc);
+		if (err) {
+			fprintf(stderr, "line %u: unbalanced quotes\n", lineno);
+			break;
+		}
+		if (!op->argc) {
+			free(op->argv);
+			continue;
+		}
+		/* the argv strings live in the line buffer */
+		op->line_buf = line;
+		line = NULL;
+		len = 0;
+		b->nr_ops++;
+
+		prog = strrchr(op->argv[0], '/');
+		if (!strcmp(prog ? prog + 1 : op->argv[0], "sed-opal")) {
+			memmove(op->argv, op->argv + 1, op->argc * sizeof(*op->argv));
+			op->argc--;
+		}
+		for (cmd = batch_cmds; cmd->name && op->argc; cmd++)
+			if (!strcmp(cmd->name, op->argv[0]))
+				break;
+		if (!op->argc || !cmd->name) {
+			fprintf(stderr, "line %u: %s can't be batched\n", lineno,
+				op->argc ? op->argv[0] : "empty command");
+			err = -EINVAL;
+			break;
+		}
+		op->kind = cmd->kind;
+		err = batch_classify(b, op, cmd);
+		if (err)
+			break;
+	}
+	free(line);
+	if (!err && ferror(f))
+		err = -EIO;
+	if (err)
+		batch_free(b);
+	return err;
+}
+
+static bool batch_same_devs(const struct batch_op *a, const struct batch_op *b)
+{
+	return a->nr_devs && a->nr_devs == b->nr_devs &&
+	       !memcmp(a->devs, b->devs, a->nr_devs * sizeof(*a->devs));
+}
+
+/* the text has its secrets masked, so a repeat is judged on the argv */
+static bool batch_same_args(const struct batch_op *a, const struct batch_op *b)
+{
+	int i;
+
+	if (a->argc != b->argc)
+		return false;
+	for (i = 0; i < a->argc; i++)
+		if (strcmp(a->argv[i], b->argv[i]))
+			return false;
+	return true;
+}
+
+static bool batch_share_dev(const struct batch_op *a, const struct batch_op *b)
+{
+	unsigned int i = 0, j = 0;
+
+	if (!a->nr_devs || !b->nr_devs)
+		return true;
+	while (i < a->nr_devs && j < b->nr_devs) {
+		if (a->devs[i] == b->devs[j])
+			return true;
+		if (a->devs[i] < b->devs[j])
+			i++;
+		else
+			j++;
+	}
+	return false;
+}
+
+/*
+ * Two operations have to stay in order if they share a device and one of
+ * them touches an LR or the MBR the other one does, or changes credentials
+ * of an authority the other one logs in as or changes too.
+ */
+static bool batch_conflict(const struct batch_op *a, const struct batch_op *b)
+{
+	if (!batch_share_dev(a, b))
+		return false;
+	if (a->kind == BATCH_DEVICE || b->kind == BATCH_DEVICE)
+		return true;
+	return (a->objs & b->objs) ||
+	       (a->changes & (b->uses | b->changes)) ||
+	       (b->changes & (a->uses | a->changes));
+}
+
+enum { BATCH_KEEP, BATCH_DUP, BATCH_OVERWRITE };
+
+/* what a later op b means for an earlier op a on the same objects */
+static int batch_supersedes(const struct batch_op *a, const struct batch_op *b)
+{
+	if (strcmp(a->argv[0], b->argv[0]) || !batch_same_devs(a, b) ||
+	    a->objs != b->objs || a->kind == BATCH_WRITE || a->kind == BATCH_DEVICE)
+		return BATCH_KEEP;
+	if (batch_same_args(a, b))
+		return BATCH_DUP;
+
+	switch (a->kind) {
+	case BATCH_LOCK:
+	case BATCH_SETUPLR:
+	case BATCH_MBR:
+		return BATCH_OVERWRITE;
+	case BATCH_SAVE:
+		return a->uses == b->uses ? BATCH_OVERWRITE : BATCH_KEEP;
+	case BATCH_SETPW:
+		/* logging in with the password the earlier one set needs it */
+		return a->changes == b->changes && !(b->uses & a->changes) ?
+			BATCH_OVERWRITE : BATCH_KEEP;
+	default:
+		return BATCH_KEEP;
+	}
+}
+
+/* first device and first authority: what the reordering groups by */
+static int batch_group(const struct batch_op *op, int *auth)
+{
+	*auth = op->uses && op->uses != BATCH_OBJ_ALL ? __builtin_ctz(op->uses) : -1;
+	return op->nr_devs ? (int)op->devs[0] : -1;
+}
+
+static unsigned int batch_runs(const struct batch *b, const unsigned int *order,
+			       unsigned int nr)
+{
+	int dev, auth, last_dev = -2, last_auth = -2;
+	unsigned int i, runs = 0;
+
+	for (i = 0; i < nr; i++) {
+		dev = batch_group(&b->ops[order[i]], &auth);
+		if (dev != last_dev || auth != last_auth)
+			runs++;
+		last_dev = dev;
+		last_auth = auth;
+	}
+	return runs;
+}
+
+/*
+ * Drop what a later operation repeats or overwrites before anything in
+ * between could have depended on it, then schedule the rest: anything whose
+ * conflicting predecessors have all run may go next, preferring the device
+ * and authority we're already on.
+ */
+void batch_plan(struct batch *b, bool reorder)
+{
+	unsigned int i, j, n = 0, *indeg, *kept;
+	int dev, auth, last_dev = -2, last_auth = -2, best, score, best_score;
+	bool *done;
+
+	for (i = 0; i < b->nr_ops; i++) {
+		if (b->ops[i].dropped_for >= 0)
+			continue;
+		for (j = i + 1; j < b->nr_ops; j++) {
+			if (b->ops[j].dropped_for >= 0)
+				continue;
+			switch (batch_supersedes(&b->ops[i], &b->ops[j])) {
+			case BATCH_DUP:
+				b->ops[j].dropped_for = i;
+				b->ops[j].duplicate = true;
+				continue;
+			case BATCH_OVERWRITE:
+				b->ops[i].dropped_for = j;
+				break;
+			default:
+				if (!batch_conflict(&b->ops[i], &b->ops[j]))
+					continue;
+				break;
+			}
+			break;
+		}
+	}
+
+	free(b->plan);
+	b->plan = calloc(b->nr_ops ? b->nr_ops : 1, sizeof(*b->plan));
+	kept = calloc(b->nr_ops ? b->nr_ops : 1, sizeof(*kept));
+	indeg = calloc(b->nr_ops ? b->nr_ops : 1, sizeof(*indeg));
+	done = calloc(b->nr_ops ? b->nr_ops : 1, sizeof(*done));
+	b->nr_planned = 0;
+	for (i = 0; i < b->nr_ops; i++)
+		if (b->ops[i].dropped_for < 0)
+			kept[n++] = i;
+
+	if (!reorder || !indeg || !done) {
+		for (i = 0; b->plan && kept && i < n; i++)
+			b->plan[b->nr_planned++] = kept[i];
+		goto out;
+	}
+	if (!b->plan || !kept)
+		goto out;
+
+	for (i = 0; i < n; i++)
+		for (j = i + 1; j < n; j++)
+			if (batch_conflict(&b->ops[kept[i]], &b->ops[kept[j]]))
+				indeg[j]++;
+
+	while (b->nr_planned < n) {
+		best = -1;
+		best_score = -1;
+		for (i = 0; i < n; i++) {
+			if (done[i] || indeg[i])
+				continue;
+			dev = batch_group(&b->ops[kept[i]], &auth);
+			score = (dev == last_dev) * 2 + (dev == last_dev && auth == last_auth);
+			if (score > best_score) {
+				best = i;
+				best_score = score;
+			}
+		}
+		done[best] = true;
+		b->plan[b->nr_planned++] = kept[best];
+		last_dev = batch_group(&b->ops[kept[best]], &last_auth);
+		for (j = best + 1; j < n; j++)
+			if (!done[j] && batch_conflict(&b->ops[kept[best]], &b->ops[kept[j]]))
+				indeg[j]--;
+	}
+ out:
+	free(kept);
+	free(indeg);
+	free(done);
+}
+
+void batch_print(struct batch *b)
+{
+	unsigned int i, *all, sessions = 0, was = 0, runs = 0;
+	struct batch_op *op;
+
+	all = calloc(b->nr_ops ? b->nr_ops : 1, sizeof(*all));
+	for (i = 0; i < b->nr_ops; i++) {
+		was += b->ops[i].sessions;
+		if (all)
+			all[i] = i;
+	}
+	for (i = 0; i < b->nr_planned; i++)
+		sessions += b->ops[b->plan[i]].sessions;
+	if (all)
+		runs = batch_runs(b, all, b->nr_ops);
+	free(all);
+
+	printf("Plan: %u of %u operations, ~%u sessions (was ~%u), "
+	       "%u device/authority runs (was %u)\n", b->nr_planned, b->nr_ops,
+	       sessions, was, batch_runs(b, b->plan, b->nr_planned), runs);
+	for (i = 0; i < b->nr_planned; i++) {
+		op = &b->ops[b->plan[i]];
+		printf("  %3u. line %u: %s\n", i + 1, op->line, op->text);
+	}
+	for (i = 0; i < b->nr_ops; i++) {
+		op = &b->ops[i];
+		if (op->dropped_for < 0)
+			continue;
+		printf("  dropped line %u: %s (%s line %u)\n", op->line, op->text,
+		       op->duplicate ? "repeats" : "overwritten by",
+		       b->ops[op->dropped_for].line);
+	}
+}
+
+void batch_free(struct batch *b)
+{
+	unsigned int i;
+
+	for (i = 0; i < b->nr_ops; i++) {
+		free(b->ops[i].line_buf);
+		free(b->ops[i].argv);
+		free(b->ops[i].devs);
+		free(b->ops[i].text);
+	}
+	free(b->ops);
+	for (i = 0; i < b->nr_devs; i++)
+		free(b->devs[i]);
+	free(b->devs);
+	free(b->plan);
+	memset(b, 0, sizeof(*b));
+}
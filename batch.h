@@ -0,0 +1,58 @@
+#ifndef _BATCH_H
+#define _BATCH_H
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <linux/types.h>
+
+#define BATCH_OBJ_MBR	(1U << 9)	/* bits 0-8 are the LRs */
+#define BATCH_OBJ_ALL	(~0U)
+
+enum batch_kind {
+	BATCH_LOCK,		/* last lock state wins */
+	BATCH_SAVE,		/* last saved key wins */
+	BATCH_SETUPLR,		/* last range wins */
+	BATCH_SETPW,		/* last password wins, unless it logs in with it */
+	BATCH_MBR,		/* last MBR enable/done flag wins */
+	BATCH_GRANT,		/* idempotent, only exact duplicates merge */
+	BATCH_WRITE,		/* changes data: erase, MBR load */
+	BATCH_DEVICE,		/* anything else: orders against all of the device */
+};
+
+/*
+ * One line of a batch: a sed-opal command line, plus what it touches as far
+ * as the planner is concerned. Devices are indexes into batch->devs; no
+ * devices means ones we can't see (a --set or a scan), i.e. all of them.
+ */
+struct batch_op {
+	unsigned int line;
+	int argc;
+	char **argv;			/* argv[0] is the command */
+	char *line_buf;			/* the argv strings point into it */
+	enum batch_kind kind;
+	unsigned int nr_devs;
+	unsigned int *devs;
+	__u32 objs;			/* LRs and BATCH_OBJ_MBR */
+	__u32 uses;			/* authorities it opens sessions as */
+	__u32 changes;			/* authorities whose credentials it sets */
+	unsigned int sessions;		/* estimated, one per device and LR */
+	char *text;			/* argv joined, secrets masked */
+	int dropped_for;		/* index of the op that made it redundant */
+	bool duplicate;			/* ... by repeating it, not overwriting it */
+};
+
+struct batch {
+	unsigned int nr_ops;
+	struct batch_op *ops;
+	unsigned int nr_devs;
+	char **devs;
+	unsigned int nr_planned;
+	unsigned int *plan;		/* op indexes, in execution order */
+};
+
+int batch_load(FILE *f, struct batch *b);
+void batch_plan(struct batch *b, bool reorder);
+void batch_print(struct batch *b);
+void batch_free(struct batch *b);
+
+#endif
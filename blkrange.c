@@ -0,0 +1,315 @@
+#include <sys/types.h>
+#include <sys/ioctl.h>
+#include <linux/fs.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <time.h>
+
+#include "blkrange.h"
+#include "devindex.h"
+
+/* keep each BLKDISCARD short enough that a worker can't hog the queue */
+#define BLKRANGE_SEGMENT (1ULL << 30)
+
+static __u64 queue_attr(const char *disk, const char *attr)
+{
+	char path[PATH_MAX];
+	unsigned long long val = 0;
+	FILE *f;
+
+	snprintf(path, sizeof(path), "/sys/block/%s/queue/%s", disk, attr);
+	f = fopen(path, "r");
+	if (!f)
+		return 0;
+	if (fscanf(f, "%llu", &val) != 1)
+		val = 0;
+	fclose(f);
+	return val;
+}
+
+/*
+ * Bytes covered by the LR as last set up through us. LR 0 is whatever the
+ * others leave, so it's only known when none of them has been set up.
+ */
+int blkrange_lr(const char *disk, int fd, __u8 lr, __u64 *start, __u64 *length)
+{
+	struct devindex_lr r;
+	unsigned int lbs;
+	__u64 bytes;
+	int i;
+
+	if (ioctl(fd, BLKSSZGET, &lbs))
+		return -errno;
+
+	if (lr) {
+		if (devindex_get_lr(disk, lr, &r) || !r.range_length)
+			return -ENOENT;
+		*start = r.range_start * lbs;
+		*length = r.range_length * lbs;
+		return 0;
+	}
+
+	for (i = 1; i < OPAL_MAX_LRS; i++)
+		if (!devindex_get_lr(disk, i, &r) && r.range_length)
+			return -ENOENT;
+	if (ioctl(fd, BLKGETSIZE64, &bytes))
+		return -errno;
+	*start = 0;
+	*length = bytes;
+	return 0;
+}
+
+/*
+ * Drop whatever the page cache holds for the LR (lr < 0: the whole device)
+ * so reads after a lock, erase or re-key go to the drive. Falls back to the
+ * whole device when we don't know where the LR is.
+ */
+void blkrange_invalidate(const char *disk, int fd, int lr)
+{
+	__u64 start = 0, length = 0;
+
+	if (lr < 0 || blkrange_lr(disk, fd, lr, &start, &length))
+		start = length = 0;	/* 0 length is "to the end" */
+	posix_fadvise(fd, start, length, POSIX_FADV_DONTNEED);
+}
+
+static double blkrange_ms_since(struct timespec *t0)
+{
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (now.tv_sec - t0->tv_sec) * 1000.0 +
+		(now.tv_nsec - t0->tv_nsec) / 1000000.0;
+}
+
+/*
+ * Read one logical block at offset with O_DIRECT until it succeeds or
+ * timeout_ms passes, backing off from 1ms to 100ms between attempts. *ms is
+ * the time it took to get the first successful read back.
+ */
+int blkrange_probe(const char *path, __u64 offset, unsigned int timeout_ms,
+		   double *ms)
+{
+	struct timespec t0, nap = { 0, 1000000 };
+	unsigned int lbs;
+	void *buf = NULL;
+	int fd, err;
+
+	*ms = 0;
+	clock_gettime(CLOCK_MONOTONIC, &t0);
+	fd = open(path, O_RDONLY | O_DIRECT | O_CLOEXEC);
+	if (fd < 0)
+		return -errno;
+	if (ioctl(fd, BLKSSZGET, &lbs)) {
+		err = -errno;
+		goto out;
+	}
+	if (posix_memalign(&buf, lbs, lbs)) {
+		err = -ENOMEM;
+		goto out;
+	}
+
+	offset = offset / lbs * lbs;
+	for (;;) {
+		errno = 0;
+		if (pread(fd, buf, lbs, offset) == lbs) {
+			err = 0;
+			break;
+		}
+		err = errno ? -errno : -EIO;
+		if (blkrange_ms_since(&t0) >= timeout_ms)
+			break;
+		nanosleep(&nap, NULL);
+		if (nap.tv_nsec < 100000000)
+			nap.tv_nsec *= 2;
+	}
+	*ms = blkrange_ms_since(&t0);
+ out:
+	free(buf);
+	close(fd);
+	return err;
+}
+
+struct blkrange_scan {
+	int fd;
+	void *buf;
+	struct blkrange_layout *l;
+};
+
+/* a locked range fails reads; anything else failing we count as locked too */
+static int blkrange_locked(struct blkrange_scan *s, __u64 lba)
+{
+	s->l->reads++;
+	return pread(s->fd, s->buf, s->l->lbs, lba * s->l->lbs) != s->l->lbs;
+}
+
+static int blkrange_add_region(struct blkrange_layout *l, __u64 start, int locked)
+{
+	struct blkrange_region *r;
+
+	if (l->nr && l->regions[l->nr - 1].locked == locked)
+		return 0;
+	r = realloc(l->regions, (l->nr + 1) * sizeof(*r));
+	if (!r)
+		return -ENOMEM;
+	l->regions = r;
+	l->regions[l->nr++] = (struct blkrange_region) {
+		.start = start, .locked = locked,
+	};
+	return 0;
+}
+
+/*
+ * Find where reads start and stop failing: probe a grid of grid + 1 LBAs
+ * across the device, then bisect every pair of neighbours that disagree
+ * down to the LBA, which is log2(capacity / grid) reads per boundary.
+ * A region that falls entirely between two grid points goes unnoticed.
+ */
+int blkrange_probe_layout(const char *path, unsigned int grid,
+			  struct blkrange_layout *l)
+{
+	struct blkrange_scan s = { .l = l };
+	__u64 size, nr_lbas, lo, hi, mid, prev = 0;
+	int prev_locked = 0, locked, err = 0;
+	unsigned int i;
+
+	memset(l, 0, sizeof(*l));
+	s.fd = open(path, O_RDONLY | O_DIRECT | O_CLOEXEC);
+	if (s.fd < 0)
+		return -errno;
+	if (ioctl(s.fd, BLKSSZGET, &l->lbs) || ioctl(s.fd, BLKGETSIZE64, &size)) {
+		err = -errno;
+		goto out;
+	}
+	if (posix_memalign(&s.buf, l->lbs, l->lbs)) {
+		err = -ENOMEM;
+		goto out;
+	}
+	nr_lbas = size / l->lbs;
+	if (!nr_lbas || !grid) {
+		err = -EINVAL;
+		goto out;
+	}
+
+	for (i = 0; i <= grid; i++) {
+		mid = (nr_lbas - 1) * i / grid;
+		if (i && mid == prev)
+			continue;
+		locked = blkrange_locked(&s, mid);
+		if (i && locked != prev_locked) {
+			lo = prev;
+			hi = mid;
+			while (hi - lo > 1) {
+				mid = lo + (hi - lo) / 2;
+				if (blkrange_locked(&s, mid) == prev_locked)
+					lo = mid;
+				else
+					hi = mid;
+			}
+			mid = (nr_lbas - 1) * i / grid;
+			err = blkrange_add_region(l, hi, locked);
+		} else if (!i)
+			err = blkrange_add_region(l, 0, locked);
+		if (err)
+			goto out;
+		prev = mid;
+		prev_locked = locked;
+	}
+
+	for (i = 0; i < l->nr; i++)
+		l->regions[i].length = (i + 1 < l->nr ? l->regions[i + 1].start :
+					nr_lbas) - l->regions[i].start;
+ out:
+	free(s.buf);
+	close(s.fd);
+	if (err)
+		blkrange_layout_free(l);
+	return err;
+}
+
+void blkrange_layout_free(struct blkrange_layout *l)
+{
+	free(l->regions);
+	l->regions = NULL;
+	l->nr = 0;
+}
+
+struct blkrange_discard {
+	int fd;
+	__u64 start;
+	__u64 end;
+	__u64 seg;
+	__u64 next;
+	int err;
+};
+
+static void *blkrange_discard_worker(void *arg)
+{
+	struct blkrange_discard *d = arg;
+	__u64 range[2], off;
+
+	for (;;) {
+		off = __atomic_fetch_add(&d->next, d->seg, __ATOMIC_RELAXED);
+		if (off >= d->end || __atomic_load_n(&d->err, __ATOMIC_RELAXED))
+			break;
+		range[0] = off;
+		range[1] = d->end - off < d->seg ? d->end - off : d->seg;
+		if (ioctl(d->fd, BLKDISCARD, range)) {
+			__atomic_store_n(&d->err, -errno, __ATOMIC_RELAXED);
+			break;
+		}
+	}
+	return NULL;
+}
+
+/*
+ * Discard [start, start + length), trimmed inwards to the discard granularity
+ * and split into granularity-aligned segments issued from a few threads.
+ */
+int blkrange_discard(const char *path, const char *disk, __u64 start,
+		     __u64 length)
+{
+	struct blkrange_discard d = { .err = 0 };
+	pthread_t threads[BLKRANGE_THREADS];
+	__u64 gran, max;
+	int i, started;
+
+	max = queue_attr(disk, "discard_max_bytes");
+	if (!max)
+		return -EOPNOTSUPP;
+	gran = queue_attr(disk, "discard_granularity");
+	if (!gran)
+		gran = 512;
+
+	d.start = (start + gran - 1) / gran * gran;
+	d.end = (start + length) / gran * gran;
+	if (d.end <= d.start)
+		return 0;
+	d.seg = BLKRANGE_SEGMENT < max ? BLKRANGE_SEGMENT : max;
+	d.seg = d.seg / gran * gran;
+	if (!d.seg)
+		d.seg = gran;
+	d.next = d.start;
+
+	d.fd = open(path, O_WRONLY | O_CLOEXEC);
+	if (d.fd < 0)
+		return -errno;
+
+	for (started = 0; started < BLKRANGE_THREADS; started++)
+		if (pthread_create(&threads[started], NULL,
+				   blkrange_discard_worker, &d))
+			break;
+	if (!started)
+		blkrange_discard_worker(&d);
+	for (i = 0; i < started; i++)
+		pthread_join(threads[i], NULL);
+
+	close(d.fd);
+	return d.err;
+}
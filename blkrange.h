@@ -0,0 +1,37 @@
+#ifndef _BLKRANGE_H
+#define _BLKRANGE_H
+
+#include <linux/types.h>
+
+#define BLKRANGE_THREADS	4
+#define BLKRANGE_GRID		256
+
+/* a run of LBAs that either all read back or all fail */
+struct blkrange_region {
+	__u64 start;
+	__u64 length;
+	int locked;
+};
+
+struct blkrange_layout {
+	unsigned int lbs;
+	unsigned int reads;
+	unsigned int nr;
+	struct blkrange_region *regions;
+};
+
+/*
+ * Byte ranges of a disk that a locking range covers, and the block layer
+ * operations we run over them once the drive has changed what's underneath.
+ */
+int blkrange_lr(const char *disk, int fd, __u8 lr, __u64 *start, __u64 *length);
+void blkrange_invalidate(const char *disk, int fd, int lr);
+int blkrange_probe(const char *path, __u64 offset, unsigned int timeout_ms,
+		   double *ms);
+int blkrange_probe_layout(const char *path, unsigned int grid,
+			  struct blkrange_layout *l);
+void blkrange_layout_free(struct blkrange_layout *l);
+int blkrange_discard(const char *path, const char *disk, __u64 start,
+		     __u64 length);
+
+#endif
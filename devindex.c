@@ -0,0 +1,535 @@
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <sys/file.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <ctype.h>
+#include <dirent.h>
+#include <stdbool.h>
+#include <pthread.h>
+
+#include "devindex.h"
+
+static const char * const devindex_prefixes[] = { "serial:", "wwn:", "eui:" };
+
+/* flock() keeps other processes out, this keeps our own fleet workers out */
+static pthread_mutex_t devindex_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/* FNV-1a */
+unsigned int devindex_hash(const char *key)
+{
+	unsigned int h = 2166136261u;
+
+	while (*key) {
+		h ^= (unsigned char)*key++;
+		h *= 16777619u;
+	}
+	return h;
+}
+
+static int sysfs_read_str(const char *path, char *buf, size_t len)
+{
+	FILE *f;
+	char *p;
+
+	f = fopen(path, "r");
+	if (!f)
+		return -errno;
+	p = fgets(buf, len, f);
+	fclose(f);
+	if (!p)
+		return -EINVAL;
+
+	p = buf + strlen(buf);
+	while (p > buf && isspace((unsigned char)p[-1]))
+		*--p = '\0';
+	return buf[0] ? 0 : -ENOENT;
+}
+
+/* SCSI/SATA disks only expose their serial through the unit serial VPD page */
+static int sysfs_read_vpd80(const char *disk, char *buf, size_t len)
+{
+	unsigned char page[256];
+	char path[128];
+	size_t n, i = 0;
+	FILE *f;
+
+	snprintf(path, sizeof(path), "/sys/block/%s/device/vpd_pg80", disk);
+	f = fopen(path, "r");
+	if (!f)
+		return -errno;
+	n = fread(page, 1, sizeof(page), f);
+	fclose(f);
+	if (n < 4)
+		return -EINVAL;
+
+	n = page[3] + 4 < n ? page[3] + 4u : n;
+	for (n -= 4; i < n && i < len - 1 && page[4 + i]; i++)
+		buf[i] = page[4 + i];
+	buf[i] = '\0';
+
+	while (i && isspace((unsigned char)buf[i - 1]))
+		buf[--i] = '\0';
+	for (i = 0; isspace((unsigned char)buf[i]); i++)
+		;
+	memmove(buf, buf + i, strlen(buf + i) + 1);
+	return buf[0] ? 0 : -ENOENT;
+}
+
+int mkdir_parents(const char *path)
+{
+	char tmp[PATH_MAX], *p;
+
+	snprintf(tmp, sizeof(tmp), "%s", path);
+	for (p = tmp + 1; *p; p++) {
+		if (*p != '/')
+			continue;
+		*p = '\0';
+		if (mkdir(tmp, 0755) && errno != EEXIST)
+			return -errno;
+		*p = '/';
+	}
+	if (mkdir(tmp, 0755) && errno != EEXIST)
+		return -errno;
+	return 0;
+}
+
+int devid_read(const char *disk, struct devid *id)
+{
+	char path[128], buf[32];
+
+	memset(id, 0, sizeof(*id));
+
+	snprintf(path, sizeof(path), "/sys/block/%s/device/serial", disk);
+	if (sysfs_read_str(path, id->serial, sizeof(id->serial)))
+		sysfs_read_vpd80(disk, id->serial, sizeof(id->serial));
+
+	snprintf(path, sizeof(path), "/sys/block/%s/wwid", disk);
+	if (sysfs_read_str(path, id->wwid, sizeof(id->wwid))) {
+		snprintf(path, sizeof(path), "/sys/block/%s/device/wwid", disk);
+		sysfs_read_str(path, id->wwid, sizeof(id->wwid));
+	}
+
+	snprintf(path, sizeof(path), "/sys/block/%s/eui", disk);
+	sysfs_read_str(path, id->eui, sizeof(id->eui));
+
+	snprintf(path, sizeof(path), "/sys/block/%s/device/model", disk);
+	sysfs_read_str(path, id->model, sizeof(id->model));
+
+	snprintf(path, sizeof(path), "/sys/block/%s/device/firmware_rev", disk);
+	if (sysfs_read_str(path, id->firmware, sizeof(id->firmware))) {
+		snprintf(path, sizeof(path), "/sys/block/%s/device/rev", disk);
+		sysfs_read_str(path, id->firmware, sizeof(id->firmware));
+	}
+
+	snprintf(path, sizeof(path), "/sys/block/%s/nsid", disk);
+	if (!sysfs_read_str(path, buf, sizeof(buf)))
+		id->nsid = strtoul(buf, NULL, 10);
+
+	return id->serial[0] || id->wwid[0] ? 0 : -ENOENT;
+}
+
+void devid_key(const struct devid *id, char *key)
+{
+	if (!id->serial[0])
+		snprintf(key, DEVINDEX_KEY_LEN, "wwn:%s", id->wwid);
+	else if (id->nsid)
+		snprintf(key, DEVINDEX_KEY_LEN, "serial:%s/%u", id->serial, id->nsid);
+	else
+		snprintf(key, DEVINDEX_KEY_LEN, "serial:%s", id->serial);
+}
+
+int devindex_is_key(const char *str)
+{
+	size_t i;
+
+	for (i = 0; i < sizeof(devindex_prefixes) / sizeof(devindex_prefixes[0]); i++)
+		if (!strncmp(str, devindex_prefixes[i], strlen(devindex_prefixes[i])))
+			return 1;
+	return 0;
+}
+
+static struct devindex_slot *devindex_find(struct devindex *idx, const char *key)
+{
+	struct devindex_slot *slot;
+	unsigned int h = devindex_hash(key), i;
+
+	for (i = 0; i < DEVINDEX_SLOTS; i++) {
+		slot = &idx->slots[(h + i) & (DEVINDEX_SLOTS - 1)];
+		if (!slot->key[0])
+			return NULL;
+		if (!strncmp(slot->key, key, DEVINDEX_KEY_LEN))
+			return slot;
+	}
+	return NULL;
+}
+
+/*
+ * The bare controller serial of an NVMe drive is shared by its namespaces;
+ * it resolves to the namespace with the lowest nsid.
+ */
+static int devindex_insert(struct devindex *idx, const char *key, int dev)
+{
+	struct devindex_slot *slot;
+	unsigned int h = devindex_hash(key), i;
+
+	if (!key[0])
+		return 0;
+
+	for (i = 0; i < DEVINDEX_SLOTS; i++) {
+		slot = &idx->slots[(h + i) & (DEVINDEX_SLOTS - 1)];
+		if (!slot->key[0]) {
+			snprintf(slot->key, sizeof(slot->key), "%s", key);
+			slot->dev = dev;
+			idx->nr_slots++;
+			return 0;
+		}
+		if (!strncmp(slot->key, key, DEVINDEX_KEY_LEN)) {
+			if (idx->devs[dev].nsid < idx->devs[slot->dev].nsid)
+				slot->dev = dev;
+			return -EEXIST;
+		}
+	}
+	return -ENOSPC;
+}
+
+static struct devindex *devindex_map(int *fdp, bool rw)
+{
+	struct devindex *idx;
+	struct stat st;
+	int fd;
+
+	fd = open(DEVINDEX_FILE, rw ? O_RDWR : O_RDONLY);
+	if (fd < 0)
+		return NULL;
+
+	if (rw && flock(fd, LOCK_EX))
+		goto close;
+	if (fstat(fd, &st) || st.st_size != sizeof(*idx))
+		goto close;
+
+	idx = mmap(NULL, sizeof(*idx), rw ? PROT_READ | PROT_WRITE : PROT_READ,
+		   MAP_SHARED, fd, 0);
+	if (idx == MAP_FAILED)
+		goto close;
+	if (idx->magic != DEVINDEX_MAGIC) {
+		munmap(idx, sizeof(*idx));
+		goto close;
+	}
+
+	*fdp = fd;
+	return idx;
+ close:
+	close(fd);
+	return NULL;
+}
+
+static void devindex_unmap(struct devindex *idx, int fd)
+{
+	munmap(idx, sizeof(*idx));
+	close(fd);
+}
+
+static struct devindex_dev *devindex_find_disk(struct devindex *idx,
+					       const char *disk)
+{
+	struct devindex_slot *slot;
+	char key[DEVINDEX_KEY_LEN];
+	struct devid id;
+
+	if (devid_read(disk, &id))
+		return NULL;
+
+	devid_key(&id, key);
+	slot = devindex_find(idx, key);
+	return slot ? &idx->devs[slot->dev] : NULL;
+}
+
+static void devindex_add(struct devindex *idx, struct devindex *old,
+			 const char *disk, const struct devid *id)
+{
+	struct devindex_dev *d = &idx->devs[idx->nr_devs];
+	char key[DEVINDEX_KEY_LEN];
+	int numa_node;
+	__u32 i;
+
+	snprintf(d->serial, sizeof(d->serial), "%s", id->serial);
+	snprintf(d->path, sizeof(d->path), "/dev/%.*s",
+		 (int)sizeof(d->path) - 6, disk);
+	d->nsid = id->nsid;
+	fleet_disk_topology(disk, d->ctrl, &numa_node);
+
+	/* the LR layout belongs to the drive, not to the path it had */
+	for (i = 0; old && i < old->nr_devs; i++) {
+		if (strcmp(old->devs[i].serial, d->serial) ||
+		    old->devs[i].nsid != d->nsid)
+			continue;
+		memcpy(d->lr, old->devs[i].lr, sizeof(d->lr));
+		break;
+	}
+
+	devid_key(id, key);
+	devindex_insert(idx, key, idx->nr_devs);
+	if (id->serial[0]) {
+		snprintf(key, sizeof(key), "serial:%s", id->serial);
+		devindex_insert(idx, key, idx->nr_devs);
+	}
+	if (id->wwid[0]) {
+		snprintf(key, sizeof(key), "wwn:%s", id->wwid);
+		devindex_insert(idx, key, idx->nr_devs);
+	}
+	if (id->eui[0]) {
+		snprintf(key, sizeof(key), "eui:%s", id->eui);
+		devindex_insert(idx, key, idx->nr_devs);
+	}
+	idx->nr_devs++;
+}
+
+/*
+ * Walk /sys/block once and write a fresh index next to the old one, then
+ * rename it into place so readers that have the old one mapped are fine.
+ */
+static int __devindex_rebuild(void)
+{
+	struct devindex *idx, *old;
+	char path[PATH_MAX];
+	struct dirent *de;
+	struct devid id;
+	ssize_t n;
+	size_t done = 0;
+	int fd, oldfd = -1, err = 0;
+	DIR *dir;
+
+	idx = calloc(1, sizeof(*idx));
+	if (!idx)
+		return -ENOMEM;
+	idx->magic = DEVINDEX_MAGIC;
+
+	dir = opendir("/sys/block");
+	if (!dir) {
+		err = -errno;
+		free(idx);
+		return err;
+	}
+
+	err = mkdir_parents(SED_OPAL_STATE_DIR);
+	if (err) {
+		fprintf(stderr, "Could not create %s: %s\n", SED_OPAL_STATE_DIR,
+			strerror(-err));
+		goto out;
+	}
+
+	old = devindex_map(&oldfd, true);
+	while ((de = readdir(dir))) {
+		if (de->d_name[0] == '.')
+			continue;
+		/* loop, dm, md and friends have no device of their own */
+		snprintf(path, sizeof(path), "/sys/block/%s/device", de->d_name);
+		if (access(path, F_OK) || devid_read(de->d_name, &id))
+			continue;
+		if (idx->nr_devs == DEVINDEX_MAX_DEVS) {
+			fprintf(stderr, "Device index full, ignoring %s\n", de->d_name);
+			continue;
+		}
+		devindex_add(idx, old, de->d_name, &id);
+	}
+
+	snprintf(path, sizeof(path), "%s.tmp", DEVINDEX_FILE);
+	fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+	if (fd < 0) {
+		err = -errno;
+		perror(path);
+		goto unmap;
+	}
+	while (done < sizeof(*idx)) {
+		n = write(fd, (char *)idx + done, sizeof(*idx) - done);
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n <= 0) {
+			err = n ? -errno : -EIO;
+			break;
+		}
+		done += n;
+	}
+	if (!err && fsync(fd))
+		err = -errno;
+	close(fd);
+	if (!err && rename(path, DEVINDEX_FILE))
+		err = -errno;
+	if (err) {
+		fprintf(stderr, "Could not write %s: %s\n", DEVINDEX_FILE, strerror(-err));
+		unlink(path);
+	}
+ unmap:
+	if (old)
+		devindex_unmap(old, oldfd);
+ out:
+	closedir(dir);
+	free(idx);
+	return err;
+}
+
+int devindex_rebuild(void)
+{
+	int err;
+
+	pthread_mutex_lock(&devindex_lock);
+	err = __devindex_rebuild();
+	pthread_mutex_unlock(&devindex_lock);
+	return err;
+}
+
+/*
+ * Resolve "serial:", "wwn:" or "eui:" to the current device path. The index
+ * is rebuilt when it's missing, doesn't know the key, or when the device it
+ * points at turns out to have been renumbered since.
+ */
+int devindex_resolve(const char *key, char *path, size_t len)
+{
+	struct devindex_slot *slot;
+	struct devindex_dev *d;
+	struct devindex *idx;
+	struct devid id;
+	bool rebuilt = false;
+	int fd, err;
+
+	for (;;) {
+		idx = devindex_map(&fd, false);
+		if (idx) {
+			slot = devindex_find(idx, key);
+			if (slot) {
+				d = &idx->devs[slot->dev];
+				if (!devid_read(d->path + strlen("/dev/"), &id) &&
+				    !strcmp(id.serial, d->serial) && id.nsid == d->nsid) {
+					snprintf(path, len, "%s", d->path);
+					devindex_unmap(idx, fd);
+					return 0;
+				}
+			}
+			devindex_unmap(idx, fd);
+		}
+
+		if (rebuilt)
+			break;
+		err = devindex_rebuild();
+		if (err)
+			return err;
+		rebuilt = true;
+	}
+
+	fprintf(stderr, "No device with identity %s\n", key);
+	return -ENODEV;
+}
+
+int devindex_get_lr(const char *disk, __u8 lr, struct devindex_lr *out)
+{
+	struct devindex_dev *d;
+	struct devindex *idx;
+	int fd, err = -ENOENT;
+
+	if (lr >= OPAL_MAX_LRS)
+		return -EINVAL;
+
+	idx = devindex_map(&fd, false);
+	if (!idx)
+		return -ENOENT;
+
+	d = devindex_find_disk(idx, disk);
+	if (d && d->lr[lr].valid) {
+		*out = d->lr[lr];
+		err = 0;
+	}
+	devindex_unmap(idx, fd);
+	return err;
+}
+
+static int devindex_update(const char *disk, __u8 lr, __u64 start,
+			   __u64 length, bool clear)
+{
+	struct devindex_dev *d = NULL;
+	struct devindex *idx = NULL;
+	bool rebuilt = false;
+	unsigned int i;
+	int fd, err = 0;
+
+	pthread_mutex_lock(&devindex_lock);
+	for (;;) {
+		idx = devindex_map(&fd, true);
+		if (idx) {
+			d = devindex_find_disk(idx, disk);
+			if (d)
+				break;
+			devindex_unmap(idx, fd);
+		}
+		err = rebuilt ? -ENOENT : __devindex_rebuild();
+		if (err)
+			goto out;
+		rebuilt = true;
+	}
+
+	if (clear) {
+		/* a TPer revert takes every namespace behind it along */
+		for (i = 0; i < idx->nr_devs; i++)
+			if (!strcmp(idx->devs[i].serial, d->serial))
+				memset(idx->devs[i].lr, 0, sizeof(idx->devs[i].lr));
+	} else {
+		d->lr[lr].range_start = start;
+		d->lr[lr].range_length = length;
+		d->lr[lr].valid = 1;
+	}
+	msync(idx, sizeof(*idx), MS_SYNC);
+	devindex_unmap(idx, fd);
+ out:
+	pthread_mutex_unlock(&devindex_lock);
+	return err;
+}
+
+int devindex_set_lr(const char *disk, __u8 lr, __u64 start, __u64 length)
+{
+	if (lr >= OPAL_MAX_LRS)
+		return -EINVAL;
+	return devindex_update(disk, lr, start, length, false);
+}
+
+int devindex_clear_lrs(const char *disk)
+{
+	return devindex_update(disk, 0, 0, 0, true);
+}
+
+void devindex_list(void)
+{
+	struct devindex_slot *slot;
+	struct devindex_dev *d;
+	struct devindex *idx;
+	unsigned int i, lr;
+	int fd;
+
+	idx = devindex_map(&fd, false);
+	if (!idx) {
+		fprintf(stderr, "No device index at %s\n", DEVINDEX_FILE);
+		return;
+	}
+
+	for (i = 0; i < DEVINDEX_SLOTS; i++) {
+		slot = &idx->slots[i];
+		if (!slot->key[0])
+			continue;
+		d = &idx->devs[slot->dev];
+		printf("%-48s %-16s %s\n", slot->key, d->path, d->ctrl);
+	}
+
+	for (i = 0; i < idx->nr_devs; i++) {
+		d = &idx->devs[i];
+		for (lr = 0; lr < OPAL_MAX_LRS; lr++)
+			if (d->lr[lr].valid)
+				printf("%s LR%u: start %llu length %llu\n", d->path, lr,
+				       d->lr[lr].range_start, d->lr[lr].range_length);
+	}
+	devindex_unmap(idx, fd);
+}
@@ -0,0 +1,77 @@
+#ifndef _DEVINDEX_H
+#define _DEVINDEX_H
+
+#include <linux/types.h>
+
+#include "sed-opal.h"
+#include "fleet.h"
+
+#define SED_OPAL_STATE_DIR	"/var/lib/sed-opal"
+#define DEVINDEX_FILE		SED_OPAL_STATE_DIR "/devindex"
+#define DEVINDEX_MAGIC		0x3130305844494553ULL	/* "SEDIX001" */
+#define DEVINDEX_MAX_DEVS	512
+#define DEVINDEX_SLOTS		2048	/* power of two, > 3 keys per dev */
+#define DEVINDEX_ID_LEN		160
+#define DEVINDEX_KEY_LEN	184
+#define DEVINDEX_PATH_LEN	64
+
+/*
+ * Stable identifiers of a disk as reported by sysfs. For NVMe the serial is
+ * the controller's, so namespaces are told apart by nsid.
+ */
+struct devid {
+	char serial[DEVINDEX_ID_LEN];
+	char wwid[DEVINDEX_ID_LEN];
+	char eui[DEVINDEX_ID_LEN];
+	char model[DEVINDEX_ID_LEN];
+	char firmware[DEVINDEX_ID_LEN];
+	__u32 nsid;
+};
+
+struct devindex_lr {
+	__u64 range_start;
+	__u64 range_length;
+	__u32 valid;
+	__u32 __align;
+};
+
+struct devindex_dev {
+	char serial[DEVINDEX_ID_LEN];
+	__u32 nsid;
+	__u32 __align;
+	char path[DEVINDEX_PATH_LEN];
+	char ctrl[FLEET_NAME_LEN];
+	struct devindex_lr lr[OPAL_MAX_LRS];
+};
+
+struct devindex_slot {
+	char key[DEVINDEX_KEY_LEN];	/* "serial:...", "wwn:..." or "eui:..." */
+	__s32 dev;
+	__u32 __align;
+};
+
+/*
+ * On-disk (and mmap()ed) layout: header, device table, then an open
+ * addressing hash table of identifiers pointing into the device table.
+ */
+struct devindex {
+	__u64 magic;
+	__u32 nr_devs;
+	__u32 nr_slots;
+	struct devindex_dev devs[DEVINDEX_MAX_DEVS];
+	struct devindex_slot slots[DEVINDEX_SLOTS];
+};
+
+int mkdir_parents(const char *path);
+int devid_read(const char *disk, struct devid *id);
+void devid_key(const struct devid *id, char *key);
+unsigned int devindex_hash(const char *key);
+int devindex_is_key(const char *str);
+int devindex_rebuild(void);
+int devindex_resolve(const char *key, char *path, size_t len);
+int devindex_get_lr(const char *disk, __u8 lr, struct devindex_lr *out);
+int devindex_set_lr(const char *disk, __u8 lr, __u64 start, __u64 length);
+int devindex_clear_lrs(const char *disk);
+void devindex_list(void);
+
+#endif
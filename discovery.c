@@ -0,0 +1,311 @@
+#include <sys/types.h>
+#include <sys/ioctl.h>
+#include <linux/nvme_ioctl.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+
+#include "discovery.h"
+#include "sed-opal.h"
+#include "ioctlcaps.h"
+
+#define NVME_SECURITY_RECV	0x82
+#define TCG_PROTOCOL_1		0x01
+#define TCG_LEVEL0_COMID	0x0001
+
+/* Level 0 header is 48 bytes, every feature descriptor has a 4 byte one */
+#define L0_HEADER_LEN		48
+#define L0_FEAT_HEADER_LEN	4
+
+enum {
+	FC_TPER		= 0x0001,
+	FC_LOCKING	= 0x0002,
+	FC_GEOMETRY	= 0x0003,
+	FC_ENTERPRISE	= 0x0100,
+	FC_OPAL1	= 0x0200,
+	FC_SUM		= 0x0201,
+	FC_OPAL2	= 0x0203,
+	FC_OPALITE	= 0x0301,
+	FC_PYRITE1	= 0x0302,
+	FC_PYRITE2	= 0x0303,
+	FC_RUBY		= 0x0304,
+	FC_BLOCK_SID	= 0x0402,
+};
+
+static __u16 be16(const unsigned char *p)
+{
+	return p[0] << 8 | p[1];
+}
+
+static __u32 be32(const unsigned char *p)
+{
+	return (__u32)be16(p) << 16 | be16(p + 2);
+}
+
+static __u64 be64(const unsigned char *p)
+{
+	return (__u64)be32(p) << 32 | be32(p + 4);
+}
+
+/*
+ * Ask the kernel first; kernels without IOC_OPAL_DISCOVERY get an NVMe
+ * Security Receive for protocol 1, ComID 1 sent through passthrough. When we
+ * already know the kernel lacks it we go straight to passthrough.
+ */
+int discovery_query(int fd, unsigned char *buf, size_t len)
+{
+	struct opal_discovery disc = {
+		.data = (__u64)(uintptr_t)buf,
+		.size = len,
+	};
+	struct nvme_admin_cmd cmd = {
+		.opcode = NVME_SECURITY_RECV,
+		.addr = (__u64)(uintptr_t)buf,
+		.data_len = len,
+		.cdw10 = TCG_PROTOCOL_1 << 24 | TCG_LEVEL0_COMID << 8,
+		.cdw11 = len,
+	};
+
+	struct ioctlcaps caps;
+
+	memset(buf, 0, len);
+	if ((ioctlcaps_get(fd, &caps) || ioctlcaps_has(&caps, IOC_OPAL_DISCOVERY)) &&
+	    ioctl(fd, IOC_OPAL_DISCOVERY, &disc) >= 0)
+		return 0;
+	if (ioctl(fd, NVME_IOCTL_ADMIN_CMD, &cmd) == 0)
+		return 0;
+	return errno ? -errno : -EIO;
+}
+
+int discovery_parse(const unsigned char *buf, size_t len, struct discovery *d)
+{
+	const unsigned char *feat, *data;
+	size_t end, off, flen;
+	__u16 code;
+
+	memset(d, 0, sizeof(*d));
+	if (len < L0_HEADER_LEN)
+		return -EINVAL;
+	/* the length field doesn't count itself */
+	end = be32(buf) + 4;
+	if (end < L0_HEADER_LEN || end > len)
+		return -EINVAL;
+
+	for (off = L0_HEADER_LEN; off + L0_FEAT_HEADER_LEN <= end; off += flen) {
+		feat = buf + off;
+		code = be16(feat);
+		flen = L0_FEAT_HEADER_LEN + feat[3];
+		if (off + flen > end)
+			break;
+		data = feat + L0_FEAT_HEADER_LEN;
+
+		switch (code) {
+		case FC_TPER:
+			d->tper = data[0];
+			break;
+		case FC_LOCKING:
+			d->has_locking = 1;
+			d->locking = data[0];
+			break;
+		case FC_GEOMETRY:
+			if (feat[3] < 28)
+				break;
+			d->has_geometry = 1;
+			d->align_required = data[0] & 1;
+			d->lbs = be32(data + 8);
+			d->align_granularity = be64(data + 12);
+			d->lowest_aligned_lba = be64(data + 20);
+			break;
+		case FC_ENTERPRISE:
+			d->ssc |= DISC_ENTERPRISE;
+			goto comid;
+		case FC_OPAL1:
+			d->ssc |= DISC_OPAL1;
+			goto comid;
+		case FC_SUM:
+			if (feat[3] < 5)
+				break;
+			d->has_sum = 1;
+			d->sum_objects = be32(data);
+			d->sum_flags = data[4];
+			break;
+		case FC_OPAL2:
+			d->ssc |= DISC_OPAL2;
+			goto users;
+		case FC_OPALITE:
+			d->ssc |= DISC_OPALITE;
+			goto comid;
+		case FC_PYRITE1:
+			d->ssc |= DISC_PYRITE1;
+			goto comid;
+		case FC_PYRITE2:
+			d->ssc |= DISC_PYRITE2;
+			goto comid;
+		case FC_RUBY:
+			d->ssc |= DISC_RUBY;
+			goto users;
+		case FC_BLOCK_SID:
+			d->block_sid = 1;
+			break;
+		}
+		continue;
+ users:
+		if (feat[3] >= 9) {
+			d->admins = be16(data + 5);
+			d->users = be16(data + 7);
+		}
+ comid:
+		if (feat[3] >= 4) {
+			d->base_comid = be16(data);
+			d->nr_comids = be16(data + 2);
+		}
+	}
+	d->magic = DISCOVERY_MAGIC;
+	return 0;
+}
+
+static int discovery_path(const char *disk, char *path, size_t len)
+{
+	char key[2 * DEVINDEX_ID_LEN + 1], *p;
+	struct devid id;
+
+	if (devid_read(disk, &id) || !id.serial[0])
+		return -ENOENT;
+	snprintf(key, sizeof(key), "%s_%s", id.serial, id.firmware);
+	for (p = key; *p; p++)
+		if (*p == '/' || *p == ' ')
+			*p = '_';
+	snprintf(path, len, "%s/%s", DISCOVERY_DIR, key);
+	return 0;
+}
+
+int discovery_cached(const char *disk, struct discovery *d)
+{
+	char path[PATH_MAX];
+	int fd, ret;
+
+	if (discovery_path(disk, path, sizeof(path)))
+		return -ENOENT;
+	fd = open(path, O_RDONLY | O_CLOEXEC);
+	if (fd < 0)
+		return -errno;
+	ret = read(fd, d, sizeof(*d));
+	close(fd);
+	if (ret != sizeof(*d) || d->magic != DISCOVERY_MAGIC)
+		return -ESTALE;
+	return 0;
+}
+
+static void discovery_store(const char *disk, const struct discovery *live)
+{
+	char path[PATH_MAX], tmp[PATH_MAX + 4];
+	struct discovery cached = *live, *d = &cached;
+	int fd;
+
+	cached.locking &= DISC_LOCKING_STATIC;
+	cached.live = 0;
+
+	if (discovery_path(disk, path, sizeof(path)) || mkdir_parents(DISCOVERY_DIR))
+		return;
+	snprintf(tmp, sizeof(tmp), "%s.tmp", path);
+	fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+	if (fd < 0)
+		return;
+	if (write(fd, d, sizeof(*d)) != sizeof(*d) || close(fd) ||
+	    rename(tmp, path))
+		unlink(tmp);
+}
+
+int discovery_get(const char *disk, int fd, bool refresh, struct discovery *d)
+{
+	unsigned char buf[DISCOVERY_BUF_LEN];
+	int err;
+
+	if (!refresh && !discovery_cached(disk, d))
+		return 0;
+
+	err = discovery_query(fd, buf, sizeof(buf));
+	if (!err)
+		err = discovery_parse(buf, sizeof(buf), d);
+	if (err)
+		return err;
+	d->live = 1;
+	discovery_store(disk, d);
+	return 0;
+}
+
+/*
+ * Refuse what the cached capabilities say can't work, without going to the
+ * drive. Drives we haven't run discovery on are let through.
+ */
+int discovery_check(const char *disk, __u8 lr, bool sum)
+{
+	struct discovery d;
+
+	if (discovery_cached(disk, &d))
+		return 0;
+	if (!d.has_locking || !(d.locking & DISC_LOCKING_SUPPORTED)) {
+		fprintf(stderr, "%s: drive has no Locking feature\n", disk);
+		return -EOPNOTSUPP;
+	}
+	if (sum && !d.has_sum) {
+		fprintf(stderr, "%s: drive doesn't support Single User Mode\n", disk);
+		return -EOPNOTSUPP;
+	}
+	if (d.has_sum && d.sum_objects && lr >= d.sum_objects) {
+		fprintf(stderr, "%s: drive only has %u locking ranges\n", disk,
+			d.sum_objects);
+		return -EINVAL;
+	}
+	return 0;
+}
+
+void discovery_print(const char *name, const struct discovery *d)
+{
+	static const char * const sscs[] = {
+		"Enterprise", "Opal 1", "Opal 2", "Opalite", "Pyrite 1",
+		"Pyrite 2", "Ruby",
+	};
+	unsigned int i;
+
+	printf("%s:\n  SSC:", name);
+	for (i = 0; i < sizeof(sscs) / sizeof(sscs[0]); i++)
+		if (d->ssc & (1 << i))
+			printf(" %s", sscs[i]);
+	printf("%s\n", d->ssc ? "" : " none");
+	if (d->base_comid)
+		printf("  ComID: 0x%04x (%u)\n", d->base_comid, d->nr_comids);
+	if (d->admins || d->users)
+		printf("  Locking SP authorities: %u admin, %u user\n",
+		       d->admins, d->users);
+	if (d->has_locking && !d->live)
+		printf("  Locking: %s%s, state unknown (cached, --refresh to read it)\n",
+		       d->locking & DISC_LOCKING_SUPPORTED ? "supported" : "unsupported",
+		       d->locking & DISC_MEDIA_ENCRYPTION ? ", media encryption" : "");
+	else if (d->has_locking)
+		printf("  Locking: %s%s%s%s%s%s\n",
+		       d->locking & DISC_LOCKING_SUPPORTED ? "supported" : "unsupported",
+		       d->locking & DISC_LOCKING_ENABLED ? ", enabled" : "",
+		       d->locking & DISC_LOCKED ? ", locked" : "",
+		       d->locking & DISC_MEDIA_ENCRYPTION ? ", media encryption" : "",
+		       d->locking & DISC_MBR_ENABLED ? ", MBR shadow enabled" : "",
+		       d->locking & DISC_MBR_DONE ? ", MBR done" : "");
+	else
+		printf("  Locking: no feature descriptor\n");
+	if (d->has_sum)
+		printf("  Single User Mode: %u locking objects%s\n", d->sum_objects,
+		       d->sum_flags & 1 ? ", any in SUM" :
+		       d->sum_flags & 2 ? ", all in SUM" : "");
+	if (d->has_geometry)
+		printf("  Geometry: %u-byte blocks, granularity %llu, lowest "
+		       "aligned LBA %llu%s\n", d->lbs, d->align_granularity,
+		       d->lowest_aligned_lba,
+		       d->align_required ? ", alignment required" : "");
+	if (d->block_sid)
+		printf("  Block SID authentication\n");
+}
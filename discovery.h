@@ -0,0 +1,66 @@
+#ifndef _DISCOVERY_H
+#define _DISCOVERY_H
+
+#include <linux/types.h>
+#include <stdbool.h>
+
+#include "devindex.h"
+
+/*
+ * TCG Level 0 discovery: which SSC a drive implements and what its Locking
+ * feature can do. Parsed results are kept per serial and firmware revision,
+ * since a firmware update is the only thing that changes them; the Locking
+ * feature's state bits change all the time and aren't kept.
+ */
+#define DISCOVERY_DIR		SED_OPAL_STATE_DIR "/discovery"
+#define DISCOVERY_MAGIC		0x32304353	/* "SC02" */
+#define DISCOVERY_BUF_LEN	2048
+
+/* SSCs, from the feature codes */
+#define DISC_ENTERPRISE		(1 << 0)
+#define DISC_OPAL1		(1 << 1)
+#define DISC_OPAL2		(1 << 2)
+#define DISC_OPALITE		(1 << 3)
+#define DISC_PYRITE1		(1 << 4)
+#define DISC_PYRITE2		(1 << 5)
+#define DISC_RUBY		(1 << 6)
+
+/* Locking feature flags, as in the descriptor */
+#define DISC_LOCKING_SUPPORTED	(1 << 0)
+#define DISC_LOCKING_ENABLED	(1 << 1)
+#define DISC_LOCKED		(1 << 2)
+#define DISC_MEDIA_ENCRYPTION	(1 << 3)
+#define DISC_MBR_ENABLED	(1 << 4)
+#define DISC_MBR_DONE		(1 << 5)
+#define DISC_LOCKING_STATIC	(DISC_LOCKING_SUPPORTED | DISC_MEDIA_ENCRYPTION)
+
+struct discovery {
+	__u32 magic;
+	__u32 ssc;
+	__u8 tper;
+	__u8 locking;
+	__u8 has_locking;
+	__u8 has_sum;
+	__u8 sum_flags;
+	__u8 has_geometry;
+	__u8 align_required;
+	__u8 block_sid;
+	__u8 live;		/* locking state bits are valid: not from the cache */
+	__u32 sum_objects;	/* locking objects SUM covers, the LRs */
+	__u16 base_comid;
+	__u16 nr_comids;
+	__u16 admins;
+	__u16 users;
+	__u32 lbs;
+	__u64 align_granularity;
+	__u64 lowest_aligned_lba;
+};
+
+int discovery_query(int fd, unsigned char *buf, size_t len);
+int discovery_parse(const unsigned char *buf, size_t len, struct discovery *d);
+int discovery_get(const char *disk, int fd, bool refresh, struct discovery *d);
+int discovery_cached(const char *disk, struct discovery *d);
+int discovery_check(const char *disk, __u8 lr, bool sum);
+void discovery_print(const char *name, const struct discovery *d);
+
+#endif
@@ -0,0 +1,144 @@
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/ioctl.h>
+#include <sys/sysmacros.h>
+#include <linux/dm-ioctl.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+
+#include "dmlr.h"
+#include "blkrange.h"
+
+/* one linear target and its "major:minor offset" parameters */
+struct dmlr_table {
+	struct dm_ioctl dmi;
+	struct dm_target_spec spec;
+	char params[64];
+};
+
+static void dmlr_init(struct dm_ioctl *dmi, size_t size, const char *disk,
+		      __u8 lr)
+{
+	memset(dmi, 0, size);
+	dmi->version[0] = DM_VERSION_MAJOR;
+	dmi->version[1] = 0;
+	dmi->version[2] = 0;
+	dmi->data_size = size;
+	dmi->data_start = sizeof(*dmi);
+	snprintf(dmi->name, sizeof(dmi->name), DMLR_PREFIX "%s-lr%u", disk, lr);
+}
+
+static int dmlr_ioctl(int ctl, unsigned long cmd, struct dm_ioctl *dmi)
+{
+	return ioctl(ctl, cmd, dmi) ? -errno : 0;
+}
+
+/*
+ * Create the device, or reload it if it's there already (the LR may have
+ * been set up over a different range since), then resume it to make the
+ * table live. dm works in 512-byte sectors whatever the disk's LBA size.
+ */
+int dmlr_create(const char *disk, int fd, __u8 lr, bool ro, char *node,
+		size_t len)
+{
+	struct dmlr_table t;
+	struct dm_ioctl dmi;
+	__u64 start, length;
+	struct stat st;
+	int ctl, err;
+	bool created = false;
+
+	if (!lr)
+		return -EINVAL;
+	err = blkrange_lr(disk, fd, lr, &start, &length);
+	if (err)
+		return err;
+	if (!length || start % 512 || length % 512)
+		return -EINVAL;
+	if (fstat(fd, &st))
+		return -errno;
+
+	ctl = open(DMLR_CONTROL, O_RDWR | O_CLOEXEC);
+	if (ctl < 0)
+		return -errno;
+
+	dmlr_init(&dmi, sizeof(dmi), disk, lr);
+	snprintf(dmi.uuid, sizeof(dmi.uuid), "SEDOPAL-%.120s", dmi.name);
+	err = dmlr_ioctl(ctl, DM_DEV_CREATE, &dmi);
+	if (!err)
+		created = true;
+	else if (err != -EBUSY)
+		goto out;
+
+	dmlr_init(&t.dmi, sizeof(t), disk, lr);
+	t.dmi.target_count = 1;
+	if (ro)
+		t.dmi.flags |= DM_READONLY_FLAG;
+	t.spec.sector_start = 0;
+	t.spec.length = length / 512;
+	t.spec.next = 0;
+	snprintf(t.spec.target_type, sizeof(t.spec.target_type), "linear");
+	snprintf(t.params, sizeof(t.params), "%u:%u %llu", major(st.st_rdev),
+		 minor(st.st_rdev), start / 512);
+	err = dmlr_ioctl(ctl, DM_TABLE_LOAD, &t.dmi);
+	if (err)
+		goto undo;
+
+	dmlr_init(&dmi, sizeof(dmi), disk, lr);
+	err = dmlr_ioctl(ctl, DM_DEV_SUSPEND, &dmi);	/* no SUSPEND_FLAG: resume */
+	if (err)
+		goto undo;
+	if (node)
+		snprintf(node, len, "/dev/dm-%u", minor(dmi.dev));
+	close(ctl);
+	return 0;
+ undo:
+	if (created) {
+		dmlr_init(&dmi, sizeof(dmi), disk, lr);
+		dmlr_ioctl(ctl, DM_DEV_REMOVE, &dmi);
+	}
+ out:
+	close(ctl);
+	return err;
+}
+
+/* 1, and whether it's read-only, if the LR is mapped; 0 if it isn't */
+int dmlr_status(const char *disk, __u8 lr, bool *ro)
+{
+	struct dm_ioctl dmi;
+	int ctl, err;
+
+	ctl = open(DMLR_CONTROL, O_RDWR | O_CLOEXEC);
+	if (ctl < 0)
+		return errno == ENOENT || errno == ENODEV ? 0 : -errno;
+	dmlr_init(&dmi, sizeof(dmi), disk, lr);
+	err = dmlr_ioctl(ctl, DM_DEV_STATUS, &dmi);
+	close(ctl);
+	if (err)
+		return err == -ENXIO ? 0 : err;
+	*ro = dmi.flags & DM_READONLY_FLAG;
+	return 1;
+}
+
+/*
+ * A mapping that isn't there is fine, and there's none without a control
+ * node or device-mapper in the kernel. One that's still open is not fine.
+ */
+int dmlr_remove(const char *disk, __u8 lr)
+{
+	struct dm_ioctl dmi;
+	int ctl, err;
+
+	ctl = open(DMLR_CONTROL, O_RDWR | O_CLOEXEC);
+	if (ctl < 0)
+		return errno == ENOENT || errno == ENODEV ? 0 : -errno;
+	dmlr_init(&dmi, sizeof(dmi), disk, lr);
+	err = dmlr_ioctl(ctl, DM_DEV_REMOVE, &dmi);
+	close(ctl);
+	return err == -ENXIO ? 0 : err;
+}
@@ -0,0 +1,21 @@
+#ifndef _DMLR_H
+#define _DMLR_H
+
+#include <stdbool.h>
+#include <linux/types.h>
+
+#define DMLR_CONTROL	"/dev/mapper/control"
+#define DMLR_PREFIX	"sed-"		/* sed-nvme0n1-lr1 */
+
+/*
+ * A dm-linear device per unlocked LR, covering exactly the LR's range of
+ * the disk, so consumers get a correctly bounded block device no matter
+ * how the disk is partitioned. Talks to device-mapper's ioctl interface
+ * directly.
+ */
+int dmlr_create(const char *disk, int fd, __u8 lr, bool ro, char *node,
+		size_t len);
+int dmlr_status(const char *disk, __u8 lr, bool *ro);
+int dmlr_remove(const char *disk, __u8 lr);
+
+#endif
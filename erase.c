@@ -0,0 +1,142 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+
+#include "erase.h"
+
+/* weight of the newest sample in the moving average */
+#define ERASE_HIST_ALPHA 0.25
+
+static struct erase_model *erase_hist_find(struct erase_hist *hist,
+					   const char *model, int secure)
+{
+	unsigned int i;
+
+	for (i = 0; i < hist->nr; i++)
+		if (hist->models[i].secure == secure &&
+		    !strcmp(hist->models[i].model, model))
+			return &hist->models[i];
+	return NULL;
+}
+
+static struct erase_model *erase_hist_add(struct erase_hist *hist,
+					  const char *model, int secure)
+{
+	struct erase_model *m;
+
+	m = realloc(hist->models, (hist->nr + 1) * sizeof(*m));
+	if (!m)
+		return NULL;
+	hist->models = m;
+	m = &hist->models[hist->nr++];
+	memset(m, 0, sizeof(*m));
+	snprintf(m->model, sizeof(m->model), "%s", model);
+	m->secure = secure;
+	return m;
+}
+
+/* one model per line: "<secure> <ms> <samples> <model>" */
+int erase_hist_load(struct erase_hist *hist)
+{
+	char *line = NULL, model[DEVINDEX_ID_LEN];
+	struct erase_model *m;
+	unsigned int samples;
+	size_t len = 0;
+	int secure, n;
+	double ms;
+	FILE *f;
+
+	memset(hist, 0, sizeof(*hist));
+	f = fopen(ERASE_HIST_FILE, "r");
+	if (!f)
+		return errno == ENOENT ? 0 : -errno;
+
+	while (getline(&line, &len, f) > 0) {
+		if (sscanf(line, "%d %lf %u %n", &secure, &ms, &samples, &n) != 3)
+			continue;
+		snprintf(model, sizeof(model), "%s", line + n);
+		model[strcspn(model, "\n")] = '\0';
+		m = erase_hist_add(hist, model, secure);
+		if (!m)
+			break;
+		m->ms = ms;
+		m->samples = samples;
+	}
+	free(line);
+	fclose(f);
+	return 0;
+}
+
+/*
+ * Best guess for one erase on this model: what we've seen it take before,
+ * else the average over every model we know of, else 0 (unknown).
+ */
+double erase_hist_estimate(struct erase_hist *hist, const char *model, int secure)
+{
+	struct erase_model *m;
+	unsigned int i, n = 0;
+	double sum = 0;
+
+	m = erase_hist_find(hist, model, secure);
+	if (m)
+		return m->ms;
+
+	for (i = 0; i < hist->nr; i++) {
+		if (hist->models[i].secure != secure)
+			continue;
+		sum += hist->models[i].ms;
+		n++;
+	}
+	return n ? sum / n : 0;
+}
+
+void erase_hist_update(struct erase_hist *hist, const char *model, int secure,
+		       double ms)
+{
+	struct erase_model *m;
+
+	m = erase_hist_find(hist, model, secure);
+	if (!m) {
+		m = erase_hist_add(hist, model, secure);
+		if (!m)
+			return;
+		m->ms = ms;
+	} else
+		m->ms += ERASE_HIST_ALPHA * (ms - m->ms);
+	m->samples++;
+}
+
+int erase_hist_save(struct erase_hist *hist)
+{
+	char tmp[sizeof(ERASE_HIST_FILE) + 4];
+	unsigned int i;
+	FILE *f;
+	int err;
+
+	err = mkdir_parents(SED_OPAL_STATE_DIR);
+	if (err)
+		return err;
+
+	snprintf(tmp, sizeof(tmp), "%s.tmp", ERASE_HIST_FILE);
+	f = fopen(tmp, "w");
+	if (!f)
+		return -errno;
+	for (i = 0; i < hist->nr; i++)
+		fprintf(f, "%d %.1f %u %s\n", hist->models[i].secure,
+			hist->models[i].ms, hist->models[i].samples,
+			hist->models[i].model);
+	if (fclose(f) || rename(tmp, ERASE_HIST_FILE)) {
+		err = -errno;
+		unlink(tmp);
+		return err;
+	}
+	return 0;
+}
+
+void erase_hist_free(struct erase_hist *hist)
+{
+	free(hist->models);
+	memset(hist, 0, sizeof(*hist));
+}
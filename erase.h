@@ -0,0 +1,31 @@
+#ifndef _ERASE_H
+#define _ERASE_H
+
+#include "devindex.h"
+
+/*
+ * Observed erase latency per drive model, kept across runs so that the
+ * erase scheduler can estimate how long a batch is going to take.
+ */
+#define ERASE_HIST_FILE	SED_OPAL_STATE_DIR "/erase-latency"
+
+struct erase_model {
+	char model[DEVINDEX_ID_LEN];
+	int secure;
+	double ms;		/* moving average */
+	unsigned int samples;
+};
+
+struct erase_hist {
+	unsigned int nr;
+	struct erase_model *models;
+};
+
+int erase_hist_load(struct erase_hist *hist);
+double erase_hist_estimate(struct erase_hist *hist, const char *model, int secure);
+void erase_hist_update(struct erase_hist *hist, const char *model, int secure,
+		       double ms);
+int erase_hist_save(struct erase_hist *hist);
+void erase_hist_free(struct erase_hist *hist);
+
+#endif
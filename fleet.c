@@ -0,0 +1,470 @@
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/sysmacros.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <libgen.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sched.h>
+
+#include "fleet.h"
+#include "throttle.h"
+#include "devindex.h"
+
+struct fleet_work {
+	struct fleet *fleet;
+	struct fleet_ctrl *ctrl;
+	fleet_fn fn;
+	void *arg;
+	pthread_t thread;
+	bool started;
+};
+
+/* start barrier for fleet_run_parallel */
+struct fleet_gate {
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	bool open;
+	bool abort;
+};
+
+struct fleet_par {
+	struct fleet_gate *gate;
+	struct fleet_dev *dev;
+	fleet_fn fn;
+	void *arg;
+	pthread_t thread;
+	bool started;
+};
+
+static int sysfs_read_int(const char *dir, const char *attr, int *val)
+{
+	char path[PATH_MAX + FLEET_NAME_LEN];
+	FILE *f;
+	int ret;
+
+	snprintf(path, sizeof(path), "%s/%s", dir, attr);
+	f = fopen(path, "r");
+	if (!f)
+		return -errno;
+	ret = fscanf(f, "%d", val) == 1 ? 0 : -EINVAL;
+	fclose(f);
+	return ret;
+}
+
+/*
+ * Given the sysfs directory of a disk (or partition), resolve the disk, the
+ * controller that owns its TPer and the NUMA node the controller is attached
+ * to. NVMe namespaces live under their controller (nvme0) or, with native
+ * multipath, under their subsystem (nvme-subsys0), both of which share a
+ * single TPer. Anything else is its own controller.
+ */
+static void sysfs_topology(char *real, char *name, char *ctrl, int *numa_node)
+{
+	char parent[PATH_MAX + FLEET_NAME_LEN];
+	char *p;
+	int node;
+
+	/* partitions hang below their disk */
+	snprintf(parent, sizeof(parent), "%s/partition", real);
+	if (!access(parent, F_OK)) {
+		p = strrchr(real, '/');
+		if (p)
+			*p = '\0';
+	}
+
+	p = strrchr(real, '/');
+	if (!p)
+		return;
+	snprintf(name, FLEET_NAME_LEN, "%s", p + 1);
+	snprintf(ctrl, FLEET_NAME_LEN, "%s", p + 1);
+
+	snprintf(parent, sizeof(parent), "%s", real);
+	*strrchr(parent, '/') = '\0';
+	p = strrchr(parent, '/');
+	if (p && !strncmp(p + 1, "nvme", 4))
+		snprintf(ctrl, FLEET_NAME_LEN, "%s", p + 1);
+
+	while (strcmp(real, "/sys/devices") && strcmp(real, "/sys")) {
+		if (!sysfs_read_int(real, "numa_node", &node)) {
+			*numa_node = node;
+			return;
+		}
+		p = strrchr(real, '/');
+		if (!p || p == real)
+			return;
+		*p = '\0';
+	}
+}
+
+static void fleet_topology(struct fleet_dev *dev, dev_t rdev)
+{
+	char link[PATH_MAX], real[PATH_MAX];
+
+	snprintf(dev->name, sizeof(dev->name), "%s", basename(dev->path));
+	snprintf(dev->ctrl, sizeof(dev->ctrl), "%s", dev->name);
+	dev->numa_node = -1;
+
+	snprintf(link, sizeof(link), "/sys/dev/block/%u:%u", major(rdev), minor(rdev));
+	if (realpath(link, real))
+		sysfs_topology(real, dev->name, dev->ctrl, &dev->numa_node);
+}
+
+void fleet_disk_topology(const char *disk, char *ctrl, int *numa_node)
+{
+	char link[PATH_MAX], real[PATH_MAX], name[FLEET_NAME_LEN];
+
+	snprintf(ctrl, FLEET_NAME_LEN, "%s", disk);
+	*numa_node = -1;
+
+	snprintf(link, sizeof(link), "/sys/block/%s", disk);
+	if (realpath(link, real))
+		sysfs_topology(real, name, ctrl, numa_node);
+}
+
+static int fleet_open_dev(struct fleet_dev *dev, const char *path)
+{
+	struct stat _stat;
+	int err;
+
+	dev->fd = -1;
+	if (devindex_is_key(path)) {
+		err = devindex_resolve(path, dev->path, sizeof(dev->path));
+		if (err)
+			return err;
+		path = dev->path;
+	} else
+		snprintf(dev->path, sizeof(dev->path), "%s", path);
+
+	err = open(path, O_RDONLY);
+	if (err < 0)
+		goto perror;
+	dev->fd = err;
+
+	err = fstat(dev->fd, &_stat);
+	if (err < 0)
+		goto perror;
+	if (!S_ISBLK(_stat.st_mode)) {
+		fprintf(stderr, "%s is not a block device!\n", path);
+		return -ENODEV;
+	}
+
+	fleet_topology(dev, _stat.st_rdev);
+	return 0;
+ perror:
+	err = -errno;
+	perror(path);
+	return err;
+}
+
+static struct fleet_ctrl *fleet_get_ctrl(struct fleet *fleet,
+					 struct fleet_dev *dev)
+{
+	struct fleet_ctrl *ctrl;
+	unsigned int i;
+
+	for (i = 0; i < fleet->nr_ctrls; i++)
+		if (!strcmp(fleet->ctrls[i].name, dev->ctrl))
+			return &fleet->ctrls[i];
+
+	ctrl = &fleet->ctrls[fleet->nr_ctrls];
+	ctrl->devs = calloc(fleet->nr_devs, sizeof(*ctrl->devs));
+	if (!ctrl->devs)
+		return NULL;
+	snprintf(ctrl->name, sizeof(ctrl->name), "%s", dev->ctrl);
+	ctrl->numa_node = dev->numa_node;
+	fleet->nr_ctrls++;
+	return ctrl;
+}
+
+int fleet_init(struct fleet *fleet, int nr, char **paths)
+{
+	struct fleet_ctrl *ctrl;
+	int i, err;
+
+	memset(fleet, 0, sizeof(*fleet));
+	if (nr <= 0)
+		return -EINVAL;
+
+	fleet->devs = calloc(nr, sizeof(*fleet->devs));
+	fleet->ctrls = calloc(nr, sizeof(*fleet->ctrls));
+	if (!fleet->devs || !fleet->ctrls) {
+		fleet_free(fleet);
+		return -ENOMEM;
+	}
+	fleet->nr_devs = nr;
+	for (i = 0; i < nr; i++)
+		fleet->devs[i].fd = -1;
+
+	for (i = 0; i < nr; i++) {
+		err = fleet_open_dev(&fleet->devs[i], paths[i]);
+		if (err)
+			goto fail;
+
+		ctrl = fleet_get_ctrl(fleet, &fleet->devs[i]);
+		if (!ctrl) {
+			err = -ENOMEM;
+			goto fail;
+		}
+		ctrl->devs[ctrl->nr_devs++] = &fleet->devs[i];
+	}
+	return 0;
+ fail:
+	fleet_free(fleet);
+	return err;
+}
+
+int fleet_init_set(struct fleet *fleet, const char *name)
+{
+	char *line = NULL, *tok, **paths = NULL, **tmp;
+	size_t len = 0;
+	int nr = 0, err = -ENOENT;
+	FILE *f;
+
+	f = fopen(FLEET_SETS_FILE, "r");
+	if (!f) {
+		err = -errno;
+		perror(FLEET_SETS_FILE);
+		return err;
+	}
+
+	while (getline(&line, &len, f) > 0) {
+		tok = strtok(line, " \t\n");
+		if (!tok || *tok == '#' || strcmp(tok, name))
+			continue;
+
+		while ((tok = strtok(NULL, " \t\n")) && *tok != '#') {
+			tmp = realloc(paths, (nr + 1) * sizeof(*paths));
+			if (!tmp) {
+				err = -ENOMEM;
+				goto out;
+			}
+			paths = tmp;
+			paths[nr++] = strdup(tok);
+		}
+		err = nr ? 0 : -ENOENT;
+		break;
+	}
+
+	if (err == -ENOENT)
+		fprintf(stderr, "No devices for drive set '%s' in %s\n",
+			name, FLEET_SETS_FILE);
+	else if (!err)
+		err = fleet_init(fleet, nr, paths);
+ out:
+	while (nr--)
+		free(paths[nr]);
+	free(paths);
+	free(line);
+	fclose(f);
+	return err;
+}
+
+static int fleet_node_cpus(int node, cpu_set_t *set)
+{
+	char path[64];
+	unsigned int a, b;
+	FILE *f;
+	int c;
+
+	CPU_ZERO(set);
+	snprintf(path, sizeof(path), "/sys/devices/system/node/node%d/cpulist", node);
+	f = fopen(path, "r");
+	if (!f)
+		return -errno;
+
+	while (fscanf(f, "%u", &a) == 1) {
+		b = a;
+		c = fgetc(f);
+		if (c == '-') {
+			if (fscanf(f, "%u", &b) != 1)
+				break;
+			c = fgetc(f);
+		}
+		for (; a <= b && a < CPU_SETSIZE; a++)
+			CPU_SET(a, set);
+		if (c != ',')
+			break;
+	}
+	fclose(f);
+	return CPU_COUNT(set) ? 0 : -ENOENT;
+}
+
+static void fleet_run_ctrl(struct fleet_work *work)
+{
+	struct fleet_dev *dev;
+	unsigned int i;
+
+	/* with more than one worker per controller they share the queue */
+	while ((i = __atomic_fetch_add(&work->ctrl->next, 1, __ATOMIC_RELAXED)) <
+	       work->ctrl->nr_devs) {
+		dev = work->ctrl->devs[i];
+		if (throttle_wait(work->fleet->throttle, dev->name)) {
+			dev->note = "device stayed busy, not started";
+			dev->result = -1;
+			dev->err = ETIMEDOUT;
+		} else {
+			errno = 0;
+			dev->result = work->fn(dev, work->arg);
+			dev->err = errno;
+		}
+		clock_gettime(CLOCK_MONOTONIC, &dev->done);
+	}
+}
+
+static void fleet_pin(int node)
+{
+	cpu_set_t set;
+
+	if (node >= 0 && !fleet_node_cpus(node, &set))
+		pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+}
+
+static void *fleet_worker(void *data)
+{
+	struct fleet_work *work = data;
+
+	fleet_pin(work->ctrl->numa_node);
+	fleet_run_ctrl(work);
+	return NULL;
+}
+
+/*
+ * Run fn once for every device in the fleet. Each controller gets its own
+ * worker (or per_ctrl of them) which walks that controller's devices one at a
+ * time, so different TPers are driven in parallel but, by default, no TPer
+ * ever sees two sessions from us.
+ */
+int fleet_run(struct fleet *fleet, fleet_fn fn, void *arg)
+{
+	unsigned int per_ctrl = fleet->per_ctrl ? fleet->per_ctrl : 1;
+	struct fleet_work *work;
+	unsigned int i, nr = 0, n;
+
+	for (i = 0; i < fleet->nr_ctrls; i++) {
+		fleet->ctrls[i].next = 0;
+		nr += per_ctrl < fleet->ctrls[i].nr_devs ?
+			per_ctrl : fleet->ctrls[i].nr_devs;
+	}
+
+	work = calloc(nr, sizeof(*work));
+	if (!work)
+		return -ENOMEM;
+
+	for (i = 0, nr = 0; i < fleet->nr_ctrls; i++) {
+		for (n = 0; n < per_ctrl && n < fleet->ctrls[i].nr_devs; n++, nr++) {
+			work[nr].fleet = fleet;
+			work[nr].ctrl = &fleet->ctrls[i];
+			work[nr].fn = fn;
+			work[nr].arg = arg;
+		}
+	}
+
+	if (nr == 1) {
+		fleet_run_ctrl(&work[0]);
+		free(work);
+		return 0;
+	}
+
+	for (i = 0; i < nr; i++)
+		work[i].started = !pthread_create(&work[i].thread, NULL,
+						  fleet_worker, &work[i]);
+
+	/* whatever we couldn't hand to a thread runs here */
+	for (i = 0; i < nr; i++)
+		if (!work[i].started)
+			fleet_run_ctrl(&work[i]);
+
+	for (i = 0; i < nr; i++)
+		if (work[i].started)
+			pthread_join(work[i].thread, NULL);
+
+	free(work);
+	return 0;
+}
+
+static void *fleet_par_worker(void *data)
+{
+	struct fleet_par *par = data;
+	struct fleet_gate *gate = par->gate;
+	struct fleet_dev *dev = par->dev;
+	bool abort;
+
+	fleet_pin(dev->numa_node);
+
+	pthread_mutex_lock(&gate->lock);
+	while (!gate->open)
+		pthread_cond_wait(&gate->cond, &gate->lock);
+	abort = gate->abort;
+	pthread_mutex_unlock(&gate->lock);
+	if (abort)
+		return NULL;
+
+	errno = 0;
+	dev->result = par->fn(dev, par->arg);
+	dev->err = errno;
+	clock_gettime(CLOCK_MONOTONIC, &dev->done);
+	return NULL;
+}
+
+/*
+ * Run fn on every device at the same time, one thread per device. Nothing is
+ * issued until every thread is up and waiting at the start barrier; if we
+ * can't get all of them going, nothing is issued at all and -EAGAIN is
+ * returned. Devices sharing a controller are still serialised by the kernel.
+ */
+int fleet_run_parallel(struct fleet *fleet, fleet_fn fn, void *arg)
+{
+	struct fleet_gate gate = {
+		.lock = PTHREAD_MUTEX_INITIALIZER,
+		.cond = PTHREAD_COND_INITIALIZER,
+	};
+	struct fleet_par *par;
+	unsigned int i;
+
+	par = calloc(fleet->nr_devs, sizeof(*par));
+	if (!par)
+		return -ENOMEM;
+
+	for (i = 0; i < fleet->nr_devs; i++) {
+		par[i].gate = &gate;
+		par[i].dev = &fleet->devs[i];
+		par[i].fn = fn;
+		par[i].arg = arg;
+		par[i].started = !pthread_create(&par[i].thread, NULL,
+						 fleet_par_worker, &par[i]);
+		if (!par[i].started)
+			gate.abort = true;
+	}
+
+	pthread_mutex_lock(&gate.lock);
+	gate.open = true;
+	pthread_cond_broadcast(&gate.cond);
+	pthread_mutex_unlock(&gate.lock);
+
+	for (i = 0; i < fleet->nr_devs; i++)
+		if (par[i].started)
+			pthread_join(par[i].thread, NULL);
+
+	free(par);
+	return gate.abort ? -EAGAIN : 0;
+}
+
+void fleet_free(struct fleet *fleet)
+{
+	unsigned int i;
+
+	for (i = 0; fleet->devs && i < fleet->nr_devs; i++)
+		if (fleet->devs[i].fd >= 0)
+			close(fleet->devs[i].fd);
+	for (i = 0; fleet->ctrls && i < fleet->nr_ctrls; i++)
+		free(fleet->ctrls[i].devs);
+	free(fleet->devs);
+	free(fleet->ctrls);
+	memset(fleet, 0, sizeof(*fleet));
+}
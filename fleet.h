@@ -0,0 +1,60 @@
+#ifndef _FLEET_H
+#define _FLEET_H
+
+#include <limits.h>
+#include <stdbool.h>
+#include <time.h>
+
+#define FLEET_NAME_LEN 64
+
+/* one drive set per line: "<name> <device> [<device>...]", '#' comments */
+#define FLEET_SETS_FILE "/etc/sed-opal/drivesets"
+
+struct throttle;
+
+/*
+ * A fleet is the set of block devices named on the command line. Devices
+ * are grouped by the controller (TPer) that owns them so that we never have
+ * more than one outstanding session on the same controller, and each
+ * controller's worker runs on the CPUs of the NUMA node it hangs off.
+ */
+struct fleet_dev {
+	char path[PATH_MAX];
+	char name[FLEET_NAME_LEN];	/* nvme0n1 */
+	char ctrl[FLEET_NAME_LEN];	/* nvme0, nvme-subsys0 or the disk */
+	int numa_node;
+	int fd;
+	int result;
+	int err;			/* errno captured with result */
+	struct timespec done;		/* CLOCK_MONOTONIC when fn returned */
+	const char *note;		/* printed along with the result */
+	void *priv;
+};
+
+struct fleet_ctrl {
+	char name[FLEET_NAME_LEN];
+	int numa_node;
+	unsigned int nr_devs;
+	struct fleet_dev **devs;
+	unsigned int next;		/* next device to hand to a worker */
+};
+
+struct fleet {
+	unsigned int nr_devs;
+	struct fleet_dev *devs;
+	unsigned int nr_ctrls;
+	struct fleet_ctrl *ctrls;
+	struct throttle *throttle;	/* optional, checked before each device */
+	unsigned int per_ctrl;		/* concurrent devices per controller, default 1 */
+};
+
+typedef int (*fleet_fn)(struct fleet_dev *dev, void *arg);
+
+void fleet_disk_topology(const char *disk, char *ctrl, int *numa_node);
+int fleet_init(struct fleet *fleet, int nr, char **paths);
+int fleet_init_set(struct fleet *fleet, const char *name);
+int fleet_run(struct fleet *fleet, fleet_fn fn, void *arg);
+int fleet_run_parallel(struct fleet *fleet, fleet_fn fn, void *arg);
+void fleet_free(struct fleet *fleet);
+
+#endif
@@ -0,0 +1,226 @@
+#include <sys/types.h>
+#include <sys/ioctl.h>
+#include <linux/fs.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <endian.h>
+#include <pthread.h>
+
+#include "gpt.h"
+
+#define GPT_SIGNATURE		"EFI PART"
+#define GPT_HEADER_MIN		92
+#define GPT_ENTRY_MIN		128
+#define GPT_MAX_ENTRIES		4096
+
+/* 128 entries of 128 bytes: what every partitioning tool writes */
+#define GPT_DEF_ARRAY		(128 * 128)
+
+struct gpt_header {
+	char signature[8];
+	__le32 revision;
+	__le32 header_size;
+	__le32 header_crc32;
+	__le32 reserved;
+	__le64 my_lba;
+	__le64 alternate_lba;
+	__le64 first_usable_lba;
+	__le64 last_usable_lba;
+	__u8 disk_guid[16];
+	__le64 entries_lba;
+	__le32 nr_entries;
+	__le32 entry_size;
+	__le32 entries_crc32;
+} __attribute__((packed));
+
+struct gpt_entry {
+	__u8 type_guid[16];
+	__u8 part_guid[16];
+	__le64 first_lba;
+	__le64 last_lba;
+	__le64 attributes;
+	__u8 name[2 * GPT_NAME_LEN];	/* UTF-16LE */
+} __attribute__((packed));
+
+static __u32 crc32_table[256];
+
+static void crc32_init(void)
+{
+	__u32 c;
+	int i, k;
+
+	for (i = 0; i < 256; i++) {
+		c = i;
+		for (k = 0; k < 8; k++)
+			c = c & 1 ? 0xedb88320 ^ (c >> 1) : c >> 1;
+		crc32_table[i] = c;
+	}
+}
+
+/* the zlib/EFI CRC-32 */
+static __u32 crc32(const void *buf, size_t len)
+{
+	const unsigned char *p = buf;
+	__u32 c = ~0U;
+
+	static pthread_once_t once = PTHREAD_ONCE_INIT;
+
+	/* fleet workers read GPTs in parallel */
+	pthread_once(&once, crc32_init);
+	while (len--)
+		c = crc32_table[(c ^ *p++) & 0xff] ^ (c >> 8);
+	return ~c;
+}
+
+static int gpt_pread(int fd, void **buf, size_t len, off_t off)
+{
+	ssize_t n;
+
+	if (posix_memalign(buf, 4096, len))
+		return -ENOMEM;
+	n = pread(fd, *buf, len, off);
+	if (n == (ssize_t)len)
+		return 0;
+	free(*buf);
+	*buf = NULL;
+	return n < 0 ? -errno : -EIO;
+}
+
+static int gpt_check_header(struct gpt_header *h, unsigned int lbs)
+{
+	__u32 size = le32toh(h->header_size), crc = le32toh(h->header_crc32);
+	int ok;
+
+	if (memcmp(h->signature, GPT_SIGNATURE, sizeof(h->signature)) ||
+	    size < GPT_HEADER_MIN || size > lbs || le64toh(h->my_lba) != 1 ||
+	    le64toh(h->entries_lba) < 2 ||
+	    le32toh(h->entry_size) < GPT_ENTRY_MIN ||
+	    le32toh(h->entry_size) % 8 ||
+	    le32toh(h->nr_entries) > GPT_MAX_ENTRIES)
+		return -EINVAL;
+	h->header_crc32 = 0;
+	ok = crc32(h, size) == crc;
+	h->header_crc32 = htole32(crc);
+	return ok ? 0 : -EILSEQ;
+}
+
+/* the entry is packed, so the UTF-16LE name is read byte by byte */
+static void gpt_name(char *dst, const __u8 *src)
+{
+	unsigned int i;
+	__u16 c;
+
+	for (i = 0; i < GPT_NAME_LEN; i++) {
+		c = src[2 * i] | src[2 * i + 1] << 8;
+		if (!c)
+			break;
+		dst[i] = c < 0x80 && c >= 0x20 ? c : '?';
+	}
+	dst[i] = 0;
+}
+
+/*
+ * Header and entry array of the primary GPT. The array normally sits right
+ * behind the header, so both come in with a single O_DIRECT read; only a
+ * table that puts it somewhere else costs a second one. Both CRCs have to
+ * match: we're about to draw key boundaries along these numbers.
+ */
+int gpt_read(const char *path, struct gpt *g)
+{
+	void *buf = NULL, *entries;
+	struct gpt_header h;
+	struct gpt_entry *e;
+	size_t len, array;
+	__u64 entries_lba;
+	__u32 nr, esize, i;
+	int fd, err;
+
+	memset(g, 0, sizeof(*g));
+	fd = open(path, O_RDONLY | O_DIRECT | O_CLOEXEC);
+	if (fd < 0)
+		return -errno;
+	if (ioctl(fd, BLKSSZGET, &g->lbs) || !g->lbs) {
+		err = errno ? -errno : -EINVAL;
+		goto out;
+	}
+
+	len = g->lbs + (GPT_DEF_ARRAY + g->lbs - 1) / g->lbs * g->lbs;
+	err = gpt_pread(fd, &buf, len, g->lbs);
+	if (err)
+		goto out;
+	err = gpt_check_header(buf, g->lbs);
+	if (err)
+		goto out;
+	memcpy(&h, buf, sizeof(h));
+
+	nr = le32toh(h.nr_entries);
+	esize = le32toh(h.entry_size);
+	entries_lba = le64toh(h.entries_lba);
+	array = (size_t)nr * esize;
+	if (entries_lba == 2 && len - g->lbs >= array) {
+		entries = (char *)buf + g->lbs;
+	} else {
+		void *more;
+
+		err = gpt_pread(fd, &more, (array + g->lbs - 1) / g->lbs * g->lbs,
+				entries_lba * g->lbs);
+		if (err)
+			goto out;
+		free(buf);
+		buf = more;
+		entries = more;
+	}
+	if (crc32(entries, array) != le32toh(h.entries_crc32)) {
+		err = -EILSEQ;
+		goto out;
+	}
+
+	g->parts = calloc(nr ? nr : 1, sizeof(*g->parts));
+	if (!g->parts) {
+		err = -ENOMEM;
+		goto out;
+	}
+	for (i = 0; i < nr; i++) {
+		static const __u8 unused[16];
+		struct gpt_part *p = &g->parts[g->nr];
+
+		e = (struct gpt_entry *)((char *)entries + (size_t)i * esize);
+		if (!memcmp(e->type_guid, unused, sizeof(unused)))
+			continue;
+		p->index = i + 1;
+		p->first = le64toh(e->first_lba);
+		p->last = le64toh(e->last_lba);
+		if (p->last < p->first)
+			continue;
+		gpt_name(p->name, e->name);
+		g->nr++;
+	}
+	err = 0;
+ out:
+	free(buf);
+	close(fd);
+	if (err)
+		gpt_free(g);
+	return err;
+}
+
+const struct gpt_part *gpt_find(const struct gpt *g, unsigned int index)
+{
+	unsigned int i;
+
+	for (i = 0; i < g->nr; i++)
+		if (g->parts[i].index == index)
+			return &g->parts[i];
+	return NULL;
+}
+
+void gpt_free(struct gpt *g)
+{
+	free(g->parts);
+	memset(g, 0, sizeof(*g));
+}
@@ -0,0 +1,26 @@
+#ifndef _GPT_H
+#define _GPT_H
+
+#include <linux/types.h>
+
+#define GPT_NAME_LEN	36		/* UTF-16 code units in an entry */
+
+/* a used entry of the partition array, LBAs in the disk's logical blocks */
+struct gpt_part {
+	unsigned int index;		/* 1-based, as the kernel numbers them */
+	__u64 first;
+	__u64 last;			/* inclusive */
+	char name[GPT_NAME_LEN + 1];	/* ASCII, anything else as '?' */
+};
+
+struct gpt {
+	unsigned int lbs;
+	unsigned int nr;
+	struct gpt_part *parts;		/* in entry order */
+};
+
+int gpt_read(const char *path, struct gpt *g);
+const struct gpt_part *gpt_find(const struct gpt *g, unsigned int index);
+void gpt_free(struct gpt *g);
+
+#endif
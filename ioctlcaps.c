@@ -0,0 +1,142 @@
+#include <sys/types.h>
+#include <sys/ioctl.h>
+#include <sys/utsname.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+
+#include "ioctlcaps.h"
+#include "sed-opal.h"
+
+#define IOCTLCAP(c)	{ #c, c }
+
+static const struct {
+	const char *name;
+	unsigned long cmd;
+} ioctlcaps_table[] = {
+	IOCTLCAP(IOC_OPAL_SAVE),
+	IOCTLCAP(IOC_OPAL_LOCK_UNLOCK),
+	IOCTLCAP(IOC_OPAL_TAKE_OWNERSHIP),
+	IOCTLCAP(IOC_OPAL_ACTIVATE_LSP),
+	IOCTLCAP(IOC_OPAL_SET_PW),
+	IOCTLCAP(IOC_OPAL_ACTIVATE_USR),
+	IOCTLCAP(IOC_OPAL_REVERT_TPR),
+	IOCTLCAP(IOC_OPAL_LR_SETUP),
+	IOCTLCAP(IOC_OPAL_ADD_USR_TO_LR),
+	IOCTLCAP(IOC_OPAL_ENABLE_DISABLE_MBR),
+	IOCTLCAP(IOC_OPAL_ERASE_LR),
+	IOCTLCAP(IOC_OPAL_SECURE_ERASE_LR),
+	IOCTLCAP(IOC_OPAL_MBR_STATUS),
+	IOCTLCAP(IOC_OPAL_WRITE_SHADOW_MBR),
+	IOCTLCAP(IOC_OPAL_PSID_REVERT_TPR),
+	IOCTLCAP(IOC_OPAL_GET_STATUS),
+	IOCTLCAP(IOC_OPAL_GET_LR_STATUS),
+	IOCTLCAP(IOC_OPAL_GET_GEOMETRY),
+	IOCTLCAP(IOC_OPAL_DISCOVERY),
+};
+
+#define IOCTLCAPS_NR (sizeof(ioctlcaps_table) / sizeof(ioctlcaps_table[0]))
+
+/*
+ * With a NULL argument a sed-opal ioctl the kernel knows fails copying it in
+ * (or out) with EFAULT before anything reaches the drive, or with
+ * EOPNOTSUPP/EACCES before that. Numbers it doesn't know never get past the
+ * driver and come back ENOTTY, or EINVAL from drivers without sed-opal.
+ */
+static int ioctlcaps_probe(int fd, struct ioctlcaps *caps)
+{
+	unsigned int i, seen = 0;
+
+	caps->known = 0;
+	for (i = 0; i < IOCTLCAPS_NR; i++) {
+		if (!ioctl(fd, ioctlcaps_table[i].cmd, NULL) ||
+		    (errno != ENOTTY && errno != EINVAL)) {
+			caps->known |= 1ULL << i;
+			seen++;
+		}
+	}
+	/* a device that doesn't do sed-opal at all tells us nothing */
+	return seen ? 0 : -ENODEV;
+}
+
+static void ioctlcaps_path(char *path, size_t len)
+{
+	struct utsname u;
+
+	if (uname(&u))
+		snprintf(u.release, sizeof(u.release), "unknown");
+	snprintf(path, len, "%s/%s", IOCTLCAPS_DIR, u.release);
+}
+
+/* cached, else probed on fd; -ENODEV if fd can't tell */
+int ioctlcaps_get(int fd, struct ioctlcaps *caps)
+{
+	char path[PATH_MAX], tmp[PATH_MAX + 4];
+	unsigned long long known;
+	unsigned int nr;
+	FILE *f;
+	int err;
+
+	ioctlcaps_path(path, sizeof(path));
+	f = fopen(path, "r");
+	if (f) {
+		/* probed with a shorter table: the new entries are unknown */
+		err = fscanf(f, "%llx %u", &known, &nr) == 2 &&
+			nr == IOCTLCAPS_NR ? 0 : -ESTALE;
+		fclose(f);
+		if (!err) {
+			caps->known = known;
+			return 0;
+		}
+	}
+
+	err = ioctlcaps_probe(fd, caps);
+	if (err)
+		return err;
+
+	if (mkdir_parents(IOCTLCAPS_DIR))
+		return 0;
+	snprintf(tmp, sizeof(tmp), "%s.tmp", path);
+	f = fopen(tmp, "w");
+	if (!f)
+		return 0;
+	fprintf(f, "%llx %u\n", (unsigned long long)caps->known,
+		(unsigned int)IOCTLCAPS_NR);
+	if (fclose(f) || rename(tmp, path))
+		unlink(tmp);
+	return 0;
+}
+
+/* 1 known, 0 not known, -1 not an ioctl we probe for */
+int ioctlcaps_has(const struct ioctlcaps *caps, unsigned long cmd)
+{
+	unsigned int i;
+
+	for (i = 0; i < IOCTLCAPS_NR; i++)
+		if (ioctlcaps_table[i].cmd == cmd)
+			return !!(caps->known & (1ULL << i));
+	return -1;
+}
+
+const char *ioctlcaps_name(unsigned long cmd)
+{
+	unsigned int i;
+
+	for (i = 0; i < IOCTLCAPS_NR; i++)
+		if (ioctlcaps_table[i].cmd == cmd)
+			return ioctlcaps_table[i].name;
+	return "unknown ioctl";
+}
+
+void ioctlcaps_print(const struct ioctlcaps *caps)
+{
+	unsigned int i;
+
+	for (i = 0; i < IOCTLCAPS_NR; i++)
+		printf("%-28s %s\n", ioctlcaps_table[i].name,
+		       caps->known & (1ULL << i) ? "yes" : "no");
+}
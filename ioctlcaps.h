@@ -0,0 +1,24 @@
+#ifndef _IOCTLCAPS_H
+#define _IOCTLCAPS_H
+
+#include <linux/types.h>
+#include <stdbool.h>
+
+#include "devindex.h"
+
+/*
+ * Which IOC_OPAL_* numbers the running kernel knows, probed once and kept
+ * per kernel release: the answer only changes with the kernel.
+ */
+#define IOCTLCAPS_DIR	SED_OPAL_STATE_DIR "/ioctls"
+
+struct ioctlcaps {
+	__u64 known;		/* bit per ioctlcaps_table[] entry */
+};
+
+int ioctlcaps_get(int fd, struct ioctlcaps *caps);
+int ioctlcaps_has(const struct ioctlcaps *caps, unsigned long cmd);
+const char *ioctlcaps_name(unsigned long cmd);
+void ioctlcaps_print(const struct ioctlcaps *caps);
+
+#endif
@@ -0,0 +1,126 @@
+#include <sys/types.h>
+#include <sys/ioctl.h>
+#include <linux/fs.h>
+
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+
+#include "lrplan.h"
+#include "sed-opal.h"
+#include "ioctlcaps.h"
+#include "discovery.h"
+
+static __u64 gcd(__u64 a, __u64 b)
+{
+	__u64 t;
+
+	while (b) {
+		t = a % b;
+		a = b;
+		b = t;
+	}
+	return a;
+}
+
+static __u64 lcm(__u64 a, __u64 b)
+{
+	return a / gcd(a, b) * b;
+}
+
+/*
+ * The TPer's view comes from IOC_OPAL_GET_GEOMETRY when the kernel has it,
+ * else from cached discovery data; without either only the block layer's
+ * sizes are used.
+ */
+int lrplan_geometry(const char *disk, int fd, struct lrplan_geom *g)
+{
+	struct opal_geometry geo = { };
+	struct ioctlcaps caps;
+	struct discovery d;
+	unsigned int pbs, io_opt;
+	__u64 size;
+
+	memset(g, 0, sizeof(*g));
+	if (ioctl(fd, BLKSSZGET, &g->lbs) || ioctl(fd, BLKPBSZGET, &pbs) ||
+	    ioctl(fd, BLKIOOPT, &io_opt) || ioctl(fd, BLKGETSIZE64, &size))
+		return -errno;
+	g->nr_lbas = size / g->lbs;
+	g->required = 1;
+
+	if ((ioctlcaps_get(fd, &caps) || ioctlcaps_has(&caps, IOC_OPAL_GET_GEOMETRY)) &&
+	    !ioctl(fd, IOC_OPAL_GET_GEOMETRY, &geo)) {
+		if (geo.align && geo.alignment_granularity)
+			g->required = geo.alignment_granularity;
+		g->lowest_aligned = geo.lowest_aligned_lba;
+	} else if (!discovery_cached(disk, &d) && d.has_geometry) {
+		if (d.align_required && d.align_granularity)
+			g->required = d.align_granularity;
+		g->lowest_aligned = d.lowest_aligned_lba;
+	}
+
+	g->preferred = g->required;
+	if (pbs > g->lbs)
+		g->preferred = lcm(g->preferred, pbs / g->lbs);
+	if (io_opt > g->lbs && !(io_opt % g->lbs))
+		g->preferred = lcm(g->preferred, io_opt / g->lbs);
+	return 0;
+}
+
+bool lrplan_aligned(const struct lrplan_geom *g, __u64 lba, __u64 gran)
+{
+	if (lba < g->lowest_aligned)
+		return lba == 0;
+	return (lba - g->lowest_aligned) % gran == 0;
+}
+
+/* the nearest boundary of gran LBAs at or above/below lba */
+__u64 lrplan_round(const struct lrplan_geom *g, __u64 lba, __u64 gran, bool up)
+{
+	__u64 off;
+
+	if (lba < g->lowest_aligned)
+		return up ? g->lowest_aligned : 0;
+	off = (lba - g->lowest_aligned) % gran;
+	if (!off)
+		return lba;
+	return up ? lba + gran - off : lba - off;
+}
+
+/* shrink [start, start + length) inwards onto preferred boundaries */
+void lrplan_align(const struct lrplan_geom *g, __u64 *start, __u64 *length)
+{
+	__u64 s = lrplan_round(g, *start, g->preferred, true);
+	__u64 e = *start + *length;
+
+	if (e < g->nr_lbas)
+		e = lrplan_round(g, e, g->preferred, false);
+	*start = s;
+	*length = e > s ? e - s : 0;
+}
+
+/*
+ * n LRs of equal size covering as much of the range as alignment allows;
+ * the last one takes whatever granules don't divide evenly. starts and
+ * lengths have room for max entries.
+ */
+int lrplan_split(const struct lrplan_geom *g, __u64 start, __u64 length,
+		 unsigned int n, __u64 *starts, __u64 *lengths, unsigned int max)
+{
+	__u64 granules, per;
+	unsigned int i;
+
+	if (n > max)
+		return -EINVAL;
+	lrplan_align(g, &start, &length);
+	granules = length / g->preferred;
+	if (!n || granules < n)
+		return -ENOSPC;
+	per = granules / n * g->preferred;
+
+	for (i = 0; i < n; i++) {
+		starts[i] = start + i * per;
+		lengths[i] = i + 1 < n ? per : length - i * per;
+	}
+	return 0;
+}
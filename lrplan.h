@@ -0,0 +1,27 @@
+#ifndef _LRPLAN_H
+#define _LRPLAN_H
+
+#include <linux/types.h>
+#include <stdbool.h>
+
+/*
+ * Where LR boundaries may go on a drive: the TPer's alignment granularity
+ * when it requires one, and where they should go so that I/O doesn't get
+ * split: the physical block and optimal I/O size as well. All in LBAs.
+ */
+struct lrplan_geom {
+	unsigned int lbs;
+	__u64 nr_lbas;
+	__u64 required;		/* 1 if the TPer doesn't care */
+	__u64 preferred;	/* multiple of required */
+	__u64 lowest_aligned;
+};
+
+int lrplan_geometry(const char *disk, int fd, struct lrplan_geom *g);
+bool lrplan_aligned(const struct lrplan_geom *g, __u64 lba, __u64 gran);
+__u64 lrplan_round(const struct lrplan_geom *g, __u64 lba, __u64 gran, bool up);
+void lrplan_align(const struct lrplan_geom *g, __u64 *start, __u64 *length);
+int lrplan_split(const struct lrplan_geom *g, __u64 start, __u64 length,
+		 unsigned int n, __u64 *starts, __u64 *lengths, unsigned int max);
+
+#endif
@@ -0,0 +1,272 @@
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/file.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <signal.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+#include <stdbool.h>
+
+#include "lrpool.h"
+#include "devindex.h"
+
+#define LRPOOL_MAGIC	0x3130304c4f4f504cULL	/* "LPOOL001" */
+
+static const char * const lrpool_states[] = {
+	[LRPOOL_UNKNOWN] = "unknown",
+	[LRPOOL_CLEAN] = "free",
+	[LRPOOL_ALLOCATED] = "allocated",
+	[LRPOOL_RELEASING] = "releasing",
+	[LRPOOL_DIRTY] = "dirty",
+};
+
+const char *lrpool_state_name(enum lrpool_state state)
+{
+	return state < sizeof(lrpool_states) / sizeof(lrpool_states[0]) ?
+		lrpool_states[state] : "?";
+}
+
+static int lrpool_open(const char *disk, bool create)
+{
+	char key[DEVINDEX_KEY_LEN], path[PATH_MAX];
+	struct devid id;
+	char *p;
+	int fd;
+
+	if (devid_read(disk, &id))
+		return -ENOENT;
+	devid_key(&id, key);
+	for (p = key; *p; p++)
+		if (*p == '/')
+			*p = '_';
+
+	if (create && mkdir_parents(LRPOOL_DIR))
+		return -errno;
+	snprintf(path, sizeof(path), "%s/%s", LRPOOL_DIR, key);
+	fd = open(path, O_RDWR | O_CLOEXEC | (create ? O_CREAT : 0), 0600);
+	if (fd < 0)
+		return -errno;
+	if (flock(fd, LOCK_EX)) {
+		close(fd);
+		return -errno;
+	}
+	return fd;
+}
+
+/*
+ * A release whose process is gone didn't get to say how it ended, so the
+ * LR may still hold the old tenant's key: treat it as dirty. So is one
+ * with no process recorded, which only an older release could leave.
+ */
+static void lrpool_load(int fd, struct lrpool *p)
+{
+	unsigned int i;
+
+	if (pread(fd, p, sizeof(*p), 0) != sizeof(*p) || p->magic != LRPOOL_MAGIC) {
+		memset(p, 0, sizeof(*p));
+		p->magic = LRPOOL_MAGIC;
+	}
+	for (i = 1; i < OPAL_MAX_LRS; i++)
+		if (p->lr[i].state == LRPOOL_RELEASING && (p->lr[i].pid <= 0 ||
+		    (kill(p->lr[i].pid, 0) && errno == ESRCH)))
+			p->lr[i].state = LRPOOL_DIRTY;
+}
+
+static int lrpool_store(int fd, struct lrpool *p)
+{
+	if (pwrite(fd, p, sizeof(*p), 0) != sizeof(*p))
+		return errno ? -errno : -EIO;
+	return 0;
+}
+
+static void lrpool_mark(struct lrpool_lr *lr, enum lrpool_state state)
+{
+	lr->state = state;
+	lr->since = time(NULL);
+}
+
+int lrpool_read(const char *disk, struct lrpool *p)
+{
+	int fd;
+
+	fd = lrpool_open(disk, false);
+	if (fd == -ENOENT) {
+		memset(p, 0, sizeof(*p));
+		p->magic = LRPOOL_MAGIC;
+		return 0;
+	}
+	if (fd < 0)
+		return fd;
+	lrpool_load(fd, p);
+	close(fd);
+	return 0;
+}
+
+/*
+ * Take an enrolled LR out of the pool for a tenant: one that a release left
+ * clean if there is one, else one that will have to be erased first. Ones
+ * being released are never waited for.
+ */
+int lrpool_claim(const char *disk, __u32 eligible, const char *tenant,
+		 __u8 *lr, enum lrpool_state *prev)
+{
+	static const enum lrpool_state prefer[] = {
+		LRPOOL_CLEAN, LRPOOL_UNKNOWN, LRPOOL_DIRTY,
+	};
+	struct lrpool p;
+	unsigned int i, j;
+	int fd, err;
+
+	fd = lrpool_open(disk, true);
+	if (fd < 0)
+		return fd;
+	lrpool_load(fd, &p);
+
+	for (j = 1; j < OPAL_MAX_LRS; j++)
+		if (!p.lr[j].enrolled)
+			eligible &= ~(1U << j);
+	for (i = 0; i < sizeof(prefer) / sizeof(prefer[0]); i++)
+		for (j = 1; j < OPAL_MAX_LRS; j++)
+			if ((eligible & (1U << j)) && p.lr[j].state == prefer[i])
+				goto found;
+	close(fd);
+	return eligible ? -ENOSPC : -EPERM;
+ found:
+	*lr = j;
+	*prev = p.lr[j].state;
+	lrpool_mark(&p.lr[j], LRPOOL_ALLOCATED);
+	p.lr[j].pid = 0;
+	p.lr[j].err = 0;
+	snprintf(p.lr[j].tenant, sizeof(p.lr[j].tenant), "%s", tenant);
+	err = lrpool_store(fd, &p);
+	close(fd);
+	return err;
+}
+
+/*
+ * Enrolling gives the LR and whatever is on it to the pool, so it comes in
+ * as unknown and is erased before its first tenant gets it. One a tenant
+ * holds or that is being released can't leave until it is back.
+ */
+int lrpool_enrol(const char *disk, __u8 lr, bool enrol)
+{
+	struct lrpool p;
+	int fd, err;
+	bool held;
+
+	if (!lr || lr >= OPAL_MAX_LRS)
+		return -EINVAL;
+	fd = lrpool_open(disk, true);
+	if (fd < 0)
+		return fd;
+	lrpool_load(fd, &p);
+	held = p.lr[lr].state == LRPOOL_ALLOCATED ||
+	       p.lr[lr].state == LRPOOL_RELEASING;
+	if (!enrol && held) {
+		close(fd);
+		return -EBUSY;
+	}
+	if (enrol && !held && !p.lr[lr].enrolled) {
+		lrpool_mark(&p.lr[lr], LRPOOL_UNKNOWN);
+		p.lr[lr].tenant[0] = '\0';
+		p.lr[lr].err = 0;
+	}
+	p.lr[lr].enrolled = enrol;
+	err = lrpool_store(fd, &p);
+	close(fd);
+	return err;
+}
+
+int lrpool_find(const char *disk, const char *tenant, __u8 *lr)
+{
+	struct lrpool p;
+	unsigned int i;
+	int err;
+
+	err = lrpool_read(disk, &p);
+	if (err)
+		return err;
+	for (i = 1; i < OPAL_MAX_LRS; i++)
+		if (p.lr[i].state == LRPOOL_ALLOCATED &&
+		    !strcmp(p.lr[i].tenant, tenant)) {
+			*lr = i;
+			return 0;
+		}
+	return -ENOENT;
+}
+
+/*
+ * Only an allocated LR can be released, and only once. The caller is the
+ * releasing process until it hands over to another, so there is never a
+ * moment when a releasing LR has nobody whose death makes it dirty.
+ */
+int lrpool_begin_release(const char *disk, __u8 lr)
+{
+	struct lrpool p;
+	int fd, err;
+
+	if (!lr || lr >= OPAL_MAX_LRS)
+		return -EINVAL;
+	fd = lrpool_open(disk, false);
+	if (fd < 0)
+		return fd == -ENOENT ? -EINVAL : fd;
+	lrpool_load(fd, &p);
+	if (p.lr[lr].state != LRPOOL_ALLOCATED) {
+		close(fd);
+		return p.lr[lr].state == LRPOOL_RELEASING ? -EBUSY : -EINVAL;
+	}
+	lrpool_mark(&p.lr[lr], LRPOOL_RELEASING);
+	p.lr[lr].pid = getpid();
+	err = lrpool_store(fd, &p);
+	close(fd);
+	return err;
+}
+
+/*
+ * Hand a release over from one process to another; 0 if to now owns it.
+ * Only from's own release is taken over: the other side may have done it
+ * already, the release may be over, or from may have died and left the LR
+ * dirty, in which case it is no longer to's to release.
+ */
+int lrpool_set_pid(const char *disk, __u8 lr, pid_t from, pid_t to)
+{
+	struct lrpool p;
+	int fd, err = -ESRCH;
+
+	fd = lrpool_open(disk, false);
+	if (fd < 0)
+		return fd;
+	lrpool_load(fd, &p);
+	if (p.lr[lr].state == LRPOOL_RELEASING &&
+	    (p.lr[lr].pid == from || p.lr[lr].pid == to)) {
+		p.lr[lr].pid = to;
+		err = lrpool_store(fd, &p);
+	}
+	close(fd);
+	return err;
+}
+
+void lrpool_set(const char *disk, __u8 lr, enum lrpool_state state, int err)
+{
+	struct lrpool p;
+	int fd;
+
+	if (!lr || lr >= OPAL_MAX_LRS)
+		return;
+	fd = lrpool_open(disk, true);
+	if (fd < 0)
+		return;
+	lrpool_load(fd, &p);
+	lrpool_mark(&p.lr[lr], state);
+	p.lr[lr].pid = 0;
+	p.lr[lr].err = err;
+	if (state == LRPOOL_CLEAN)
+		p.lr[lr].tenant[0] = '\0';
+	lrpool_store(fd, &p);
+	close(fd);
+}
@@ -0,0 +1,52 @@
+#ifndef _LRPOOL_H
+#define _LRPOOL_H
+
+#include <sys/types.h>
+#include <stdbool.h>
+#include <linux/types.h>
+
+#include "sed-opal.h"
+
+#define LRPOOL_DIR		SED_OPAL_STATE_DIR "/lrpool"
+#define LRPOOL_TENANT_LEN	64
+#define LRPOOL_KEY_BYTES	32
+
+enum lrpool_state {
+	LRPOOL_UNKNOWN,		/* never been through the pool: erase before use */
+	LRPOOL_CLEAN,		/* erased, relocked and re-keyed by a release */
+	LRPOOL_ALLOCATED,
+	LRPOOL_RELEASING,	/* a background release owns it */
+	LRPOOL_DIRTY,		/* an allocation or release didn't finish */
+};
+
+struct lrpool_lr {
+	__u32 state;
+	__s32 pid;		/* releasing process */
+	__s32 err;		/* last failure: OPAL status if > 0, -errno if < 0 */
+	__u32 enrolled;		/* given to the pool by sed-lr-pool --add */
+	__s64 since;		/* CLOCK_REALTIME seconds of the last change */
+	char tenant[LRPOOL_TENANT_LEN];
+};
+
+/*
+ * LRs 1 to OPAL_MAX_LRS - 1 of a drive handed out to tenants, those of them
+ * an administrator enrolled and no others, kept next to
+ * the device index and keyed by the drive's serial so the pool survives
+ * reboots and renumbering. Every update happens under flock().
+ */
+struct lrpool {
+	__u64 magic;
+	struct lrpool_lr lr[OPAL_MAX_LRS];
+};
+
+int lrpool_claim(const char *disk, __u32 eligible, const char *tenant,
+		 __u8 *lr, enum lrpool_state *prev);
+int lrpool_enrol(const char *disk, __u8 lr, bool enrol);
+int lrpool_find(const char *disk, const char *tenant, __u8 *lr);
+int lrpool_begin_release(const char *disk, __u8 lr);
+int lrpool_set_pid(const char *disk, __u8 lr, pid_t from, pid_t to);
+void lrpool_set(const char *disk, __u8 lr, enum lrpool_state state, int err);
+int lrpool_read(const char *disk, struct lrpool *p);
+const char *lrpool_state_name(enum lrpool_state state);
+
+#endif
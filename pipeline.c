@@ -0,0 +1,228 @@
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+
+#include "pipeline.h"
+#include "throttle.h"
+
+struct pipeline {
+	struct fleet *fleet;
+	struct pipeline_stage *stages;
+	unsigned int nr_stages;
+	void *arg;
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	unsigned int *queue;		/* nr_devs slots per stage, FIFO */
+	unsigned int *len;		/* per stage */
+	unsigned int *pending;		/* per stage, devices not through it yet */
+	unsigned int *ctrl_of;		/* per device */
+	unsigned int *busy;		/* per controller, devices in a stage */
+	unsigned int per_ctrl;
+	struct timespec *queued;	/* per device, when it joined its queue */
+};
+
+struct pipeline_work {
+	struct pipeline *p;
+	unsigned int stage;
+	pthread_t thread;
+	bool started;
+};
+
+static double pipeline_ms(const struct timespec *a, const struct timespec *b)
+{
+	return (b->tv_sec - a->tv_sec) * 1000.0 +
+		(b->tv_nsec - a->tv_nsec) / 1000000.0;
+}
+
+static void pipeline_push(struct pipeline *p, unsigned int stage, unsigned int idx)
+{
+	p->queue[stage * p->fleet->nr_devs + p->len[stage]++] = idx;
+	clock_gettime(CLOCK_MONOTONIC, &p->queued[idx]);
+}
+
+/*
+ * The oldest device in the stage's queue whose controller has room for it:
+ * a TPer only ever sees per_ctrl of our sessions, whichever stages they are
+ * for. Called with p->lock held.
+ */
+static int pipeline_pop(struct pipeline *p, unsigned int stage)
+{
+	unsigned int *q = &p->queue[stage * p->fleet->nr_devs];
+	unsigned int i, idx;
+
+	for (i = 0; i < p->len[stage]; i++) {
+		idx = q[i];
+		if (p->busy[p->ctrl_of[idx]] >= p->per_ctrl)
+			continue;
+		memmove(&q[i], &q[i + 1], (p->len[stage] - i - 1) * sizeof(*q));
+		p->len[stage]--;
+		return idx;
+	}
+	return -1;
+}
+
+static void pipeline_stage_run(struct pipeline *p, unsigned int s)
+{
+	struct pipeline_stage *stage = &p->stages[s];
+	struct timespec start, end;
+	struct fleet_dev *dev;
+	unsigned int k;
+	int idx, ret, err;
+
+	pthread_mutex_lock(&p->lock);
+	while (p->pending[s]) {
+		idx = pipeline_pop(p, s);
+		if (idx < 0) {
+			pthread_cond_wait(&p->cond, &p->lock);
+			continue;
+		}
+		dev = &p->fleet->devs[idx];
+		p->busy[p->ctrl_of[idx]]++;
+		pthread_mutex_unlock(&p->lock);
+
+		if (throttle_wait(p->fleet->throttle, dev->name)) {
+			dev->note = "device stayed busy, not started";
+			ret = -1;
+			err = ETIMEDOUT;
+			clock_gettime(CLOCK_MONOTONIC, &start);
+			end = start;
+		} else {
+			clock_gettime(CLOCK_MONOTONIC, &start);
+			errno = 0;
+			ret = stage->fn(dev, p->arg);
+			err = errno;
+			clock_gettime(CLOCK_MONOTONIC, &end);
+		}
+
+		pthread_mutex_lock(&p->lock);
+		p->busy[p->ctrl_of[idx]]--;
+		stage->busy_ms += pipeline_ms(&start, &end);
+		stage->wait_ms += pipeline_ms(&p->queued[idx], &start);
+		dev->result = ret;
+		dev->err = err;
+		dev->done = end;
+		if (ret) {
+			stage->failed[stage->nr_failed++] = idx;
+			for (k = s; k < p->nr_stages; k++)
+				p->pending[k]--;
+		} else {
+			stage->done++;
+			p->pending[s]--;
+			if (s + 1 < p->nr_stages)
+				pipeline_push(p, s + 1, idx);
+		}
+		pthread_cond_broadcast(&p->cond);
+	}
+	pthread_mutex_unlock(&p->lock);
+}
+
+static void *pipeline_worker(void *data)
+{
+	struct pipeline_work *work = data;
+
+	pipeline_stage_run(work->p, work->stage);
+	return NULL;
+}
+
+/*
+ * Run the stages over the fleet like a factory line: every stage has its
+ * own pool of workers and hands each device on to the next stage as soon
+ * as it is done with it, so different devices are in different stages at
+ * the same time and the line moves at the pace of its slowest stage, not
+ * the sum of them. Devices still go through the stages in order.
+ */
+int pipeline_run(struct fleet *fleet, struct pipeline_stage *stages,
+		 unsigned int nr_stages, void *arg)
+{
+	struct pipeline p = {
+		.fleet = fleet,
+		.stages = stages,
+		.nr_stages = nr_stages,
+		.arg = arg,
+		.lock = PTHREAD_MUTEX_INITIALIZER,
+		.cond = PTHREAD_COND_INITIALIZER,
+		.per_ctrl = fleet->per_ctrl ? fleet->per_ctrl : 1,
+	};
+	struct pipeline_work *work = NULL;
+	unsigned int i, j, nr = 0;
+	int err = -ENOMEM;
+
+	if (!nr_stages)
+		return 0;
+	p.queue = calloc(nr_stages * fleet->nr_devs, sizeof(*p.queue));
+	p.len = calloc(nr_stages, sizeof(*p.len));
+	p.pending = calloc(nr_stages, sizeof(*p.pending));
+	p.ctrl_of = calloc(fleet->nr_devs, sizeof(*p.ctrl_of));
+	p.busy = calloc(fleet->nr_ctrls, sizeof(*p.busy));
+	p.queued = calloc(fleet->nr_devs, sizeof(*p.queued));
+	if (!p.queue || !p.len || !p.pending || !p.ctrl_of || !p.busy || !p.queued)
+		goto out;
+
+	for (i = 0; i < nr_stages; i++) {
+		stages[i].done = stages[i].nr_failed = 0;
+		stages[i].busy_ms = stages[i].wait_ms = 0;
+		free(stages[i].failed);
+		stages[i].failed = calloc(fleet->nr_devs, sizeof(*stages[i].failed));
+		if (!stages[i].failed)
+			goto out;
+		if (!stages[i].workers)
+			stages[i].workers = PIPELINE_DEF_WORKERS;
+		nr += stages[i].workers;
+		p.pending[i] = fleet->nr_devs;
+	}
+	for (i = 0; i < fleet->nr_ctrls; i++)
+		for (j = 0; j < fleet->ctrls[i].nr_devs; j++)
+			p.ctrl_of[fleet->ctrls[i].devs[j] - fleet->devs] = i;
+	for (i = 0; i < fleet->nr_devs; i++)
+		pipeline_push(&p, 0, i);
+
+	work = calloc(nr, sizeof(*work));
+	if (!work)
+		goto out;
+	for (i = 0, nr = 0; i < nr_stages; i++) {
+		for (j = 0; j < stages[i].workers; j++, nr++) {
+			work[nr].p = &p;
+			work[nr].stage = i;
+			work[nr].started = !pthread_create(&work[nr].thread, NULL,
+							   pipeline_worker, &work[nr]);
+		}
+	}
+
+	/*
+	 * A stage none of whose workers got going is run here, in stage
+	 * order: by the time we get to it the stages before it are done.
+	 */
+	for (i = 0, nr = 0; i < nr_stages; i++) {
+		for (j = 0; j < stages[i].workers; j++)
+			if (work[nr + j].started)
+				break;
+		if (j == stages[i].workers)
+			pipeline_stage_run(&p, i);
+		nr += stages[i].workers;
+	}
+
+	for (i = 0; i < nr; i++)
+		if (work[i].started)
+			pthread_join(work[i].thread, NULL);
+	err = 0;
+ out:
+	free(work);
+	free(p.queue);
+	free(p.len);
+	free(p.pending);
+	free(p.ctrl_of);
+	free(p.busy);
+	free(p.queued);
+	return err;
+}
+
+void pipeline_free(struct pipeline_stage *stages, unsigned int nr_stages)
+{
+	unsigned int i;
+
+	for (i = 0; i < nr_stages; i++) {
+		free(stages[i].failed);
+		stages[i].failed = NULL;
+	}
+}
@@ -0,0 +1,29 @@
+#ifndef _PIPELINE_H
+#define _PIPELINE_H
+
+#include "fleet.h"
+
+#define PIPELINE_DEF_WORKERS	4
+
+/*
+ * One step of a pipeline: fn is run on every device that made it through
+ * the steps before, by a pool of workers of its own. A device fn fails on
+ * goes on the stage's failure queue and no further.
+ */
+struct pipeline_stage {
+	const char *name;
+	fleet_fn fn;
+	unsigned int workers;
+	/* filled in by pipeline_run */
+	unsigned int done;
+	unsigned int nr_failed;
+	unsigned int *failed;		/* device indexes, in failure order */
+	double busy_ms;			/* time spent in fn, all workers */
+	double wait_ms;			/* time devices sat in the stage's queue */
+};
+
+int pipeline_run(struct fleet *fleet, struct pipeline_stage *stages,
+		 unsigned int nr_stages, void *arg);
+void pipeline_free(struct pipeline_stage *stages, unsigned int nr_stages);
+
+#endif
@@ -0,0 +1,126 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <ctype.h>
+#include <errno.h>
+
+#include "psid.h"
+
+static char *psid_trim(char *s)
+{
+	char *e;
+
+	while (isspace((unsigned char)*s))
+		s++;
+	e = s + strlen(s);
+	while (e > s && isspace((unsigned char)e[-1]))
+		*--e = '\0';
+	return s;
+}
+
+static int *psid_slot(struct psid_table *t, const char *serial)
+{
+	unsigned int i = devindex_hash(serial) & (t->nr_slots - 1);
+
+	while (t->slots[i] >= 0 && strcmp(t->entries[t->slots[i]].serial, serial))
+		i = (i + 1) & (t->nr_slots - 1);
+	return &t->slots[i];
+}
+
+static int psid_add(struct psid_table *t, const char *serial, const char *psid,
+		    unsigned int *alloc)
+{
+	struct psid_entry *e;
+
+	if (t->nr == *alloc) {
+		*alloc = *alloc ? *alloc * 2 : 64;
+		e = realloc(t->entries, *alloc * sizeof(*e));
+		if (!e)
+			return -ENOMEM;
+		t->entries = e;
+	}
+	e = &t->entries[t->nr];
+	snprintf(e->serial, sizeof(e->serial), "%s", serial);
+	snprintf(e->psid, sizeof(e->psid), "%s", psid);
+	t->nr++;
+	return 0;
+}
+
+/*
+ * One "serial,psid" per line; blank lines, '#' comments and a "serial,..."
+ * header are skipped. A serial listed twice keeps its last PSID.
+ */
+int psid_load(const char *path, struct psid_table *t)
+{
+	char *line = NULL, *serial, *psid;
+	unsigned int alloc = 0, i, n;
+	size_t len = 0;
+	int err = 0, *slot;
+	FILE *f;
+
+	memset(t, 0, sizeof(*t));
+	f = fopen(path, "r");
+	if (!f)
+		return -errno;
+
+	while (getline(&line, &len, f) > 0) {
+		serial = psid_trim(line);
+		if (!*serial || *serial == '#')
+			continue;
+		psid = strchr(serial, ',');
+		if (!psid) {
+			fprintf(stderr, "%s: ignoring line without a PSID: %s\n",
+				path, serial);
+			continue;
+		}
+		*psid++ = '\0';
+		serial = psid_trim(serial);
+		psid = psid_trim(psid);
+		if (!strcasecmp(serial, "serial"))
+			continue;
+		err = psid_add(t, serial, psid, &alloc);
+		if (err)
+			break;
+	}
+	free(line);
+	fclose(f);
+	if (err)
+		goto fail;
+
+	/* keep the table at most half full */
+	for (n = 64; n < t->nr * 2; n *= 2)
+		;
+	t->nr_slots = n;
+	t->slots = malloc(n * sizeof(*t->slots));
+	if (!t->slots) {
+		err = -ENOMEM;
+		goto fail;
+	}
+	memset(t->slots, 0xff, n * sizeof(*t->slots));
+	for (i = 0; i < t->nr; i++) {
+		slot = psid_slot(t, t->entries[i].serial);
+		*slot = i;
+	}
+	return 0;
+ fail:
+	psid_free(t);
+	return err;
+}
+
+const char *psid_lookup(struct psid_table *t, const char *serial)
+{
+	int slot;
+
+	if (!t->nr_slots)
+		return NULL;
+	slot = *psid_slot(t, serial);
+	return slot < 0 ? NULL : t->entries[slot].psid;
+}
+
+void psid_free(struct psid_table *t)
+{
+	free(t->entries);
+	free(t->slots);
+	memset(t, 0, sizeof(*t));
+}
@@ -0,0 +1,27 @@
+#ifndef _PSID_H
+#define _PSID_H
+
+#include "sed-opal.h"
+#include "devindex.h"
+
+/*
+ * Serial to PSID map loaded from a "serial,psid" CSV, hashed in memory so a
+ * host full of drives can be matched against a bin's worth of labels.
+ */
+struct psid_entry {
+	char serial[DEVINDEX_ID_LEN];
+	char psid[OPAL_KEY_MAX];
+};
+
+struct psid_table {
+	unsigned int nr;
+	unsigned int nr_slots;		/* power of two */
+	struct psid_entry *entries;
+	int *slots;			/* index into entries, -1 if free */
+};
+
+int psid_load(const char *path, struct psid_table *t);
+const char *psid_lookup(struct psid_table *t, const char *serial);
+void psid_free(struct psid_table *t);
+
+#endif
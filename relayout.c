@@ -0,0 +1,259 @@
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdbool.h>
+
+#include "relayout.h"
+#include "uring.h"
+
+#define RELAYOUT_MAGIC	0x3130304f59414c52ULL	/* "RLAYO001" */
+
+static void relayout_path(const char *disk, __u8 lr, char *path, size_t len)
+{
+	char key[DEVINDEX_KEY_LEN];
+	struct devid id;
+	char *p;
+
+	if (devid_read(disk, &id))
+		snprintf(key, sizeof(key), "%s", disk);
+	else
+		devid_key(&id, key);
+	for (p = key; *p; p++)
+		if (*p == '/')
+			*p = '_';
+	snprintf(path, len, "%s/%s-lr%u", RELAYOUT_DIR, key, lr);
+}
+
+int relayout_load(const char *disk, __u8 lr, struct relayout_state *st)
+{
+	char path[PATH_MAX];
+	ssize_t n;
+	int fd;
+
+	relayout_path(disk, lr, path, sizeof(path));
+	fd = open(path, O_RDONLY | O_CLOEXEC);
+	if (fd < 0)
+		return -errno;
+	n = pread(fd, st, sizeof(*st), 0);
+	close(fd);
+	if (n != sizeof(*st) || st->magic != RELAYOUT_MAGIC ||
+	    !st->phase || st->phase > RELAYOUT_RESTORING)
+		return -EINVAL;
+	st->stage[sizeof(st->stage) - 1] = '\0';
+	return 0;
+}
+
+/* written aside and renamed over, so a crash leaves the old or the new one */
+int relayout_save(const char *disk, __u8 lr, struct relayout_state *st)
+{
+	char path[PATH_MAX], tmp[PATH_MAX + 4];
+	int fd, err = 0;
+
+	if (mkdir_parents(RELAYOUT_DIR))
+		return -errno;
+	relayout_path(disk, lr, path, sizeof(path));
+	snprintf(tmp, sizeof(tmp), "%s.new", path);
+	st->magic = RELAYOUT_MAGIC;
+
+	fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+	if (fd < 0)
+		return -errno;
+	if (pwrite(fd, st, sizeof(*st), 0) != sizeof(*st) || fsync(fd))
+		err = errno ? -errno : -EIO;
+	close(fd);
+	if (!err && rename(tmp, path))
+		err = -errno;
+	if (err)
+		unlink(tmp);
+	return err;
+}
+
+void relayout_finish(const char *disk, __u8 lr)
+{
+	char path[PATH_MAX];
+
+	relayout_path(disk, lr, path, sizeof(path));
+	unlink(path);
+}
+
+enum { SLOT_IDLE, SLOT_READ, SLOT_WRITE };
+
+struct relayout_slot {
+	unsigned char *buf;
+	__u64 off;		/* into the copy */
+	unsigned int len;
+	unsigned int pos;	/* of the current read or write */
+	int state;
+};
+
+static void relayout_queue(struct uring *r, struct relayout_copy *c,
+			   struct relayout_slot *s, unsigned int idx)
+{
+	struct io_uring_sqe *sqe = uring_sqe(r);
+	bool rd = s->state == SLOT_READ;
+
+	/* never more in flight than the ring has entries */
+	sqe->opcode = rd ? IORING_OP_READ : IORING_OP_WRITE;
+	sqe->fd = rd ? c->in_fd : c->out_fd;
+	sqe->addr = (unsigned long)(s->buf + s->pos);
+	sqe->len = s->len - s->pos;
+	sqe->off = (rd ? c->in_off : c->out_off) + s->off + s->pos;
+	sqe->user_data = idx;
+}
+
+/* lowest offset not yet written: everything below it is */
+static __u64 relayout_low(struct relayout_slot *slots, unsigned int qd,
+			  __u64 next)
+{
+	__u64 low = next;
+	unsigned int i;
+
+	for (i = 0; i < qd; i++)
+		if (slots[i].state != SLOT_IDLE && slots[i].off < low)
+			low = slots[i].off;
+	return low;
+}
+
+static int relayout_sync(struct relayout_copy *c, __u64 done)
+{
+	if (fdatasync(c->out_fd) || (c->out_tail_fd != c->out_fd &&
+				     fdatasync(c->out_tail_fd)))
+		return -errno;
+	c->done = done;
+	return c->checkpoint ? c->checkpoint(c->arg, done) : 0;
+}
+
+/* the part that isn't a multiple of RELAYOUT_ALIGN, or all of it without a ring */
+static int relayout_copy_sync(struct relayout_copy *c, unsigned char *buf,
+			      __u64 end, int in_fd, int out_fd)
+{
+	__u64 off = c->done, last = c->done;
+	ssize_t n;
+	size_t len;
+	int err;
+
+	while (off < end) {
+		len = end - off < c->bs ? end - off : c->bs;
+		n = pread(in_fd, buf, len, c->in_off + off);
+		if (n != (ssize_t)len)
+			return n < 0 ? -errno : -EIO;
+		n = pwrite(out_fd, buf, len, c->out_off + off);
+		if (n != (ssize_t)len)
+			return n < 0 ? -errno : -EIO;
+		off += len;
+		if (off - last >= RELAYOUT_CKPT_BYTES || off == end) {
+			err = relayout_sync(c, off);
+			if (err)
+				return err;
+			last = off;
+		}
+	}
+	return 0;
+}
+
+/*
+ * qd buffers of bs bytes each cycle read -> write through one io_uring.
+ * Completions come back in any order, so the checkpoint is the low-water
+ * mark below which every write has completed, and it's only recorded once
+ * those writes have been flushed. Resuming from it redoes at most the
+ * in-flight window. Without io_uring the same copy runs synchronously.
+ */
+int relayout_copy(struct relayout_copy *c)
+{
+	__u64 aligned = c->len / RELAYOUT_ALIGN * RELAYOUT_ALIGN;
+	__u64 next = c->done, low, last = c->done;
+	struct relayout_slot *slots;
+	struct io_uring_cqe cqe;
+	unsigned int i, inflight = 0;
+	struct relayout_slot *s;
+	struct uring r;
+	int err = 0, ret;
+
+	if (!c->qd || !c->bs || c->bs % RELAYOUT_ALIGN)
+		return -EINVAL;
+	slots = calloc(c->qd, sizeof(*slots));
+	if (!slots)
+		return -ENOMEM;
+	for (i = 0; i < c->qd; i++)
+		if (posix_memalign((void **)&slots[i].buf, RELAYOUT_ALIGN, c->bs)) {
+			err = -ENOMEM;
+			goto out;
+		}
+
+	if (uring_init(&r, c->qd)) {
+		err = relayout_copy_sync(c, slots[0].buf, aligned, c->in_fd, c->out_fd);
+		goto tail;
+	}
+
+	for (;;) {
+		for (i = 0; i < c->qd && next < aligned && !err; i++) {
+			s = &slots[i];
+			if (s->state != SLOT_IDLE)
+				continue;
+			s->off = next;
+			s->len = aligned - next < c->bs ? aligned - next : c->bs;
+			s->pos = 0;
+			s->state = SLOT_READ;
+			relayout_queue(&r, c, s, i);
+			next += s->len;
+			inflight++;
+		}
+		if (!inflight)
+			break;
+
+		ret = uring_submit_wait(&r, 1);
+		if (ret) {
+			err = err ? err : ret;
+			break;
+		}
+		while (uring_peek(&r, &cqe)) {
+			s = &slots[cqe.user_data];
+			if (cqe.res <= 0) {
+				if (!err)
+					err = cqe.res ? cqe.res : -EIO;
+				s->state = SLOT_IDLE;
+				inflight--;
+				continue;
+			}
+			s->pos += cqe.res;
+			if (s->pos < s->len) {
+				relayout_queue(&r, c, s, cqe.user_data);
+				continue;
+			}
+			if (s->state == SLOT_READ && !err) {
+				s->state = SLOT_WRITE;
+				s->pos = 0;
+				relayout_queue(&r, c, s, cqe.user_data);
+				continue;
+			}
+			s->state = SLOT_IDLE;
+			inflight--;
+		}
+		if (err)
+			continue;
+
+		low = relayout_low(slots, c->qd, next);
+		if (low - last >= RELAYOUT_CKPT_BYTES) {
+			err = relayout_sync(c, low);
+			last = low;
+		}
+	}
+	uring_exit(&r);
+	if (!err && c->done < aligned)
+		err = relayout_sync(c, aligned);
+ tail:
+	if (!err && c->done < c->len)
+		err = relayout_copy_sync(c, slots[0].buf, c->len, c->in_tail_fd,
+					 c->out_tail_fd);
+ out:
+	for (i = 0; i < c->qd; i++)
+		free(slots[i].buf);
+	free(slots);
+	return err;
+}
@@ -0,0 +1,60 @@
+#ifndef _RELAYOUT_H
+#define _RELAYOUT_H
+
+#include <limits.h>
+#include <linux/types.h>
+
+#include "devindex.h"
+
+#define RELAYOUT_DIR		SED_OPAL_STATE_DIR "/relayout"
+#define RELAYOUT_DEF_QD		32
+#define RELAYOUT_DEF_BS		(1024 * 1024)
+#define RELAYOUT_ALIGN		4096
+/* progress is made durable this often */
+#define RELAYOUT_CKPT_BYTES	(256ULL * 1024 * 1024)
+
+enum relayout_phase {
+	RELAYOUT_STAGING = 1,	/* old extent -> stage file */
+	RELAYOUT_STAGED,	/* stage complete, LR still on the old extent */
+	RELAYOUT_RESTORING,	/* LR on the new extent, stage file -> LR */
+};
+
+/*
+ * Where a re-layout got to, keyed by the drive's serial and the LR so that
+ * an interrupted one picks up where it stopped. Extents are in LBAs, done
+ * in bytes of the current phase's copy.
+ */
+struct relayout_state {
+	__u64 magic;
+	__u32 phase;
+	__u32 lbs;
+	__u64 old_start;
+	__u64 old_length;
+	__u64 new_start;
+	__u64 new_length;
+	__u64 done;
+	char stage[PATH_MAX];
+};
+
+/* an O_DIRECT copy of len bytes, checkpointed as it goes */
+struct relayout_copy {
+	int in_fd;
+	int out_fd;
+	int in_tail_fd;		/* without O_DIRECT where needed, for the */
+	int out_tail_fd;	/* last len % RELAYOUT_ALIGN bytes */
+	__u64 in_off;
+	__u64 out_off;
+	__u64 len;
+	__u64 done;		/* everything below is on stable storage */
+	unsigned int qd;
+	unsigned int bs;
+	int (*checkpoint)(void *arg, __u64 done);
+	void *arg;
+};
+
+int relayout_load(const char *disk, __u8 lr, struct relayout_state *st);
+int relayout_save(const char *disk, __u8 lr, struct relayout_state *st);
+void relayout_finish(const char *disk, __u8 lr);
+int relayout_copy(struct relayout_copy *c);
+
+#endif
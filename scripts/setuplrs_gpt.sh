@@ -0,0 +1,2 @@
+#!/bin/sh
+./sed-opal sed-setuplr /dev/nvme0n1 /dev/nvme1n1 --from-gpt --align --lr 1 --user admin1 --password abcdefg --readLockEnabled  --writeLockEnabled
@@ -22,6 +22,19 @@ COMMAND_LIST(
 	ENTRY("sed-shadow-mbr", "Enable or Disable Shadow MBR", sed_shadowmbr)
 	ENTRY("sed-load-mbr", "load file into shadow MBR", sed_load_mbr)
 	ENTRY("sed-mbr-done", "Mark Shadow MBR as done", sed_mbr_done)
+	ENTRY("sed-erase-batch", "Erase many locking ranges on many devices in parallel", sed_erase_batch)
+	ENTRY("sed-wipe", "Wipe a byte range by crypto-erasing it in a spare locking range", sed_wipe)
+	ENTRY("sed-psid-revert", "Revert drives to factory state by PSID from a serial,PSID CSV *THIS WILL ERASE YOUR DATA*", sed_psid_revert)
+	ENTRY("sed-probe-layout", "Find locked and readable LBA regions by bisecting read probes", sed_probe_layout)
+	ENTRY("sed-discovery", "Show and cache Level 0 discovery data", sed_discovery)
+	ENTRY("sed-status", "Show the lock state of every locking range", sed_status)
+	ENTRY("sed-lr-alloc", "Allocate a locking range from the pool to a tenant with a fresh key", sed_lr_alloc)
+	ENTRY("sed-lr-release", "Secure erase and relock a tenant's locking range in the background", sed_lr_release)
+	ENTRY("sed-lr-pool", "Show the state of the locking range pool", sed_lr_pool)
+	ENTRY("sed-relayout", "Move a locking range to a new extent along with its data, resumably", sed_relayout)
+	ENTRY("sed-provision", "Take ownership of, activate and set up LRs and users on new drives as a staged pipeline", sed_provision)
+	ENTRY("sed-batch", "Plan and run a file of sed-opal commands, dropping redundant ones", sed_batch)
+	ENTRY("sed-index", "Rebuild the serial/WWN/EUI-64 to device index", sed_index)
 );
 #endif
 #include "define_cmd.h"
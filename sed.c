@@ -2,10 +2,13 @@
 #include <sys/mman.h>
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <sys/random.h>
 
 #include <termios.h>
 
 #include <stdio.h>
+#include <stdint.h>
+#include <time.h>
 #include <stdlib.h>
 #include <strings.h>
 #include <string.h>
@@ -13,18 +16,57 @@
 #include <errno.h>
 #include <libgen.h>
 #include <fcntl.h>
+#include <pthread.h>
+#include <dirent.h>
+#include <linux/fs.h>
 
 #include "argconfig.h"
+#include "suffix.h"
 #include "sed-opal.h"
 #include "plugin.h"
+#include "fleet.h"
+#include "throttle.h"
+#include "devindex.h"
+#include "statecache.h"
+#include "erase.h"
+#include "verify.h"
+#include "blkrange.h"
+#include "psid.h"
+#include "discovery.h"
+#include "ioctlcaps.h"
+#include "lrplan.h"
+#include "gpt.h"
+#include "batch.h"
+#include "lrpool.h"
+#include "dmlr.h"
+#include "relayout.h"
+#include "pipeline.h"
 
-static const char *devicename;
 static const char *lr_d = "The locking range we wish to unlock.";
 static const char *user_d = "User Authority to unlock as User[1..9] or Admin1";
+static const char *lr_list_d = "The locking ranges to act on, e.g. 1-5,8";
+static const char *user_list_d = "User Authority as User[1..9] or Admin1, or one per LR, e.g. user1,user2";
 static const char *pw_d = "The password up to 254 characters";
+static const char *admin_pw_d = "Admin1 Password";
 static const char *sum_d = "Specify whether to unlock in sum or in Opal SSC mode";
 static const char *key_d = "Specify whether to store the password in secure Kernel Key Ring";
 static const char *lt_d = "String specifying how to lock/unlock/etc: RW/RO/LK";
+static const char *set_d = "Operate on the named drive set from " FLEET_SETS_FILE;
+static const char *txn_d = "Change all devices or none: roll back the ones that succeeded if any fails";
+static const char *restore_d = "State to roll back to on failure when a drive can't report "\
+	"its current one: RW/RO/LK (default: refuse to start)";
+static const char *cached_d = "Skip LRs the state cache says we already put in the "\
+	"requested state, without asking the drive or checking the password. "\
+	"The cache can't see other tools or a controller reset";
+static const char *probe_d = "After unlocking, time a read inside the LR until it succeeds";
+static const char *dm_d = "Map the LR as its own dm-linear device once unlocked, "\
+	"and remove that before locking it";
+static const char *probe_timeout_d = "Give up on --probe after this many ms (default 5000)";
+static const char *verify_d = "Sample the range before and after the erase and check it now reads as noise";
+static const char *samples_d = "Number of blocks to sample with --verify";
+static const char *vstart_d = "First LBA the LR covers, for --verify/--discard (default: as recorded by sed-setuplr)";
+static const char *vlength_d = "LBAs the LR covers, for --verify/--discard (default: as recorded by sed-setuplr)";
+static const char *discard_d = "Discard the erased range so the drive can reclaim it";
 
 //extern struct command *commands[];
 
@@ -42,9 +84,10 @@ static struct plugin builtin = {
 static struct program sed_opal = {
 	.name = "sed-opal",
 	.version = "1.0",
-	.usage = "<command> [<device>] [<args>]",
+	.usage = "<command> [<device>...] [<args>]",
 	.desc = "The '<device>' must be a block device. "\
-		"(ex: /dev/nvme0n1).",
+		"(ex: /dev/nvme0n1). When several devices are given, "\
+		"devices behind different controllers are handled in parallel.",
 	.extensions = &builtin,
 };
 
@@ -87,30 +130,6 @@ static int opal_error_to_human(int error)
 	return error;
 }
 
-static int open_dev(char *dev)
-{
-	int err, fd;
-	struct stat _stat;
-
-	devicename = basename(dev);
-	err = open(dev, O_RDONLY);
-	if (err < 0)
-		goto perror;
-	fd = err;
-
-	err = fstat(fd, &_stat);
-	if (err < 0)
-		goto perror;
-	if (!S_ISBLK(_stat.st_mode)) {
-		fprintf(stderr, "%s is not a block device!\n", dev);
-		return -ENODEV;
-	}
-	return fd;
- perror:
-	perror(dev);
-	return err;
-}
-
 static char *read_password () {
 	struct termios old, new;
 	char *str;
@@ -171,6 +190,17 @@ reset:		free (str);
 	return str;
 }
 
+static const char *opal_strerror(int error, int err)
+{
+	if (error == 0x3f)
+		return "Failed";
+	if (error < 0)
+		return strerror(err);
+	if (error >= ARRAY_SIZE(opal_errors))
+		return "Unknown Error";
+	return opal_errors[error];
+}
+
 static int check_arg_dev(int argc, char **argv)
 {
 	if (optind >= argc) {
@@ -181,31 +211,146 @@ static int check_arg_dev(int argc, char **argv)
 	return 0;
 }
 
-static int get_dev(int argc, char **argv)
+static int open_fleet(int argc, char **argv, struct fleet *fleet)
 {
 	int ret;
 
 	ret = check_arg_dev(argc, argv);
 	if (ret) {
 		fprintf(stderr, "expected nvme device (ex: /dev/nvme0), none provided\n");
-		return ret;
+		return -ret;
 	}
 
-	return open_dev(argv[optind]);
+	return -fleet_init(fleet, argc - optind, &argv[optind]);
 }
 
-
 static int parse_and_open(int argc, char **argv, const char *desc,
 			  const struct argconfig_commandline_options *clo,
-			  void *cfg, size_t size)
+			  void *cfg, size_t size, struct fleet *fleet)
 {
 	int ret;
 
 	ret = argconfig_parse(argc, argv, desc, clo, cfg, size);
 	if (ret)
-		return ret;
+		return -ret;
+
+	return open_fleet(argc, argv, fleet);
+}
+
+struct fleet_ioctl {
+	unsigned long cmd;
+	void *arg;
+	/* called for every device the ioctl succeeded on */
+	void (*done)(struct fleet_dev *dev, void *arg);
+};
+
+static int fleet_ioctl_one(struct fleet_dev *dev, void *data)
+{
+	struct fleet_ioctl *req = data;
+	int ret;
+
+	ret = ioctl(dev->fd, req->cmd, req->arg);
+	if (!ret && req->done)
+		req->done(dev, req->arg);
+	return ret;
+}
+
+/*
+ * Print the outcome for every device, prefixed with its name when more than
+ * one device was given, and return the first failure.
+ */
+static int fleet_report(struct fleet *fleet)
+{
+	struct fleet_dev *dev;
+	unsigned int i;
+	int ret = 0, err;
+
+	for (i = 0; i < fleet->nr_devs; i++) {
+		dev = &fleet->devs[i];
+		if (fleet->nr_devs > 1)
+			printf("%s: ", dev->name);
+		if (dev->note)
+			printf("(%s) ", dev->note);
+		errno = dev->err;
+		err = opal_error_to_human(dev->result);
+		if (err && !ret)
+			ret = err;
+	}
+	fleet_free(fleet);
+	return ret;
+}
+
+static int fleet_throttle(struct fleet *fleet, struct throttle *throttle)
+{
+	int err;
+
+	err = throttle_setup(throttle);
+	if (err) {
+		fleet_free(fleet);
+		return err;
+	}
+	fleet->throttle = throttle;
+	return 0;
+}
+
+/*
+ * Fail before prompting for anything when the running kernel doesn't know
+ * the ioctl at all. If no device can tell, let the ioctl find out.
+ */
+static int fleet_check_ioctl(struct fleet *fleet, unsigned long cmd)
+{
+	struct ioctlcaps caps;
+	unsigned int i;
+
+	for (i = 0; i < fleet->nr_devs; i++)
+		if (!ioctlcaps_get(fleet->devs[i].fd, &caps))
+			break;
+	if (i == fleet->nr_devs || ioctlcaps_has(&caps, cmd))
+		return 0;
+
+	fprintf(stderr, "The running kernel doesn't support %s\n",
+		ioctlcaps_name(cmd));
+	fleet_free(fleet);
+	return EOPNOTSUPP;
+}
+
+/* ...and what cached discovery data says the drives can't do */
+static int fleet_check_caps(struct fleet *fleet, unsigned long cmd, __u8 lr,
+			    bool sum)
+{
+	unsigned int i;
+	int err;
+
+	err = fleet_check_ioctl(fleet, cmd);
+	if (err)
+		return err;
+	for (i = 0; i < fleet->nr_devs; i++) {
+		err = discovery_check(fleet->devs[i].name, lr, sum);
+		if (err) {
+			fleet_free(fleet);
+			return -err;
+		}
+	}
+	return 0;
+}
+
+static int fleet_ioctl_done(struct fleet *fleet, unsigned long cmd, void *arg,
+			    void (*done)(struct fleet_dev *dev, void *arg))
+{
+	struct fleet_ioctl req = { .cmd = cmd, .arg = arg, .done = done };
+	int err;
+
+	err = fleet_run(fleet, fleet_ioctl_one, &req);
+	if (err) {
+		fleet_free(fleet);
+		return -err;
+	}
+	return fleet_report(fleet);
+}
 
-	return get_dev(argc, argv);
+static int fleet_ioctl(struct fleet *fleet, unsigned long cmd, void *arg)
+{
+	return fleet_ioctl_done(fleet, cmd, arg, NULL);
 }
 
 static int get_user(char *user, enum opal_user *who)
@@ -238,6 +383,84 @@ static int get_user(char *user, enum opal_user *who)
 	return 0;
 }
 
+/*
+ * A size in bytes may carry a K/M/G/T/P/E[i][B] unit; a count of LBAs may
+ * not, since 1G LBAs is easily taken for a gigabyte.
+ */
+static int get_u64(const char *opt, const char *arg, bool bytes, __u64 *val)
+{
+	if (!arg)
+		return 0;
+	*val = suffix_u64_parse(arg);
+	if (errno) {
+		fprintf(stderr, "Bad --%s '%s'\n", opt, arg);
+		return EINVAL;
+	}
+	if (!bytes && arg[strspn(arg, " 0123456789")]) {
+		fprintf(stderr, "--%s counts LBAs and takes no unit\n", opt);
+		return EINVAL;
+	}
+	return 0;
+}
+
+/* "1-5,8": LRs in the order given, each at most once */
+static int get_lr_list(char *list, __u8 *lrs, unsigned int *nr)
+{
+	unsigned long first, last, lr;
+	unsigned int seen = 0;
+	char *tok, *end, *save = NULL;
+
+	*nr = 0;
+	for (tok = strtok_r(list, ",", &save); tok; tok = strtok_r(NULL, ",", &save)) {
+		first = strtoul(tok, &end, 10);
+		last = first;
+		if (end != tok && *end == '-')
+			last = strtoul(end + 1, &end, 10);
+		if (end == tok || *end || first > last || last >= OPAL_MAX_LRS) {
+			fprintf(stderr, "Incorrect LR list, please provide e.g. 1-5,8 with LRs 0-%d\n",
+				OPAL_MAX_LRS - 1);
+			return -EINVAL;
+		}
+		for (lr = first; lr <= last; lr++) {
+			if (seen & (1U << lr)) {
+				fprintf(stderr, "LR %lu given twice\n", lr);
+				return -EINVAL;
+			}
+			seen |= 1U << lr;
+			lrs[(*nr)++] = lr;
+		}
+	}
+	if (!*nr) {
+		fprintf(stderr, "No LR given\n");
+		return -EINVAL;
+	}
+	return 0;
+}
+
+/* one user for every LR, or one per LR in the same order */
+static int get_user_list(char *users, unsigned int nr, enum opal_user *who)
+{
+	char *tok, *save = NULL;
+	unsigned int i = 0;
+
+	for (tok = strtok_r(users, ",", &save); tok; tok = strtok_r(NULL, ",", &save)) {
+		if (i == nr) {
+			i++;
+			break;
+		}
+		if (get_user(tok, &who[i++]))
+			return -EINVAL;
+	}
+	if (i == 1) {
+		while (i < nr)
+			who[i++] = who[0];
+	} else if (i != nr) {
+		fprintf(stderr, "Need one user, or one per LR (%u)\n", nr);
+		return -EINVAL;
+	}
+	return 0;
+}
+
 static int get_lock(char *lock, enum opal_lock_state *lstate)
 {
 	if (strlen(lock) < 2) {
@@ -258,34 +481,366 @@ static int get_lock(char *lock, enum opal_lock_state *lstate)
 	return 0;
 }
 
+static long ts_diff_us(const struct timespec *a, const struct timespec *b)
+{
+	return (b->tv_sec - a->tv_sec) * 1000000L +
+		(b->tv_nsec - a->tv_nsec) / 1000;
+}
+
+static void lkul_done(struct fleet_dev *dev, void *arg)
+{
+	struct opal_lock_unlock *oln = arg;
+
+	statecache_set(dev->name, oln->session.opal_key.lr, oln->l_state);
+	blkrange_invalidate(dev->name, dev->fd, oln->session.opal_key.lr);
+}
+
+struct lkul_req {
+	struct opal_lock_unlock *oln;
+	bool cached;
+	bool probe;
+	unsigned int probe_timeout;	/* ms */
+	bool dm;
+	unsigned long cmd;
+	unsigned int nr_lrs;
+	__u8 lrs[OPAL_MAX_LRS];
+	enum opal_user who[OPAL_MAX_LRS];	/* session authority per LR */
+};
+
+/* time until the first read inside the LR comes back, printed as we go */
+static int lkul_probe(struct fleet_dev *dev, struct lkul_req *req)
+{
+	__u8 lr = req->oln->session.opal_key.lr;
+	__u64 start, length;
+	double ms = 0;
+	int err;
+
+	/* --probe asked for a read; not doing one isn't success */
+	if (blkrange_lr(dev->name, dev->fd, lr, &start, &length)) {
+		dev->note = "unlocked, but the range is unknown so not probed";
+		errno = ENOENT;
+		return -1;
+	}
+	err = blkrange_probe(dev->path, start, req->probe_timeout, &ms);
+	if (err) {
+		if (ms > 0)
+			printf("%s: LR %u not readable after %.1fms\n", dev->name, lr, ms);
+		else
+			printf("%s: LR %u could not be probed: %s\n", dev->name, lr,
+			       strerror(-err));
+		dev->note = "probe failed";
+		errno = -err;
+		return -1;
+	}
+	printf("%s: LR %u readable after %.1fms\n", dev->name, lr, ms);
+	return 0;
+}
+
+static int lkul_dm(struct fleet_dev *dev, struct lkul_req *req)
+{
+	__u8 lr = req->oln->session.opal_key.lr;
+	char node[32];
+	int err;
+
+	err = dmlr_create(dev->name, dev->fd, lr, req->oln->l_state == OPAL_RO,
+			  node, sizeof(node));
+	if (err) {
+		dev->note = err == -ENOENT ? "unlocked, range unknown so not mapped" :
+			"unlocked, but the dm device couldn't be created";
+		errno = -err;
+		return -1;
+	}
+	printf("%s: LR %u mapped at %s (/dev/mapper/" DMLR_PREFIX "%s-lr%u)\n",
+	       dev->name, lr, node, dev->name, lr);
+	return 0;
+}
+
+/*
+ * Lock state changes are idempotent, so with --cached an LR the state cache
+ * says the last transition we made already left in the requested state is
+ * skipped without a session: that is what makes re-asserting the same
+ * states over and over cheap. It takes the cache's word for it, so it
+ * can't be combined with --dm, which would map an LR on a password nobody
+ * checked.
+ *
+ * With --dm the LR's mapping goes away before it locks, so nobody gets I/O
+ * errors out of a device that still looks usable; if it's still open the
+ * LR stays unlocked, and if the lock fails the mapping comes back.
+ */
+static int lkul_one(struct fleet_dev *dev, void *data)
+{
+	struct lkul_req *req = data;
+	struct opal_lock_unlock *oln = req->oln;
+	bool mapped = false, ro = false;
+	__u32 l_state;
+	int ret, err;
+
+	if (req->cached &&
+	    !statecache_get(dev->name, oln->session.opal_key.lr, &l_state) &&
+	    l_state == oln->l_state) {
+		dev->note = "already in requested state, cached";
+		return 0;
+	}
+
+	if (req->dm && oln->l_state == OPAL_LK) {
+		mapped = dmlr_status(dev->name, oln->session.opal_key.lr, &ro) > 0;
+		err = dmlr_remove(dev->name, oln->session.opal_key.lr);
+		if (err) {
+			dev->note = err == -EBUSY ? "dm device still open, not locked" :
+				"couldn't remove the dm device, not locked";
+			errno = -err;
+			return -1;
+		}
+	}
+
+	ret = ioctl(dev->fd, IOC_OPAL_LOCK_UNLOCK, oln);
+	if (ret) {
+		err = errno;
+		statecache_forget(dev->name, oln->session.opal_key.lr);
+		if (mapped)
+			dev->note = dmlr_create(dev->name, dev->fd,
+						oln->session.opal_key.lr, ro, NULL, 0) ?
+				"not locked, and the dm device couldn't be re-created" :
+				"not locked, dm device re-created";
+		errno = err;
+		return ret;
+	}
+	lkul_done(dev, oln);
+	if (req->probe && oln->l_state != OPAL_LK)
+		ret = lkul_probe(dev, req);
+	if (!ret && req->dm && oln->l_state != OPAL_LK)
+		ret = lkul_dm(dev, req);
+	return ret;
+}
+
+/*
+ * Several LRs on the same open device, one ioctl after the other. A failing
+ * LR doesn't stop the rest: each one gets a line of its own and the device
+ * reports the first failure.
+ */
+static int lkul_multi(struct fleet_dev *dev, void *data)
+{
+	struct lkul_req *req = data, one = *req;
+	struct opal_lock_unlock oln = *req->oln;
+	unsigned int i, failed = 0;
+	int ret, first = 0, err = 0;
+
+	one.oln = &oln;
+	for (i = 0; i < req->nr_lrs; i++) {
+		oln.session.opal_key.lr = req->lrs[i];
+		if (!oln.session.sum)
+			oln.session.who = req->who[i];
+		dev->note = NULL;
+		errno = 0;
+		if (req->cmd == IOC_OPAL_LOCK_UNLOCK)
+			ret = lkul_one(dev, &one);
+		else
+			ret = ioctl(dev->fd, req->cmd, &oln);
+		printf("%s: LR %u: %s%s%s%s\n", dev->name, req->lrs[i],
+		       dev->note ? "(" : "", dev->note ? dev->note : "",
+		       dev->note ? ") " : "", opal_strerror(ret, errno));
+		if (ret && !failed++) {
+			first = ret;
+			err = errno;
+		}
+	}
+
+	dev->note = failed && failed < req->nr_lrs ? "some LRs failed" : NULL;
+	errno = err;
+	return first;
+}
+
+struct lkul_prior {
+	struct opal_lock_unlock *oln;
+	int restore;			/* -1: no fallback */
+};
+
+/* what each device goes back to if the transaction fails, in dev->priv */
+static int lkul_prior_one(struct fleet_dev *dev, void *data)
+{
+	struct lkul_prior *prior = data;
+	struct opal_lr_status lrs = { .session = prior->oln->session };
+	int ret;
+
+	ret = ioctl(dev->fd, IOC_OPAL_GET_LR_STATUS, &lrs);
+	memset(&lrs.session, 0, sizeof(lrs.session));
+	if (!ret) {
+		dev->priv = (void *)(uintptr_t)lrs.l_state;
+		return 0;
+	}
+	if (prior->restore >= 0) {
+		dev->priv = (void *)(uintptr_t)prior->restore;
+		return 0;
+	}
+	dev->note = "can't read the current lock state, see --restore";
+	return ret;
+}
+
+/*
+ * All-or-nothing lock state change across a set of devices. Every device's
+ * current state is read first, and if any can't be nothing is touched. Then
+ * every device gets its own thread and all of them are released at once to
+ * keep the skew between the first and the last transition small. If any
+ * member fails the ones that did transition are put back the way they were.
+ */
+static int lkul_transaction(struct fleet *fleet, struct opal_lock_unlock *oln,
+			    int restore)
+{
+	struct lkul_prior prior = { .oln = oln, .restore = restore };
+	struct fleet_ioctl req = {
+		.cmd = IOC_OPAL_LOCK_UNLOCK,
+		.arg = oln,
+		.done = lkul_done,
+	};
+	struct opal_lock_unlock undo = *oln;
+	struct timespec *first = NULL, *last = NULL;
+	struct fleet_dev *dev;
+	unsigned int i, failed = 0;
+	int err;
+
+	err = fleet_run(fleet, lkul_prior_one, &prior);
+	if (err) {
+		fleet_free(fleet);
+		return -err;
+	}
+	for (i = 0; i < fleet->nr_devs; i++)
+		if (fleet->devs[i].result)
+			failed++;
+	if (failed) {
+		fprintf(stderr, "Not starting the transaction, nothing was changed\n");
+		return fleet_report(fleet);
+	}
+
+	err = fleet_run_parallel(fleet, fleet_ioctl_one, &req);
+	if (err) {
+		fprintf(stderr, "Could not start transaction: %s\n", strerror(-err));
+		fleet_free(fleet);
+		return -err;
+	}
+
+	for (i = 0; i < fleet->nr_devs; i++) {
+		dev = &fleet->devs[i];
+		if (dev->result) {
+			failed++;
+			continue;
+		}
+		if (!first || ts_diff_us(&dev->done, first) > 0)
+			first = &dev->done;
+		if (!last || ts_diff_us(last, &dev->done) > 0)
+			last = &dev->done;
+	}
+
+	if (first)
+		printf("Transition skew: %ldus across %u device(s)\n",
+		       ts_diff_us(first, last), fleet->nr_devs - failed);
+
+	if (failed) {
+		for (i = 0; i < fleet->nr_devs; i++) {
+			dev = &fleet->devs[i];
+			if (dev->result)
+				continue;
+			undo.l_state = (uintptr_t)dev->priv;
+			err = ioctl(dev->fd, IOC_OPAL_LOCK_UNLOCK, &undo);
+			printf("%s: %s\n", dev->name,
+			       err ? "ROLLBACK FAILED" : "rolled back");
+			if (err)
+				statecache_forget(dev->name, undo.session.opal_key.lr);
+			else
+				lkul_done(dev, &undo);
+		}
+	}
+	return fleet_report(fleet);
+}
+
 static int do_generic_lkul(int argc, char **argv, struct command *cmd,
 			   struct plugin *plugin, const char *desc,
 			   unsigned long ioctl_cmd)
 {
 	struct config {
-		__u8 lr;
+		char *lr;
 		char *user;
 		char *lock_type;
 		char *password;
 		bool sum;
+		char *set;
+		bool transaction;
+		char *restore;
+		bool cached;
+		bool probe;
+		__u32 probe_timeout;
+		bool dm;
 	};
 
-	struct config cfg = { 0 };
+	struct config cfg = { .probe_timeout = 5000 };
 	const struct argconfig_commandline_options command_line_options[] = {
-		{"lr", 'l', "NUM",       CFG_POSITIVE, &cfg.lr, required_argument, lr_d},
-		{"user", 'u', "FMT",     CFG_STRING, &cfg.user, required_argument, user_d},
+		{"lr", 'l', "LIST",      CFG_STRING, &cfg.lr, required_argument, lr_list_d},
+		{"user", 'u', "FMT",     CFG_STRING, &cfg.user, required_argument, user_list_d},
 		{"locktype", 't', "FMT", CFG_STRING, &cfg.lock_type, required_argument, lt_d},
 		{"password", 'p', "FMT", CFG_STRING, &cfg.password, required_argument, pw_d},
 		{"sum",      's', ""   , CFG_NONE, &cfg.sum, no_argument, sum_d},
+		{"set", 0, "NAME",       CFG_STRING, &cfg.set, required_argument, set_d},
+		{"transaction", 0, "",   CFG_NONE, &cfg.transaction, no_argument, txn_d},
+		{"restore", 0, "FMT",    CFG_STRING, &cfg.restore, required_argument, restore_d},
+		{"cached", 'c', "",      CFG_NONE, &cfg.cached, no_argument, cached_d},
+		{"probe", 0, "",         CFG_NONE, &cfg.probe, no_argument, probe_d},
+		{"probeTimeout", 0, "MS", CFG_POSITIVE, &cfg.probe_timeout, required_argument, probe_timeout_d},
+		{"dm", 0, "",            CFG_NONE, &cfg.dm, no_argument, dm_d},
 		{NULL}
 	};
 
 	struct opal_lock_unlock oln = { };
-	int fd;
+	struct lkul_req req = { .oln = &oln, .cmd = ioctl_cmd };
+	enum opal_lock_state restore;
+	struct fleet fleet;
+	char lr0[] = "0";
+	unsigned int i;
+	int err;
+
+	err = argconfig_parse(argc, argv, desc, command_line_options, &cfg, sizeof(cfg));
+	if (err)
+		return -err;
+
+	if (get_lr_list(cfg.lr ? cfg.lr : lr0, req.lrs, &req.nr_lrs))
+		return EINVAL;
+	if (req.nr_lrs > 1 && cfg.transaction) {
+		fprintf(stderr, "--transaction takes a single LR\n");
+		return EINVAL;
+	}
+
+	if ((cfg.transaction || cfg.probe || cfg.dm || cfg.cached) &&
+	    ioctl_cmd != IOC_OPAL_LOCK_UNLOCK) {
+		fprintf(stderr, "--transaction, --probe, --dm and --cached are only valid for sed-lock-state\n");
+		return EINVAL;
+	}
+	if (cfg.transaction && (cfg.probe || cfg.dm || cfg.cached)) {
+		fprintf(stderr, "--probe, --dm and --cached can't be combined with --transaction\n");
+		return EINVAL;
+	}
+	if (cfg.cached && cfg.dm) {
+		fprintf(stderr, "--cached can't be combined with --dm\n");
+		return EINVAL;
+	}
+
+	if (cfg.set && optind < argc) {
+		fprintf(stderr, "--set or devices, not both\n");
+		return EINVAL;
+	}
+	if (cfg.restore && !cfg.transaction) {
+		fprintf(stderr, "--restore goes with --transaction\n");
+		return EINVAL;
+	}
 
-	fd = parse_and_open(argc, argv, desc, command_line_options, &cfg, sizeof(cfg));
-	if (fd <= 0)
-		return fd==0?EINVAL:-fd;
+	if (cfg.set)
+		err = -fleet_init_set(&fleet, cfg.set);
+	else
+		err = open_fleet(argc, argv, &fleet);
+	if (err)
+		return err;
+	for (i = 0; i < req.nr_lrs; i++) {
+		err = fleet_check_caps(&fleet, ioctl_cmd, req.lrs[i], cfg.sum);
+		if (err)
+			return err;
+	}
 
 	if ( (!cfg.sum && cfg.user == NULL) || cfg.lock_type == NULL || cfg.password == NULL) {
 		if (!((!cfg.sum && cfg.user == NULL) || cfg.lock_type == NULL) && cfg.password == NULL)
@@ -299,9 +854,11 @@ static int do_generic_lkul(int argc, char **argv, struct command *cmd,
 	}
 
 	oln.session.sum = cfg.sum;
-	if (!cfg.sum)
-		if (get_user(cfg.user, &oln.session.who))
+	if (!cfg.sum) {
+		if (get_user_list(cfg.user, req.nr_lrs, req.who))
 			return EINVAL;
+		oln.session.who = req.who[0];
+	}
 
 	if (get_lock(cfg.lock_type, &oln.l_state))
 		return EINVAL;
@@ -313,8 +870,49 @@ static int do_generic_lkul(int argc, char **argv, struct command *cmd,
 		oln.session.opal_key.key_len = 1;
 		oln.session.opal_key.key[0] = 0;
 	}
-	oln.session.opal_key.lr = cfg.lr;
-	return opal_error_to_human(ioctl(fd, ioctl_cmd, &oln));
+	oln.session.opal_key.lr = req.lrs[0];
+
+	if (req.nr_lrs > 1) {
+		req.cached = cfg.cached;
+		req.probe = cfg.probe;
+		req.probe_timeout = cfg.probe_timeout;
+		req.dm = cfg.dm;
+		err = fleet_run(&fleet, lkul_multi, &req);
+		if (err) {
+			fleet_free(&fleet);
+			return -err;
+		}
+		return fleet_report(&fleet);
+	}
+
+	if (cfg.transaction) {
+		if (cfg.restore && get_lock(cfg.restore, &restore)) {
+			fleet_free(&fleet);
+			return EINVAL;
+		}
+		return lkul_transaction(&fleet, &oln, cfg.restore ? (int)restore : -1);
+	}
+
+	if (ioctl_cmd == IOC_OPAL_LOCK_UNLOCK) {
+		req.cached = cfg.cached;
+		req.probe = cfg.probe;
+		req.probe_timeout = cfg.probe_timeout;
+		req.dm = cfg.dm;
+		err = fleet_run(&fleet, lkul_one, &req);
+		if (err) {
+			fleet_free(&fleet);
+			return -err;
+		}
+		return fleet_report(&fleet);
+	}
+	return fleet_ioctl(&fleet, ioctl_cmd, &oln);
+}
+
+static void revert_done(struct fleet_dev *dev, void *arg)
+{
+	devindex_clear_lrs(dev->name);
+	statecache_forget(dev->name, -1);
+	blkrange_invalidate(dev->name, dev->fd, -1);
 }
 
 static int do_generic_opal(int argc, char **argv, struct command *cmd,
@@ -332,11 +930,15 @@ static int do_generic_opal(int argc, char **argv, struct command *cmd,
 		{"password", 'p', "FMT", CFG_STRING, &cfg.password, required_argument, pw_d},
 		{NULL}
 	};
-	int fd;
+	struct fleet fleet;
+	int err;
 
-	fd = parse_and_open(argc, argv, desc, command_line_options, &cfg, sizeof(cfg));
-	if (fd <= 0)
-		return fd==0?EINVAL:-fd;
+	err = parse_and_open(argc, argv, desc, command_line_options, &cfg, sizeof(cfg), &fleet);
+	if (err)
+		return err;
+	err = fleet_check_ioctl(&fleet, ioctl_cmd);
+	if (err)
+		return err;
 
 	if (cfg.password == NULL) {
 		cfg.password = read_password ();
@@ -348,7 +950,8 @@ static int do_generic_opal(int argc, char **argv, struct command *cmd,
 
 	pw.key_len = snprintf((char *)pw.key, sizeof(pw.key), "%s", cfg.password);
 	pw.lr = cfg.lr;
-	return opal_error_to_human(ioctl(fd, ioctl_cmd, &pw));
+	return fleet_ioctl_done(&fleet, ioctl_cmd, &pw,
+				ioctl_cmd == IOC_OPAL_REVERT_TPR ? revert_done : NULL);
 }
 
 int sed_save(int argc, char **argv, struct command *cmd, struct plugin *plugin)
@@ -400,11 +1003,15 @@ int sed_activatelsp(int argc, char **argv, struct command *cmd, struct plugin *p
 	unsigned long parsed;
 	size_t count = 0;
 	char *num, *errchk;
-	int fd;
+	struct fleet fleet;
+	int err;
 
-	fd = parse_and_open(argc, argv, desc, command_line_options, &cfg, sizeof(cfg));
-	if (fd <= 0)
-		return fd==0?EINVAL:-fd;
+	err = parse_and_open(argc, argv, desc, command_line_options, &cfg, sizeof(cfg), &fleet);
+	if (err)
+		return err;
+	err = fleet_check_ioctl(&fleet, IOC_OPAL_ACTIVATE_LSP);
+	if (err)
+		return err;
 
 	if (cfg.password == NULL || (cfg.sum && !cfg.lr_str)) {
 		if (!(cfg.sum && !cfg.lr_str) && cfg.password == NULL) {
@@ -439,8 +1046,7 @@ int sed_activatelsp(int argc, char **argv, struct command *cmd, struct plugin *p
 					     sizeof(opal_activate.key.key),
 					     "%s", cfg.password);
 
-	return opal_error_to_human(ioctl(fd, IOC_OPAL_ACTIVATE_LSP,
-					 &opal_activate));
+	return fleet_ioctl(&fleet, IOC_OPAL_ACTIVATE_LSP, &opal_activate);
 }
 
 int sed_reverttper(int argc, char **argv, struct command *cmd, struct plugin *plugin)
@@ -449,101 +1055,484 @@ int sed_reverttper(int argc, char **argv, struct command *cmd, struct plugin *pl
 	return do_generic_opal(argc, argv, cmd, plugin, desc, IOC_OPAL_REVERT_TPR);
 }
 
-int sed_setuplr(int argc, char **argv, struct command *cmd, struct plugin *plugin)
+static void setuplr_done(struct fleet_dev *dev, void *arg)
 {
-	const char *desc = "Set up a locking range.";
-	const char *rle_d = "Enable read locking on this LR";
-	const char *wle_d = "Enable Write locking on this LR";
-	const char *rs_d = "Where the Locking range should start";
-	const char *rl_d = "Length of the Locking range";
+	struct opal_user_lr_setup *setup = arg;
+
+	/* both what the LR used to cover and what it covers now changed hands */
+	blkrange_invalidate(dev->name, dev->fd, setup->session.opal_key.lr);
+	devindex_set_lr(dev->name, setup->session.opal_key.lr,
+			setup->range_start, setup->range_length);
+	blkrange_invalidate(dev->name, dev->fd, setup->session.opal_key.lr);
+	/* RLE/WLE changes what a lock state means for the range */
+	statecache_forget(dev->name, setup->session.opal_key.lr);
+}
 
-	int fd;
-	struct opal_user_lr_setup setup = { };
-	struct config {
-		__u8 lr;
-		char *user;
-		char *password;
-		bool sum;
-		bool RLE;
-		bool WLE;
-		size_t range_start;
-		size_t range_length;
-	};
+static void erase_done(struct fleet_dev *dev, void *arg)
+{
+	struct opal_session_info *session = arg;
 
-	struct config cfg = {
-		.range_start = 0,
-		.range_length = 0,
-		.WLE = false,
-		.RLE = false
-	};
-	const struct argconfig_commandline_options command_line_options[] = {
-		{"lr", 'l', "NUM",       CFG_POSITIVE, &cfg.lr, required_argument, lr_d},
-		{"user", 'u', "FMT",     CFG_STRING, &cfg.user, required_argument, user_d},
-		{"password", 'p', "FMT", CFG_STRING, &cfg.password, required_argument, pw_d},
-		{"sum",      's', ""   , CFG_NONE, &cfg.sum, no_argument, sum_d},
-		{"readLockEnabled", 'r', "", CFG_NONE, &cfg.RLE, no_argument, rle_d},
-		{"writeLockEnabled", 'w', "", CFG_NONE, &cfg.WLE, no_argument, wle_d},
-		{"rangeStart", 'z', "NUM", CFG_POSITIVE, &cfg.range_start, required_argument, rs_d},
-		{"rangeLength", 'y', "NUM", CFG_POSITIVE, &cfg.range_length, required_argument, rl_d},
-		{NULL}
-	};
+	statecache_forget(dev->name, session->opal_key.lr);
+	blkrange_invalidate(dev->name, dev->fd, session->opal_key.lr);
+}
 
-	fd = parse_and_open(argc, argv, desc, command_line_options, &cfg, sizeof(cfg));
-	if (fd <= 0)
-		return fd==0?EINVAL:-fd;
+/* we don't know how far the shadow MBR reaches */
+static void mbr_done(struct fleet_dev *dev, void *arg)
+{
+	blkrange_invalidate(dev->name, dev->fd, -1);
+}
 
-	if (cfg.range_start == ~0 || cfg.range_length == ~0 || (!cfg.sum && cfg.user == NULL) ||
-	    cfg.password == NULL) {
-		if (!(cfg.range_start == ~0 || cfg.range_length == ~0 || (!cfg.sum && cfg.user == NULL)) && cfg.password == NULL)
-			cfg.password = read_password ();
+struct erase_req {
+	unsigned long cmd;
+	struct opal_session_info *session;
+	bool verify;
+	bool discard;
+	unsigned int samples;
+	__u64 range_start;	/* LBAs */
+	__u64 range_length;	/* 0: look it up in the index */
+};
 
-		if (cfg.range_start == ~0 || cfg.range_length == ~0 || (!cfg.sum && cfg.user == NULL) ||
-		    cfg.password == NULL) {
-			fprintf(stderr, "Incorrect parameters, please try again\n");
-			return EINVAL;
+static int erase_range(struct fleet_dev *dev, struct erase_req *req,
+		       __u64 *start, __u64 *length)
+{
+	unsigned int lbs;
+
+	if (!req->range_length)
+		return blkrange_lr(dev->name, dev->fd, req->session->opal_key.lr,
+				   start, length);
+	if (ioctl(dev->fd, BLKSSZGET, &lbs))
+		return -errno;
+	*start = req->range_start * lbs;
+	*length = req->range_length * lbs;
+	return 0;
+}
+
+/*
+ * With --verify the samples have to be taken while the old key is still in
+ * place, so a range we can't read now is refused rather than erased
+ * unverified. --discard goes last: it would make the samples read as zeroes.
+ */
+static int erase_one(struct fleet_dev *dev, void *data)
+{
+	struct erase_req *req = data;
+	struct verify_result res;
+	__u64 start, length;
+	struct verify v;
+	int ret, err, range;
+
+	range = erase_range(dev, req, &start, &length);
+	if (req->verify) {
+		if (range) {
+			dev->note = "range unknown, pass --rangeStart/--rangeLength";
+			errno = ENOENT;
+			return -1;
+		}
+		err = verify_prepare(&v, dev->path, start, length, req->samples);
+		if (err) {
+			dev->note = "range not readable, unlock it to verify";
+			errno = -err;
+			return -1;
 		}
 	}
 
-	if (!cfg.sum)
-		if (get_user(cfg.user, &setup.session.who))
-			return -EINVAL;
-
-	setup.session.sum = cfg.sum;
-
-	setup.RLE = cfg.RLE;
-	setup.WLE = cfg.WLE;
-
-	setup.range_start = cfg.range_start;
-	setup.range_length = cfg.range_length;
+	ret = ioctl(dev->fd, req->cmd, req->session);
+	if (ret) {
+		if (req->verify)
+			verify_free(&v);
+		return ret;
+	}
+	erase_done(dev, req->session);
+
+	if (req->verify) {
+		err = verify_check(&v, &res);
+		verify_free(&v);
+		if (err) {
+			dev->note = "erased, but could not read back samples";
+			errno = -err;
+			return -1;
+		}
+		printf("%s: %u/%u samples changed, %u/%u read as noise, "
+		       "%.2f%% confident at most %.0f%% of the range is unchanged\n",
+		       dev->name, res.changed, res.total, res.noise, res.total,
+		       res.confidence * 100, VERIFY_UNCHANGED_PCT);
+		if (!res.confidence) {
+			dev->note = "verification failed";
+			errno = EIO;
+			return -1;
+		}
+	}
 
-	setup.session.opal_key.key_len = snprintf((char *)setup.session.opal_key.key,
-						  sizeof(setup.session.opal_key.key),
-						  "%s", cfg.password);
-	if (setup.session.opal_key.key_len == 0) {
-		setup.session.opal_key.key_len = 1;
-		setup.session.opal_key.key[0] = 0;
+	if (req->discard) {
+		if (range) {
+			dev->note = "erased, but the range is unknown so not discarded";
+			errno = ENOENT;
+			return -1;
+		}
+		err = blkrange_discard(dev->path, dev->name, start, length);
+		if (err) {
+			dev->note = "erased, but the discard failed";
+			errno = -err;
+			return -1;
+		}
+		dev->note = "discarded";
 	}
-	setup.session.opal_key.lr = cfg.lr;
-	return opal_error_to_human(ioctl(fd, IOC_OPAL_LR_SETUP, &setup));
+	return 0;
 }
 
-int sed_add_usr_to_lr(int argc, char **argv, struct command *cmd,
-			     struct plugin *plugin)
+static int fleet_erase(struct fleet *fleet, struct erase_req *req)
 {
-        const char *desc = "Add user to Locking range. Non-sum only!";
-	user_d = "User to add to the locking range";
-	pw_d = "Admin1 Password";
-	sum_d = key_d = "THIS FLAG IS UNUSED";
+	int err;
 
-	return do_generic_lkul(argc, argv, cmd, plugin, desc, IOC_OPAL_ADD_USR_TO_LR);
+	err = fleet_run(fleet, erase_one, req);
+	if (err) {
+		fleet_free(fleet);
+		return -err;
+	}
+	return fleet_report(fleet);
 }
 
-int sed_shadowmbr(int argc, char **argv, struct command *cmd,
-			 struct plugin *plugin)
+struct setuplr_req {
+	struct opal_user_lr_setup setup;	/* first LR and the whole range */
+	bool bytes;				/* range given in bytes, not LBAs */
+	bool align;
+	unsigned int split;
+	bool from_gpt;
+	unsigned int nr_parts;			/* 0: every partition */
+	unsigned int parts[OPAL_MAX_LRS];
+};
+
+/* --partitions: as many as there are LRs from first_lr on */
+static int get_part_list(char *list, unsigned int first_lr,
+			 struct setuplr_req *req)
 {
-	const char *desc = "Enable or Disable the MBR Shadow";
-	const char *mbr_d = "Enable or Disable the MBR Shadow";
-	struct opal_mbr_data mbr = { };
+	unsigned int max = first_lr < OPAL_MAX_LRS ? OPAL_MAX_LRS - first_lr : 0;
+	char *tok, *end, *save = NULL;
+	unsigned long idx;
+
+	for (tok = strtok_r(list, ",", &save); tok; tok = strtok_r(NULL, ",", &save)) {
+		idx = strtoul(tok, &end, 10);
+		if (*end || !idx || idx > UINT_MAX || req->nr_parts >= max) {
+			fprintf(stderr, "Bad or too many partitions in --partitions\n");
+			return EINVAL;
+		}
+		req->parts[req->nr_parts++] = idx;
+	}
+	return 0;
+}
+
+/* the selected partitions, in LR order */
+static int setuplr_gpt(struct fleet_dev *dev, struct setuplr_req *req,
+		       const struct lrplan_geom *g, __u64 *starts,
+		       __u64 *lengths, unsigned int *n)
+{
+	__u8 lr = req->setup.session.opal_key.lr;
+	unsigned int max = lr < OPAL_MAX_LRS ? OPAL_MAX_LRS - lr : 0;
+	const struct gpt_part *p;
+	struct gpt gpt;
+	unsigned int i;
+	int err;
+
+	err = gpt_read(dev->path, &gpt);
+	if (err) {
+		dev->note = err == -EILSEQ ? "GPT checksum mismatch" : "no GPT found";
+		errno = -err;
+		return -1;
+	}
+	if (gpt.lbs != g->lbs) {
+		gpt_free(&gpt);
+		errno = EIO;
+		return -1;
+	}
+
+	*n = req->nr_parts ? req->nr_parts : gpt.nr;
+	if (!*n || *n > max) {
+		dev->note = *n ? "more partitions than LRs left" : "no partitions";
+		gpt_free(&gpt);
+		errno = *n ? ENOSPC : ENOENT;
+		return -1;
+	}
+	for (i = 0; i < *n; i++) {
+		p = req->nr_parts ? gpt_find(&gpt, req->parts[i]) : &gpt.parts[i];
+		if (!p) {
+			dev->note = "partition not in the GPT";
+			gpt_free(&gpt);
+			errno = ENOENT;
+			return -1;
+		}
+		starts[i] = p->first;
+		lengths[i] = p->last - p->first + 1;
+	}
+	gpt_free(&gpt);
+	return 0;
+}
+
+/*
+ * Sets up the LRs req asks for on one device and says in *nr how many that
+ * was. Boundaries off the TPer's granularity would be rejected by the
+ * drive, so they're refused here; ones merely off the physical block or
+ * optimal I/O size get a warning. --align and --split place them for us
+ * instead.
+ */
+static int setuplr_lrs(struct fleet_dev *dev, struct setuplr_req *req,
+		       unsigned int *nr)
+{
+	struct opal_user_lr_setup setup = req->setup;
+	__u64 starts[OPAL_MAX_LRS], lengths[OPAL_MAX_LRS], end;
+	unsigned int i, n = req->split ? req->split : 1;
+	struct lrplan_geom g;
+	int err;
+
+	err = lrplan_geometry(dev->name, dev->fd, &g);
+	if (err) {
+		errno = -err;
+		return -1;
+	}
+
+	if (req->from_gpt) {
+		if (setuplr_gpt(dev, req, &g, starts, lengths, &n))
+			return -1;
+		for (i = 0; req->align && i < n; i++) {
+			lrplan_align(&g, &starts[i], &lengths[i]);
+			if (!lengths[i]) {
+				dev->note = "partition too small to align";
+				errno = EINVAL;
+				return -1;
+			}
+		}
+		goto check;
+	}
+
+	starts[0] = setup.range_start;
+	lengths[0] = setup.range_length;
+	if (req->bytes) {
+		if (starts[0] % g.lbs || lengths[0] % g.lbs) {
+			dev->note = "range isn't a multiple of the logical block size";
+			errno = EINVAL;
+			return -1;
+		}
+		starts[0] /= g.lbs;
+		lengths[0] /= g.lbs;
+	}
+	if (starts[0] > g.nr_lbas || lengths[0] > g.nr_lbas - starts[0]) {
+		dev->note = "range goes past the end of the device";
+		errno = ERANGE;
+		return -1;
+	}
+	if (req->split) {
+		if (!lengths[0] && starts[0] < g.nr_lbas)
+			lengths[0] = g.nr_lbas - starts[0];
+		if (lrplan_split(&g, starts[0], lengths[0], n, starts, lengths,
+				 ARRAY_SIZE(starts))) {
+			dev->note = "range too small to split";
+			errno = ENOSPC;
+			return -1;
+		}
+	} else if (req->align && lengths[0]) {
+		lrplan_align(&g, &starts[0], &lengths[0]);
+		if (!lengths[0]) {
+			dev->note = "nothing left of the range once aligned";
+			errno = EINVAL;
+			return -1;
+		}
+	}
+
+ check:
+	for (i = 0; i < n; i++) {
+		end = starts[i] + lengths[i];
+		if (!lrplan_aligned(&g, starts[i], g.required) ||
+		    (end < g.nr_lbas && !lrplan_aligned(&g, end, g.required))) {
+			dev->note = "range not on the drive's alignment granularity, try --align";
+			errno = EINVAL;
+			return -1;
+		}
+		if (lengths[i] && (!lrplan_aligned(&g, starts[i], g.preferred) ||
+		    (end < g.nr_lbas && !lrplan_aligned(&g, end, g.preferred))))
+			printf("%s: LR %u isn't aligned to %llu LBAs, I/O across its "
+			       "boundaries will be split\n", dev->name,
+			       setup.session.opal_key.lr + i, g.preferred);
+	}
+
+	for (i = 0; i < n; i++) {
+		setup.session.opal_key.lr = req->setup.session.opal_key.lr + i;
+		setup.range_start = starts[i];
+		setup.range_length = lengths[i];
+		if (ioctl(dev->fd, IOC_OPAL_LR_SETUP, &setup))
+			return -1;
+		setuplr_done(dev, &setup);
+		if (req->split || req->align || req->from_gpt)
+			printf("%s: LR %u: %llu+%llu\n", dev->name,
+			       setup.session.opal_key.lr, setup.range_start,
+			       setup.range_length);
+	}
+	*nr = n;
+	return 0;
+}
+
+static int setuplr_one(struct fleet_dev *dev, void *data)
+{
+	unsigned int nr;
+
+	return setuplr_lrs(dev, data, &nr);
+}
+
+int sed_setuplr(int argc, char **argv, struct command *cmd, struct plugin *plugin)
+{
+	const char *desc = "Set up a locking range.";
+	const char *rle_d = "Enable read locking on this LR";
+	const char *wle_d = "Enable Write locking on this LR";
+	const char *rs_d = "Where the Locking range should start (with --units bytes, "\
+		"K/M/G/T/P/E[i][B] suffixes allowed)";
+	const char *rl_d = "Length of the Locking range (with --units bytes, "\
+		"K/M/G/T/P/E[i][B] suffixes allowed)";
+	const char *units_d = "Unit of --rangeStart/--rangeLength: sectors (LBAs, default) or bytes";
+	const char *align_d = "Shrink the range onto the drive's preferred LBA alignment";
+	const char *split_d = "Split the range (default: the rest of the device) into "\
+		"this many equal aligned LRs, starting at --lr";
+	const char *gpt_d = "Set up one LR per GPT partition, starting at --lr";
+	const char *parts_d = "Partitions for --from-gpt, e.g. 1,3,4 (default: all)";
+
+	struct fleet fleet;
+	int err;
+	struct setuplr_req req = { };
+	struct opal_user_lr_setup *setup = &req.setup;
+	struct config {
+		__u32 lr;
+		char *user;
+		char *password;
+		bool sum;
+		bool RLE;
+		bool WLE;
+		char *range_start;
+		char *range_length;
+		char *units;
+		bool align;
+		__u32 split;
+		bool from_gpt;
+		char *parts;
+	};
+
+	struct config cfg = {
+		.WLE = false,
+		.RLE = false
+	};
+	const struct argconfig_commandline_options command_line_options[] = {
+		{"lr", 'l', "NUM",       CFG_POSITIVE, &cfg.lr, required_argument, lr_d},
+		{"user", 'u', "FMT",     CFG_STRING, &cfg.user, required_argument, user_d},
+		{"password", 'p', "FMT", CFG_STRING, &cfg.password, required_argument, pw_d},
+		{"sum",      's', ""   , CFG_NONE, &cfg.sum, no_argument, sum_d},
+		{"readLockEnabled", 'r', "", CFG_NONE, &cfg.RLE, no_argument, rle_d},
+		{"writeLockEnabled", 'w', "", CFG_NONE, &cfg.WLE, no_argument, wle_d},
+		{"rangeStart", 'z', "NUM", CFG_STRING, &cfg.range_start, required_argument, rs_d},
+		{"rangeLength", 'y', "NUM", CFG_STRING, &cfg.range_length, required_argument, rl_d},
+		{"units", 'U', "UNIT",   CFG_STRING, &cfg.units, required_argument, units_d},
+		{"align", 'a', "",       CFG_NONE, &cfg.align, no_argument, align_d},
+		{"split", 'n', "NUM",    CFG_POSITIVE, &cfg.split, required_argument, split_d},
+		{"from-gpt", 'g', "",    CFG_NONE, &cfg.from_gpt, no_argument, gpt_d},
+		{"partitions", 'P', "LIST", CFG_STRING, &cfg.parts, required_argument, parts_d},
+		{NULL}
+	};
+
+	err = parse_and_open(argc, argv, desc, command_line_options, &cfg, sizeof(cfg), &fleet);
+	if (err)
+		return err;
+	if (cfg.units && strcasecmp(cfg.units, "sectors") &&
+	    strcasecmp(cfg.units, "bytes")) {
+		fprintf(stderr, "--units must be sectors or bytes\n");
+		fleet_free(&fleet);
+		return EINVAL;
+	}
+	req.bytes = cfg.units && !strcasecmp(cfg.units, "bytes");
+	if (get_u64("rangeStart", cfg.range_start, req.bytes, &setup->range_start) ||
+	    get_u64("rangeLength", cfg.range_length, req.bytes, &setup->range_length)) {
+		fleet_free(&fleet);
+		return EINVAL;
+	}
+	if (cfg.from_gpt && (cfg.split || cfg.range_start || cfg.range_length)) {
+		fprintf(stderr, "--from-gpt takes the ranges from the partition table\n");
+		fleet_free(&fleet);
+		return EINVAL;
+	}
+	if (cfg.parts && !cfg.from_gpt) {
+		fprintf(stderr, "--partitions needs --from-gpt\n");
+		fleet_free(&fleet);
+		return EINVAL;
+	}
+	if (cfg.lr >= OPAL_MAX_LRS || cfg.split >= OPAL_MAX_LRS) {
+		fprintf(stderr, "Only LRs 0-%d exist\n", OPAL_MAX_LRS - 1);
+		fleet_free(&fleet);
+		return EINVAL;
+	}
+	if ((cfg.split || cfg.from_gpt) && !cfg.lr)
+		cfg.lr = 1;
+	if (cfg.parts && get_part_list(cfg.parts, cfg.lr, &req)) {
+		fleet_free(&fleet);
+		return EINVAL;
+	}
+	if (cfg.split && cfg.lr + cfg.split > OPAL_MAX_LRS) {
+		fprintf(stderr, "Only LRs 1-%d can be set up\n", OPAL_MAX_LRS - 1);
+		fleet_free(&fleet);
+		return EINVAL;
+	}
+	err = fleet_check_caps(&fleet, IOC_OPAL_LR_SETUP, cfg.lr, cfg.sum);
+	if (err)
+		return err;
+
+	if ((!cfg.sum && cfg.user == NULL) || cfg.password == NULL) {
+		if (!(!cfg.sum && cfg.user == NULL) && cfg.password == NULL)
+			cfg.password = read_password ();
+
+		if ((!cfg.sum && cfg.user == NULL) || cfg.password == NULL) {
+			fprintf(stderr, "Incorrect parameters, please try again\n");
+			return EINVAL;
+		}
+	}
+
+	if (!cfg.sum)
+		if (get_user(cfg.user, &setup->session.who))
+			return -EINVAL;
+
+	setup->session.sum = cfg.sum;
+
+	setup->RLE = cfg.RLE;
+	setup->WLE = cfg.WLE;
+
+	setup->session.opal_key.key_len = snprintf((char *)setup->session.opal_key.key,
+						   sizeof(setup->session.opal_key.key),
+						   "%s", cfg.password);
+	if (setup->session.opal_key.key_len == 0) {
+		setup->session.opal_key.key_len = 1;
+		setup->session.opal_key.key[0] = 0;
+	}
+	setup->session.opal_key.lr = cfg.lr;
+
+	req.from_gpt = cfg.from_gpt;
+	req.align = cfg.align;
+	req.split = cfg.split;
+	err = fleet_run(&fleet, setuplr_one, &req);
+	if (err) {
+		fleet_free(&fleet);
+		return -err;
+	}
+	return fleet_report(&fleet);
+}
+
+int sed_add_usr_to_lr(int argc, char **argv, struct command *cmd,
+			     struct plugin *plugin)
+{
+        const char *desc = "Add user to Locking range. Non-sum only!";
+	user_list_d = "User to add to the locking range, or one per LR";
+	pw_d = "Admin1 Password";
+	sum_d = key_d = "THIS FLAG IS UNUSED";
+
+	return do_generic_lkul(argc, argv, cmd, plugin, desc, IOC_OPAL_ADD_USR_TO_LR);
+}
+
+int sed_shadowmbr(int argc, char **argv, struct command *cmd,
+			 struct plugin *plugin)
+{
+	const char *desc = "Enable or Disable the MBR Shadow";
+	const char *mbr_d = "Enable or Disable the MBR Shadow";
+	struct opal_mbr_data mbr = { };
 	struct config {
 		char *password;
 		bool enable_mbr;
@@ -554,11 +1543,15 @@ int sed_shadowmbr(int argc, char **argv, struct command *cmd,
 		{"enable_mbr", 'e', "NUM", CFG_NONE, &cfg.enable_mbr, no_argument, mbr_d},
 		{NULL}
 	};
-	int fd;
+	struct fleet fleet;
+	int err;
 
-	fd = parse_and_open(argc, argv, desc, command_line_options, &cfg, sizeof(cfg));
-	if (fd <= 0)
-		return fd==0?EINVAL:-fd;
+	err = parse_and_open(argc, argv, desc, command_line_options, &cfg, sizeof(cfg), &fleet);
+	if (err)
+		return err;
+	err = fleet_check_ioctl(&fleet, IOC_OPAL_ENABLE_DISABLE_MBR);
+	if (err)
+		return err;
 
 	if (cfg.password == NULL) {
 		cfg.password = read_password ();
@@ -577,7 +1570,7 @@ int sed_shadowmbr(int argc, char **argv, struct command *cmd,
 	mbr.key.key_len = snprintf((char *)(char *)mbr.key.key,
 				   sizeof(mbr.key.key),
 				   "%s", cfg.password);
-	return opal_error_to_human(ioctl(fd, IOC_OPAL_ENABLE_DISABLE_MBR, &mbr));
+	return fleet_ioctl_done(&fleet, IOC_OPAL_ENABLE_DISABLE_MBR, &mbr, mbr_done);
 }
 
 int sed_mbr_done(int argc, char **argv, struct command *cmd,
@@ -596,11 +1589,15 @@ int sed_mbr_done(int argc, char **argv, struct command *cmd,
 		{"done", 'd', "NUM", CFG_NONE, &cfg.done, no_argument, mbr_d},
 		{NULL}
 	};
-	int fd;
+	struct fleet fleet;
+	int err;
 
-	fd = parse_and_open(argc, argv, desc, command_line_options, &cfg, sizeof(cfg));
-	if (fd <= 0)
-		return fd==0?EINVAL:-fd;
+	err = parse_and_open(argc, argv, desc, command_line_options, &cfg, sizeof(cfg), &fleet);
+	if (err)
+		return err;
+	err = fleet_check_ioctl(&fleet, IOC_OPAL_MBR_STATUS);
+	if (err)
+		return err;
 
 	if (cfg.password == NULL) {
 		cfg.password = read_password ();
@@ -619,7 +1616,7 @@ int sed_mbr_done(int argc, char **argv, struct command *cmd,
 	mbr.key.key_len = snprintf((char *)(char *)mbr.key.key,
 				   sizeof(mbr.key.key),
 				   "%s", cfg.password);
-	return opal_error_to_human(ioctl(fd, IOC_OPAL_MBR_STATUS, &mbr));
+	return fleet_ioctl_done(&fleet, IOC_OPAL_MBR_STATUS, &mbr, mbr_done);
 }
 
 int sed_load_mbr(int argc, char **argv, struct command *cmd, struct plugin *plugin)
@@ -632,21 +1629,30 @@ int sed_load_mbr(int argc, char **argv, struct command *cmd, struct plugin *plug
 		char *password;
 		char *file;
 		size_t offset;
+		struct throttle throttle;
 	};
 	struct cfg cfg = {.offset = 0};
 	const struct argconfig_commandline_options command_line_options[] = {
 		{"password", 'p', "FMT", CFG_STRING, &cfg.password, required_argument, pw_d},
 		{"infile", 'i', "PATH", CFG_STRING, &cfg.file, required_argument, file_d},
 		{"offset", 'o', "BYTES", CFG_POSITIVE, &cfg.offset, required_argument, offset_d},
+		THROTTLE_OPTIONS(cfg.throttle),
 		{NULL}
 	};
 	struct stat sb;
-	int fd;
+	struct fleet fleet;
+	int err;
 	int pba;
 
-	fd = parse_and_open(argc, argv, desc, command_line_options, &cfg, sizeof(cfg));
-	if (fd <= 0)
-		return fd==0?EINVAL:-fd;
+	err = parse_and_open(argc, argv, desc, command_line_options, &cfg, sizeof(cfg), &fleet);
+	if (err)
+		return err;
+	err = fleet_check_ioctl(&fleet, IOC_OPAL_WRITE_SHADOW_MBR);
+	if (err)
+		return err;
+	err = fleet_throttle(&fleet, &cfg.throttle);
+	if (err)
+		return err;
 
 	pba = open(cfg.file, O_RDONLY | O_CLOEXEC);
 	if (pba == -1) {
@@ -679,11 +1685,11 @@ int sed_load_mbr(int argc, char **argv, struct command *cmd, struct plugin *plug
 				   "%s", cfg.password);
 	mbr.offset = cfg.offset;
 	mbr.size = sb.st_size;
-	fprintf(stderr, "ioctl(fd<%i>, IOC_OPAL_WRITE_SHADOW_MBR, &mbr<%p>)\n",
-		fd, &mbr);
+	fprintf(stderr, "ioctl(%s, IOC_OPAL_WRITE_SHADOW_MBR, &mbr<%p>)\n",
+		fleet.nr_devs > 1 ? "<fleet>" : fleet.devs[0].path, &mbr);
 	fprintf(stderr, "key: lr=%hhu key=%.*s data=%p offset=%llu size=%llu\n",
 		mbr.key.lr, mbr.key.key_len, mbr.key.key, mbr.data, mbr.offset, mbr.size);
-	return opal_error_to_human(ioctl(fd, IOC_OPAL_WRITE_SHADOW_MBR, &mbr));
+	return fleet_ioctl(&fleet, IOC_OPAL_WRITE_SHADOW_MBR, &mbr);
 }
 
 int sed_setpw(int argc, char **argv, struct command *cmd,
@@ -703,6 +1709,7 @@ int sed_setpw(int argc, char **argv, struct command *cmd,
 		char *new_password;
 		char *authority_pw;
 		bool sum;
+		struct throttle throttle;
 	};
 
 	struct config cfg = { 0 };
@@ -712,13 +1719,21 @@ int sed_setpw(int argc, char **argv, struct command *cmd,
 		{"lspAuthority", 'p', "FMT", CFG_STRING, &cfg.lsp_authority, required_argument, lspa_d},
 		{"authorityPW", 'a', "FMT", CFG_STRING, &cfg.authority_pw, required_argument, apw_d},
 		{"sum",      's', ""   , CFG_NONE, &cfg.sum, no_argument, sum_d},
+		THROTTLE_OPTIONS(cfg.throttle),
 		{NULL}
 	};
-	int fd;
-
-	fd = parse_and_open(argc, argv, desc, command_line_options, &cfg, sizeof(cfg));
-	if (fd <= 0)
-		return fd==0?EINVAL:-fd;
+	struct fleet fleet;
+	int err;
+
+	err = parse_and_open(argc, argv, desc, command_line_options, &cfg, sizeof(cfg), &fleet);
+	if (err)
+		return err;
+	err = fleet_check_ioctl(&fleet, IOC_OPAL_SET_PW);
+	if (err)
+		return err;
+	err = fleet_throttle(&fleet, &cfg.throttle);
+	if (err)
+		return err;
 
 	if (cfg.user_for_pw == NULL || cfg.lsp_authority == NULL ||
 	    cfg.new_password == NULL || cfg.authority_pw == NULL) {
@@ -754,7 +1769,7 @@ int sed_setpw(int argc, char **argv, struct command *cmd,
 			 sizeof(pw.new_user_pw.opal_key.key),
 			 "%s", cfg.new_password);
 
-	return opal_error_to_human(ioctl(fd, IOC_OPAL_SET_PW, &pw));
+	return fleet_ioctl(&fleet, IOC_OPAL_SET_PW, &pw);
 }
 
 int sed_enable_user(int argc, char **argv, struct command *cmd,
@@ -774,11 +1789,15 @@ int sed_enable_user(int argc, char **argv, struct command *cmd,
 		{"password", 'p', "FMT", CFG_STRING, &cfg.password, required_argument, pw_d},
 		{NULL}
 	};
-	int fd;
+	struct fleet fleet;
+	int err;
 
-	fd = parse_and_open(argc, argv, desc, command_line_options, &cfg, sizeof(cfg));
-	if (fd <= 0)
-		return fd==0?EINVAL:-fd;
+	err = parse_and_open(argc, argv, desc, command_line_options, &cfg, sizeof(cfg), &fleet);
+	if (err)
+		return err;
+	err = fleet_check_ioctl(&fleet, IOC_OPAL_ACTIVATE_USR);
+	if (err)
+		return err;
 
 	if (cfg.user == NULL || cfg.password == NULL) {
 		if (cfg.user != NULL && cfg.password == NULL)
@@ -800,7 +1819,7 @@ int sed_enable_user(int argc, char **argv, struct command *cmd,
 	usr.opal_key.key_len = snprintf((char *)usr.opal_key.key, sizeof(usr.opal_key.key),
 				   "%s", cfg.password);
 	usr.opal_key.lr = 0;
-	return opal_error_to_human(ioctl(fd, IOC_OPAL_ACTIVATE_USR, &usr));
+	return fleet_ioctl(&fleet, IOC_OPAL_ACTIVATE_USR, &usr);
 }
 
 int sed_erase_lr(int argc, char **argv, struct command *cmd,
@@ -808,10 +1827,14 @@ int sed_erase_lr(int argc, char **argv, struct command *cmd,
 {
 	const char *desc = "Erase a Locking Range: *THIS ERASES YOUR DATA!*";
 	struct config {
-		__u8 lr;
+		__u32 lr;
 		char *user;
 		char *password;
 		bool sum;
+		bool discard;
+		long range_start;
+		long range_length;
+		struct throttle throttle;
 	};
 
 	struct config cfg = { 0 };
@@ -820,13 +1843,32 @@ int sed_erase_lr(int argc, char **argv, struct command *cmd,
 		{"user", 'u', "FMT",     CFG_STRING, &cfg.user, required_argument, user_d},
 		{"password", 'p', "FMT", CFG_STRING, &cfg.password, required_argument, pw_d},
 		{"sum",      's', ""   , CFG_NONE, &cfg.sum, no_argument, sum_d},
+		{"discard",  'd', "",    CFG_NONE, &cfg.discard, no_argument, discard_d},
+		{"rangeStart", 'z', "NUM", CFG_LONG, &cfg.range_start, required_argument, vstart_d},
+		{"rangeLength", 'y', "NUM", CFG_LONG, &cfg.range_length, required_argument, vlength_d},
+		THROTTLE_OPTIONS(cfg.throttle),
 		{NULL}
 	};
 
 	struct opal_session_info session;
-	int fd = parse_and_open(argc, argv, desc, command_line_options, &cfg, sizeof(cfg));
-	if (fd <= 0)
-		return fd==0?EINVAL:-fd;
+	struct erase_req req;
+	struct fleet fleet;
+	int err;
+
+	err = parse_and_open(argc, argv, desc, command_line_options, &cfg, sizeof(cfg), &fleet);
+	if (err)
+		return err;
+	err = fleet_throttle(&fleet, &cfg.throttle);
+	if (err)
+		return err;
+	if (cfg.lr >= OPAL_MAX_LRS) {
+		fprintf(stderr, "Only LRs 0-%d exist\n", OPAL_MAX_LRS - 1);
+		fleet_free(&fleet);
+		return EINVAL;
+	}
+	err = fleet_check_caps(&fleet, IOC_OPAL_ERASE_LR, cfg.lr, cfg.sum);
+	if (err)
+		return err;
 
 	if ( (!cfg.sum && cfg.user == NULL) || cfg.password == NULL) {
 		if (!(!cfg.sum && cfg.user == NULL) && cfg.password == NULL)
@@ -847,7 +1889,19 @@ int sed_erase_lr(int argc, char **argv, struct command *cmd,
 					    sizeof(session.opal_key.key),
 					    "%s", cfg.password);
 	session.opal_key.lr = cfg.lr;
-	return opal_error_to_human(ioctl(fd, IOC_OPAL_ERASE_LR, &session));
+	if (cfg.range_start < 0 || cfg.range_length < 0) {
+		fprintf(stderr, "Invalid arguments for %s\n", __func__);
+		fleet_free(&fleet);
+		return EINVAL;
+	}
+	req = (struct erase_req) {
+		.cmd = IOC_OPAL_ERASE_LR,
+		.session = &session,
+		.discard = cfg.discard,
+		.range_start = cfg.range_start,
+		.range_length = cfg.range_length,
+	};
+	return fleet_erase(&fleet, &req);
 }
 
 int sed_secure_erase_lr(int argc, char **argv, struct command *cmd,
@@ -858,10 +1912,16 @@ int sed_secure_erase_lr(int argc, char **argv, struct command *cmd,
 	struct config {
 		char *user;
 		char *password;
-		__u8   lr;
+		__u32 lr;
 		bool sum;
+		bool verify;
+		bool discard;
+		unsigned int samples;
+		long range_start;
+		long range_length;
+		struct throttle throttle;
 	};
-	struct config cfg = {  };
+	struct config cfg = { .samples = VERIFY_DEF_SAMPLES };
 	user_d = "Authority to start the session as.";
 	pw_d = "Authority Password.";
 	const struct argconfig_commandline_options command_line_options[] = {
@@ -869,17 +1929,38 @@ int sed_secure_erase_lr(int argc, char **argv, struct command *cmd,
 		{"password", 'p', "FMT", CFG_STRING, &cfg.password, required_argument, pw_d},
 		{"lr", 'l', "NUM",       CFG_POSITIVE, &cfg.lr, required_argument, lr_d},
 		{"sum",      's', ""   , CFG_NONE, &cfg.sum, no_argument, sum_d},
+		{"verify",   'V', "",    CFG_NONE, &cfg.verify, no_argument, verify_d},
+		{"samples",  0, "NUM",   CFG_POSITIVE, &cfg.samples, required_argument, samples_d},
+		{"discard",  'd', "",    CFG_NONE, &cfg.discard, no_argument, discard_d},
+		{"rangeStart", 'z', "NUM", CFG_LONG, &cfg.range_start, required_argument, vstart_d},
+		{"rangeLength", 'y', "NUM", CFG_LONG, &cfg.range_length, required_argument, vlength_d},
+		THROTTLE_OPTIONS(cfg.throttle),
 		{NULL}
 	};
-	int fd = parse_and_open(argc, argv, desc, command_line_options, &cfg, sizeof(cfg));
-	if (fd <= 0)
-		return fd==0?EINVAL:-fd;
+	struct erase_req req;
+	struct fleet fleet;
+	int err;
+
+	err = parse_and_open(argc, argv, desc, command_line_options, &cfg, sizeof(cfg), &fleet);
+	if (err)
+		return err;
+	err = fleet_throttle(&fleet, &cfg.throttle);
+	if (err)
+		return err;
+	if (cfg.lr >= OPAL_MAX_LRS) {
+		fprintf(stderr, "Only LRs 0-%d exist\n", OPAL_MAX_LRS - 1);
+		fleet_free(&fleet);
+		return EINVAL;
+	}
+	err = fleet_check_caps(&fleet, IOC_OPAL_SECURE_ERASE_LR, cfg.lr, cfg.sum);
+	if (err)
+		return err;
 
 	if (cfg.user == NULL || cfg.password == NULL) {
 		if (cfg.user != NULL && cfg.password == NULL)
 			cfg.password = read_password ();
 
-		if (cfg.user == NULL && cfg.password == NULL) {
+		if (cfg.user == NULL || cfg.password == NULL) {
 			fprintf(stderr, "Invalid arguments for %s\n", __func__);
 			return EINVAL;
 		}
@@ -890,8 +1971,2192 @@ int sed_secure_erase_lr(int argc, char **argv, struct command *cmd,
 
 	usr.opal_key.key_len = snprintf((char *)usr.opal_key.key, sizeof(usr.opal_key.key),
 				   "%s", cfg.password);
-	usr.opal_key.lr = 0;
-	return opal_error_to_human(ioctl(fd, IOC_OPAL_SECURE_ERASE_LR, &usr));
+	usr.opal_key.lr = cfg.lr;
+	if (!cfg.samples || cfg.range_start < 0 || cfg.range_length < 0) {
+		fprintf(stderr, "Invalid arguments for %s\n", __func__);
+		fleet_free(&fleet);
+		return EINVAL;
+	}
+	req = (struct erase_req) {
+		.cmd = IOC_OPAL_SECURE_ERASE_LR,
+		.session = &usr,
+		.verify = cfg.verify,
+		.discard = cfg.discard,
+		.samples = cfg.samples,
+		.range_start = cfg.range_start,
+		.range_length = cfg.range_length,
+	};
+	return fleet_erase(&fleet, &req);
+}
+
+struct erase_batch {
+	unsigned long cmd;
+	int secure;
+	struct opal_session_info session;
+	__u8 lrs[OPAL_MAX_LRS];
+	unsigned int nr_lrs;
+	struct fleet *fleet;
+	struct devid *ids;		/* per device, for the model */
+	unsigned int *left;		/* per device, LRs still to erase */
+	unsigned int total, done, failed;
+	struct erase_hist hist;
+	pthread_mutex_t lock;
+};
+
+static double ts_ms(const struct timespec *a, const struct timespec *b)
+{
+	return (b->tv_sec - a->tv_sec) * 1000.0 +
+		(b->tv_nsec - a->tv_nsec) / 1000000.0;
+}
+
+/*
+ * Controllers erase in parallel, so the batch is done when the controller
+ * with the most estimated work left is. Returns -1 while we have nothing to
+ * base an estimate on. Called with b->lock held.
+ */
+static double erase_batch_eta(struct erase_batch *b)
+{
+	unsigned int per_ctrl = b->fleet->per_ctrl ? b->fleet->per_ctrl : 1;
+	unsigned int i, j, idx, busy;
+	struct fleet_ctrl *ctrl;
+	double eta = 0, ms, est;
+
+	for (i = 0; i < b->fleet->nr_ctrls; i++) {
+		ctrl = &b->fleet->ctrls[i];
+		ms = 0;
+		busy = 0;
+		for (j = 0; j < ctrl->nr_devs; j++) {
+			idx = ctrl->devs[j] - b->fleet->devs;
+			if (!b->left[idx])
+				continue;
+			est = erase_hist_estimate(&b->hist, b->ids[idx].model, b->secure);
+			if (!est)
+				return -1;
+			ms += est * b->left[idx];
+			busy++;
+		}
+		if (busy > per_ctrl)
+			busy = per_ctrl;
+		if (busy && ms / busy > eta)
+			eta = ms / busy;
+	}
+	return eta;
+}
+
+static void erase_batch_progress(struct erase_batch *b, struct fleet_dev *dev,
+				 int lr, int ret, int err, double ms)
+{
+	unsigned int idx = dev - b->fleet->devs;
+	double eta;
+
+	pthread_mutex_lock(&b->lock);
+	b->left[idx]--;
+	b->done++;
+	if (ret)
+		b->failed++;
+	else
+		erase_hist_update(&b->hist, b->ids[idx].model, b->secure, ms);
+
+	eta = erase_batch_eta(b);
+	printf("[%u/%u] %s LR%d: %s in %.1fs, ", b->done, b->total, dev->name,
+	       lr, opal_strerror(ret, err), ms / 1000);
+	if (eta < 0)
+		printf("ETA unknown\n");
+	else
+		printf("ETA %.0fs\n", eta / 1000);
+	fflush(stdout);
+	pthread_mutex_unlock(&b->lock);
+}
+
+static int erase_batch_one(struct fleet_dev *dev, void *data)
+{
+	struct erase_batch *b = data;
+	struct opal_session_info session = b->session;
+	struct timespec start, end;
+	int ret, err, first = 0, first_err = 0;
+	unsigned int i;
+
+	for (i = 0; i < b->nr_lrs; i++) {
+		session.opal_key.lr = b->lrs[i];
+		clock_gettime(CLOCK_MONOTONIC, &start);
+		ret = ioctl(dev->fd, b->cmd, &session);
+		err = errno;
+		clock_gettime(CLOCK_MONOTONIC, &end);
+
+		if (!ret)
+			erase_done(dev, &session);
+		else if (!first) {
+			first = ret;
+			first_err = err;
+		}
+		erase_batch_progress(b, dev, b->lrs[i], ret, err, ts_ms(&start, &end));
+	}
+	errno = first_err;
+	return first;
+}
+
+int sed_erase_batch(int argc, char **argv, struct command *cmd, struct plugin *plugin)
+{
+	const char *desc = "Erase a set of locking ranges on a set of devices, "\
+		"with controllers working in parallel, reporting progress and "\
+		"the estimated time left: *THIS ERASES YOUR DATA!*";
+	const char *lrs_d = "LRs to erase on every device, e.g. 1-5,8";
+	const char *secure_d = "Secure erase (generate a new key) instead of Erase";
+	const char *perctrl_d = "Devices erased at the same time behind one controller";
+	struct config {
+		char *lr;
+		char *user;
+		char *password;
+		bool sum;
+		bool secure;
+		__u32 per_ctrl;
+		struct throttle throttle;
+	};
+	struct config cfg = { };
+	const struct argconfig_commandline_options command_line_options[] = {
+		{"lr", 'l', "LIST",      CFG_STRING, &cfg.lr, required_argument, lrs_d},
+		{"user", 'u', "FMT",     CFG_STRING, &cfg.user, required_argument, user_d},
+		{"password", 'p', "FMT", CFG_STRING, &cfg.password, required_argument, pw_d},
+		{"sum",      's', ""   , CFG_NONE, &cfg.sum, no_argument, sum_d},
+		{"secure", 0, "",        CFG_NONE, &cfg.secure, no_argument, secure_d},
+		{"perCtrl", 'c', "NUM",  CFG_POSITIVE, &cfg.per_ctrl, required_argument, perctrl_d},
+		THROTTLE_OPTIONS(cfg.throttle),
+		{NULL}
+	};
+	struct erase_batch b = { .lock = PTHREAD_MUTEX_INITIALIZER };
+	struct timespec start, end;
+	struct fleet fleet;
+	unsigned int i;
+	int err;
+
+	err = parse_and_open(argc, argv, desc, command_line_options, &cfg, sizeof(cfg), &fleet);
+	if (err)
+		return err;
+	err = fleet_check_ioctl(&fleet, cfg.secure ? IOC_OPAL_SECURE_ERASE_LR : IOC_OPAL_ERASE_LR);
+	if (err)
+		return err;
+	err = fleet_throttle(&fleet, &cfg.throttle);
+	if (err)
+		return err;
+
+	if (cfg.lr == NULL || (!cfg.sum && cfg.user == NULL)) {
+		fprintf(stderr, "Need to supply the LRs and a user\n");
+		return EINVAL;
+	}
+	if (get_lr_list(cfg.lr, b.lrs, &b.nr_lrs)) {
+		fleet_free(&fleet);
+		return EINVAL;
+	}
+
+	if (cfg.password == NULL) {
+		cfg.password = read_password ();
+		if (cfg.password == NULL) {
+			fprintf(stderr, "Must Provide a password for this command\n");
+			return EINVAL;
+		}
+	}
+
+	b.session.sum = cfg.sum;
+	if (!cfg.sum)
+		if (get_user(cfg.user, &b.session.who))
+			return EINVAL;
+	b.session.opal_key.key_len = snprintf((char *)b.session.opal_key.key,
+					      sizeof(b.session.opal_key.key),
+					      "%s", cfg.password);
+
+	b.secure = cfg.secure;
+	b.cmd = cfg.secure ? IOC_OPAL_SECURE_ERASE_LR : IOC_OPAL_ERASE_LR;
+	b.fleet = &fleet;
+	b.total = fleet.nr_devs * b.nr_lrs;
+	b.ids = calloc(fleet.nr_devs, sizeof(*b.ids));
+	b.left = calloc(fleet.nr_devs, sizeof(*b.left));
+	if (!b.ids || !b.left)
+		return ENOMEM;
+	for (i = 0; i < fleet.nr_devs; i++) {
+		devid_read(fleet.devs[i].name, &b.ids[i]);
+		b.left[i] = b.nr_lrs;
+	}
+	erase_hist_load(&b.hist);
+	fleet.per_ctrl = cfg.per_ctrl;
+
+	pthread_mutex_lock(&b.lock);
+	printf("Erasing %u LR(s) on %u device(s) behind %u controller(s)", b.total,
+	       fleet.nr_devs, fleet.nr_ctrls);
+	if (erase_batch_eta(&b) >= 0)
+		printf(", ETA %.0fs", erase_batch_eta(&b) / 1000);
+	printf("\n");
+	pthread_mutex_unlock(&b.lock);
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	err = fleet_run(&fleet, erase_batch_one, &b);
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	if (err) {
+		fleet_free(&fleet);
+		return -err;
+	}
+
+	printf("Erased %u of %u LR(s) in %.1fs\n", b.total - b.failed, b.total,
+	       ts_ms(&start, &end) / 1000);
+	if (erase_hist_save(&b.hist))
+		fprintf(stderr, "Could not save erase latencies to %s\n", ERASE_HIST_FILE);
+	erase_hist_free(&b.hist);
+	free(b.ids);
+	free(b.left);
+	return fleet_report(&fleet);
+}
+
+struct wipe_req {
+	struct opal_session_info session;
+	__u64 start;		/* bytes */
+	__u64 length;
+	int lr;			/* -1: first LR the drive says is empty */
+};
+
+/*
+ * Only the drive knows which LRs are really unused: the device index may be
+ * stale, or the LRs set up by something else. So an LR is spare only if
+ * GET_LR_STATUS says it covers nothing, and a drive we can't ask needs --lr.
+ */
+static int wipe_spare_lr(struct fleet_dev *dev, struct wipe_req *req)
+{
+	struct opal_lr_status lrs;
+	int lr, ret = -1;
+
+	for (lr = 1; lr < OPAL_MAX_LRS; lr++) {
+		memset(&lrs, 0, sizeof(lrs));
+		lrs.session = req->session;
+		lrs.session.opal_key.lr = lr;
+		if (ioctl(dev->fd, IOC_OPAL_GET_LR_STATUS, &lrs)) {
+			dev->note = "can't ask the drive which LRs are unused, pass --lr";
+			break;
+		}
+		if (!lrs.range_length) {
+			ret = lr;
+			break;
+		}
+	}
+	if (lr == OPAL_MAX_LRS) {
+		dev->note = "no spare LR";
+		errno = ENOSPC;
+	}
+	memset(&lrs, 0, sizeof(lrs));
+	return ret;
+}
+
+static int wipe_zeroout(int fd, __u64 start, __u64 end)
+{
+	__u64 range[2] = { start, end - start };
+
+	if (end <= start)
+		return 0;
+	return ioctl(fd, BLKZEROOUT, range);
+}
+
+/*
+ * The part of the range on the TPer's alignment granularity goes into a spare
+ * LR that is then given a new key; whatever is left at the edges is zeroed.
+ * The LR is left in place afterwards: handing the range back to the global
+ * range would put the old ciphertext back under the key it was written with.
+ */
+static int wipe_one(struct fleet_dev *dev, void *data)
+{
+	struct wipe_req *req = data;
+	struct opal_user_lr_setup setup = { .session = req->session };
+	__u64 end, inner_start, inner_end;
+	int wfd, lr = -1, ret = 0;
+	struct lrplan_geom g;
+
+	ret = lrplan_geometry(dev->name, dev->fd, &g);
+	if (ret) {
+		errno = -ret;
+		return -1;
+	}
+	end = req->start + req->length;
+	if (req->start % g.lbs || req->length % g.lbs || end < req->start ||
+	    end > g.nr_lbas * g.lbs) {
+		dev->note = "range not LBA aligned or past the end of the device";
+		errno = EINVAL;
+		return -1;
+	}
+	inner_start = lrplan_round(&g, req->start / g.lbs, g.required, true);
+	inner_end = end / g.lbs;
+	if (inner_end < g.nr_lbas)
+		inner_end = lrplan_round(&g, inner_end, g.required, false);
+	inner_start *= g.lbs;
+	inner_end *= g.lbs;
+	if (inner_end <= inner_start)
+		inner_start = inner_end = end;
+
+	wfd = open(dev->path, O_WRONLY | O_CLOEXEC);
+	if (wfd < 0)
+		return -1;
+
+	if (inner_end > inner_start) {
+		lr = req->lr < 0 ? wipe_spare_lr(dev, req) : req->lr;
+		if (lr <= 0) {
+			ret = -1;
+			goto out;
+		}
+		setup.session.opal_key.lr = lr;
+		setup.range_start = inner_start / g.lbs;
+		setup.range_length = (inner_end - inner_start) / g.lbs;
+		ret = ioctl(dev->fd, IOC_OPAL_LR_SETUP, &setup);
+		if (ret) {
+			dev->note = "LR setup failed";
+			goto out;
+		}
+		setuplr_done(dev, &setup);
+
+		ret = ioctl(dev->fd, IOC_OPAL_SECURE_ERASE_LR, &setup.session);
+		if (ret) {
+			dev->note = "secure erase failed, LR left set up";
+			goto out;
+		}
+		erase_done(dev, &setup.session);
+	}
+
+	if (wipe_zeroout(wfd, req->start, inner_start) ||
+	    wipe_zeroout(wfd, inner_end, end)) {
+		dev->note = "zeroing the unaligned edges failed";
+		ret = -1;
+		goto out;
+	}
+
+	if (lr > 0)
+		printf("%s: LR %d now covers LBAs %llu+%llu under a new key, "
+		       "%llu bytes at the edges zeroed\n", dev->name, lr,
+		       setup.range_start, setup.range_length,
+		       req->length - (inner_end - inner_start));
+	else
+		printf("%s: range smaller than the drive's LR granularity, zeroed\n",
+		       dev->name);
+ out:
+	close(wfd);
+	return ret;
+}
+
+int sed_wipe(int argc, char **argv, struct command *cmd, struct plugin *plugin)
+{
+	const char *desc = "Wipe an arbitrary byte range by moving it into a spare "\
+		"locking range and generating a new key for it: "\
+		"*THIS DELETES YOUR DATA*";
+	const char *start_d = "First byte to wipe (K/M/G/T suffixes allowed)";
+	const char *length_d = "Bytes to wipe (K/M/G/T suffixes allowed)";
+	const char *wlr_d = "LR to use (default: the first one the drive says covers nothing)";
+	struct config {
+		char *user;
+		char *password;
+		bool sum;
+		long start;
+		long length;
+		int lr;
+	};
+	struct config cfg = { .start = -1, .length = -1, .lr = -1 };
+	const struct argconfig_commandline_options command_line_options[] = {
+		{"user", 'u', "FMT",     CFG_STRING, &cfg.user, required_argument, user_d},
+		{"password", 'p', "FMT", CFG_STRING, &cfg.password, required_argument, pw_d},
+		{"sum",      's', ""   , CFG_NONE, &cfg.sum, no_argument, sum_d},
+		{"start", 'z', "SIZE",   CFG_LONG_SUFFIX, &cfg.start, required_argument, start_d},
+		{"length", 'y', "SIZE",  CFG_LONG_SUFFIX, &cfg.length, required_argument, length_d},
+		{"lr", 'l', "NUM",       CFG_INT, &cfg.lr, required_argument, wlr_d},
+		{NULL}
+	};
+	struct wipe_req req = { };
+	struct fleet fleet;
+	int err;
+
+	err = parse_and_open(argc, argv, desc, command_line_options, &cfg, sizeof(cfg), &fleet);
+	if (err)
+		return err;
+	err = fleet_check_ioctl(&fleet, IOC_OPAL_LR_SETUP);
+	if (!err)
+		err = fleet_check_ioctl(&fleet, IOC_OPAL_SECURE_ERASE_LR);
+	if (err)
+		return err;
+
+	if (cfg.start < 0 || cfg.length <= 0 || cfg.lr == 0 ||
+	    cfg.lr >= OPAL_MAX_LRS || (!cfg.sum && cfg.user == NULL)) {
+		fprintf(stderr, "Need a user, --start and --length, and an LR other than 0\n");
+		fleet_free(&fleet);
+		return EINVAL;
+	}
+	if (cfg.password == NULL) {
+		cfg.password = read_password ();
+		if (cfg.password == NULL) {
+			fprintf(stderr, "Must Provide a password for this command\n");
+			fleet_free(&fleet);
+			return EINVAL;
+		}
+	}
+
+	req.session.sum = cfg.sum;
+	if (!cfg.sum && get_user(cfg.user, &req.session.who)) {
+		fleet_free(&fleet);
+		return EINVAL;
+	}
+	req.session.opal_key.key_len = snprintf((char *)req.session.opal_key.key,
+						sizeof(req.session.opal_key.key),
+						"%s", cfg.password);
+	req.start = cfg.start;
+	req.length = cfg.length;
+	req.lr = cfg.lr;
+
+	err = fleet_run(&fleet, wipe_one, &req);
+	if (err) {
+		fleet_free(&fleet);
+		return -err;
+	}
+	return fleet_report(&fleet);
+}
+
+/* one path per drive in the table; namespaces of a drive share its serial */
+static int psid_scan(struct psid_table *t, char ***paths)
+{
+	char (*seen)[DEVINDEX_ID_LEN] = NULL, path[PATH_MAX];
+	struct dirent *de;
+	struct devid id;
+	int nr = 0, i;
+	DIR *dir;
+
+	dir = opendir("/sys/block");
+	if (!dir)
+		return -errno;
+	while ((de = readdir(dir))) {
+		if (de->d_name[0] == '.')
+			continue;
+		snprintf(path, sizeof(path), "/sys/block/%s/device", de->d_name);
+		if (access(path, F_OK) || devid_read(de->d_name, &id) ||
+		    !psid_lookup(t, id.serial))
+			continue;
+		for (i = 0; i < nr; i++)
+			if (!strcmp(seen[i], id.serial))
+				break;
+		if (i < nr)
+			continue;
+
+		seen = realloc(seen, (nr + 1) * sizeof(*seen));
+		*paths = realloc(*paths, (nr + 1) * sizeof(**paths));
+		if (!seen || !*paths) {
+			nr = -ENOMEM;
+			break;
+		}
+		snprintf(seen[nr], sizeof(seen[nr]), "%s", id.serial);
+		snprintf(path, sizeof(path), "/dev/%s", de->d_name);
+		(*paths)[nr++] = strdup(path);
+	}
+	closedir(dir);
+	free(seen);
+	return nr;
+}
+
+static int psid_revert_one(struct fleet_dev *dev, void *data)
+{
+	struct psid_table *t = data;
+	struct opal_key key = { };
+	const char *psid;
+	struct devid id;
+
+	if (devid_read(dev->name, &id) || !(psid = psid_lookup(t, id.serial))) {
+		dev->note = "serial not in the PSID list";
+		errno = ENOENT;
+		return -1;
+	}
+	key.key_len = snprintf((char *)key.key, sizeof(key.key), "%s", psid);
+	if (ioctl(dev->fd, IOC_OPAL_PSID_REVERT_TPR, &key))
+		return -1;
+	revert_done(dev, NULL);
+	return 0;
+}
+
+int sed_psid_revert(int argc, char **argv, struct command *cmd, struct plugin *plugin)
+{
+	const char *desc = "Revert drives to factory state with the PSID from "\
+		"their label, looked up by serial in a CSV. Without devices, "\
+		"every drive in the host listed in the CSV is reverted: "\
+		"*THIS WILL ERASE ALL YOUR DATA*";
+	const char *psids_d = "CSV of serial,PSID lines";
+	struct config {
+		char *psids;
+	};
+	struct config cfg = { };
+	const struct argconfig_commandline_options command_line_options[] = {
+		{"psids", 'f', "FILE", CFG_STRING, &cfg.psids, required_argument, psids_d},
+		{NULL}
+	};
+	struct psid_table t;
+	struct fleet fleet;
+	char **paths = NULL;
+	int err, nr, i;
+
+	err = argconfig_parse(argc, argv, desc, command_line_options, &cfg, sizeof(cfg));
+	if (err)
+		return -err;
+	if (!cfg.psids) {
+		fprintf(stderr, "Need a CSV of serial,PSID to work from\n");
+		return EINVAL;
+	}
+	err = psid_load(cfg.psids, &t);
+	if (err) {
+		fprintf(stderr, "%s: %s\n", cfg.psids, strerror(-err));
+		return -err;
+	}
+
+	if (optind < argc) {
+		err = -fleet_init(&fleet, argc - optind, &argv[optind]);
+	} else {
+		nr = psid_scan(&t, &paths);
+		if (nr <= 0) {
+			fprintf(stderr, "No drive in this host is listed in %s\n", cfg.psids);
+			psid_free(&t);
+			return nr ? -nr : ENODEV;
+		}
+		err = -fleet_init(&fleet, nr, paths);
+		for (i = 0; i < nr; i++)
+			free(paths[i]);
+		free(paths);
+	}
+	if (!err)
+		err = fleet_check_ioctl(&fleet, IOC_OPAL_PSID_REVERT_TPR);
+	if (err) {
+		psid_free(&t);
+		return err;
+	}
+
+	/* every drive reverts on its own, however many share a controller */
+	fleet.per_ctrl = fleet.nr_devs;
+	err = fleet_run(&fleet, psid_revert_one, &t);
+	psid_free(&t);
+	if (err) {
+		fleet_free(&fleet);
+		return -err;
+	}
+	return fleet_report(&fleet);
+}
+
+static int probe_layout_one(struct fleet_dev *dev, void *data)
+{
+	unsigned int *grid = data;
+
+	dev->priv = calloc(1, sizeof(struct blkrange_layout));
+	if (!dev->priv)
+		return -1;
+	errno = -blkrange_probe_layout(dev->path, *grid, dev->priv);
+	return errno ? -1 : 0;
+}
+
+int sed_probe_layout(int argc, char **argv, struct command *cmd, struct plugin *plugin)
+{
+	const char *desc = "Map which LBAs currently read back and which are "\
+		"locked, by bisecting between O_DIRECT read probes.";
+	const char *grid_d = "Probe this many evenly spaced LBAs before bisecting; "\
+		"regions smaller than the spacing can be missed (default 256)";
+	struct config {
+		__u32 grid;
+	};
+	struct config cfg = { .grid = BLKRANGE_GRID };
+	const struct argconfig_commandline_options command_line_options[] = {
+		{"grid", 'g', "NUM", CFG_POSITIVE, &cfg.grid, required_argument, grid_d},
+		{NULL}
+	};
+	struct blkrange_layout *l;
+	struct fleet_dev *dev;
+	struct fleet fleet;
+	unsigned int i, j;
+	int err;
+
+	err = parse_and_open(argc, argv, desc, command_line_options, &cfg, sizeof(cfg), &fleet);
+	if (err)
+		return err;
+	if (!cfg.grid) {
+		fprintf(stderr, "--grid must be at least 1\n");
+		fleet_free(&fleet);
+		return EINVAL;
+	}
+
+	/* plain reads, no sessions: every device can go at once */
+	fleet.per_ctrl = fleet.nr_devs;
+	err = fleet_run(&fleet, probe_layout_one, &cfg.grid);
+	if (err) {
+		fleet_free(&fleet);
+		return -err;
+	}
+
+	for (i = 0; i < fleet.nr_devs; i++) {
+		dev = &fleet.devs[i];
+		l = dev->priv;
+		if (dev->result || !l) {
+			free(l);
+			continue;
+		}
+		printf("%s: %u region(s) of %u-byte LBAs, %u reads\n", dev->name,
+		       l->nr, l->lbs, l->reads);
+		for (j = 0; j < l->nr; j++)
+			printf("  %llu+%llu %s\n", l->regions[j].start,
+			       l->regions[j].length,
+			       l->regions[j].locked ? "locked" : "readable");
+		blkrange_layout_free(l);
+		free(l);
+		dev->priv = NULL;
+	}
+	return fleet_report(&fleet);
+}
+
+static int discovery_one(struct fleet_dev *dev, void *data)
+{
+	bool *refresh = data;
+
+	dev->priv = calloc(1, sizeof(struct discovery));
+	if (!dev->priv)
+		return -1;
+	errno = -discovery_get(dev->name, dev->fd, *refresh, dev->priv);
+	return errno ? -1 : 0;
+}
+
+int sed_discovery(int argc, char **argv, struct command *cmd, struct plugin *plugin)
+{
+	const char *desc = "Show the TCG Level 0 discovery data of a drive: its "\
+		"SSC and Locking, SUM and geometry features. Results are cached "\
+		"per serial and firmware revision and used by other commands to "\
+		"refuse requests the drive can't serve.";
+	const char *refresh_d = "Query the drive even if the result is cached";
+	const char *kernel_d = "Also list which sed-opal ioctls the running kernel supports";
+	struct config {
+		bool refresh;
+		bool kernel;
+	};
+	struct config cfg = { };
+	const struct argconfig_commandline_options command_line_options[] = {
+		{"refresh", 'r', "", CFG_NONE, &cfg.refresh, no_argument, refresh_d},
+		{"kernel", 'k', "",  CFG_NONE, &cfg.kernel, no_argument, kernel_d},
+		{NULL}
+	};
+	struct ioctlcaps caps;
+	struct fleet_dev *dev;
+	struct fleet fleet;
+	unsigned int i;
+	int err;
+
+	err = parse_and_open(argc, argv, desc, command_line_options, &cfg, sizeof(cfg), &fleet);
+	if (err)
+		return err;
+
+	if (cfg.kernel) {
+		for (i = 0; i < fleet.nr_devs; i++)
+			if (!ioctlcaps_get(fleet.devs[i].fd, &caps))
+				break;
+		if (i < fleet.nr_devs)
+			ioctlcaps_print(&caps);
+		else
+			printf("No device could tell which sed-opal ioctls the kernel supports\n");
+	}
+
+	err = fleet_run(&fleet, discovery_one, &cfg.refresh);
+	if (err) {
+		fleet_free(&fleet);
+		return -err;
+	}
+	for (i = 0; i < fleet.nr_devs; i++) {
+		dev = &fleet.devs[i];
+		if (!dev->result)
+			discovery_print(dev->name, dev->priv);
+		free(dev->priv);
+		dev->priv = NULL;
+	}
+	return fleet_report(&fleet);
+}
+
+struct status_req {
+	struct opal_session_info session;
+	bool ranges;		/* have credentials for LR status */
+	__u8 lrs[OPAL_MAX_LRS];
+	unsigned int nr_lrs;
+};
+
+struct status_snap {
+	struct opal_status st;
+	int st_err;
+	struct opal_lr_status lr[OPAL_MAX_LRS];
+	int lr_err[OPAL_MAX_LRS];	/* 0 if lr[] is valid */
+};
+
+/*
+ * One GET_STATUS and a GET_LR_STATUS per LR. What the drive tells us is the
+ * truth, so the device index and the lock state cache are brought in line.
+ */
+static int status_one(struct fleet_dev *dev, void *data)
+{
+	struct status_req *req = data;
+	struct status_snap *snap;
+	struct opal_lr_status *lrs;
+	unsigned int i;
+	int lr;
+
+	snap = dev->priv = calloc(1, sizeof(*snap));
+	if (!snap)
+		return -1;
+	if (ioctl(dev->fd, IOC_OPAL_GET_STATUS, &snap->st))
+		snap->st_err = errno;
+
+	for (i = 0; req->ranges && i < req->nr_lrs; i++) {
+		lr = req->lrs[i];
+		lrs = &snap->lr[lr];
+		lrs->session = req->session;
+		lrs->session.opal_key.lr = lr;
+		if (ioctl(dev->fd, IOC_OPAL_GET_LR_STATUS, lrs)) {
+			snap->lr_err[lr] = errno;
+			continue;
+		}
+		if (lr)
+			devindex_set_lr(dev->name, lr, lrs->range_start,
+					lrs->range_length);
+		statecache_set(dev->name, lr, lrs->l_state);
+	}
+	errno = snap->st_err;
+	return snap->st_err ? -1 : 0;
+}
+
+static const char *status_lock_str(__u32 l_state)
+{
+	switch (l_state) {
+	case OPAL_RW:
+		return "RW";
+	case OPAL_RO:
+		return "RO";
+	case OPAL_LK:
+		return "LK";
+	}
+	return "??";
+}
+
+static void status_print_table(struct fleet *fleet, struct status_req *req)
+{
+	static const char * const flags[] = {
+		"opal", "locking-supported", "locking-enabled", "locked",
+		"mbr-enabled", "mbr-done", "sum",
+	};
+	struct status_snap *snap;
+	struct opal_lr_status *lrs;
+	unsigned int i, j;
+	int lr;
+
+	printf("%-12s %-3s %14s %14s %-3s %-3s %s\n", "DEVICE", "LR", "START",
+	       "LENGTH", "RLE", "WLE", "STATE");
+	for (i = 0; i < fleet->nr_devs; i++) {
+		snap = fleet->devs[i].priv;
+		if (!snap)
+			continue;
+		printf("%-12s", fleet->devs[i].name);
+		if (snap->st_err)
+			printf(" status: %s", strerror(snap->st_err));
+		for (j = 0; !snap->st_err && j < ARRAY_SIZE(flags); j++)
+			if (snap->st.flags & (1 << j))
+				printf(" %s", flags[j]);
+		printf("\n");
+
+		for (j = 0; req->ranges && j < req->nr_lrs; j++) {
+			lr = req->lrs[j];
+			lrs = &snap->lr[lr];
+			if (snap->lr_err[lr]) {
+				printf("%-12s %-3d %s\n", "", lr,
+				       strerror(snap->lr_err[lr]));
+				continue;
+			}
+			printf("%-12s %-3d %14llu %14llu %-3s %-3s %s\n", "", lr,
+			       lrs->range_start, lrs->range_length,
+			       lrs->RLE ? "yes" : "no", lrs->WLE ? "yes" : "no",
+			       status_lock_str(lrs->l_state));
+		}
+	}
+}
+
+static void status_print_json(struct fleet *fleet, struct status_req *req)
+{
+	struct status_snap *snap;
+	struct opal_lr_status *lrs;
+	unsigned int i, j, n = 0;
+	int lr;
+
+	printf("[");
+	for (i = 0; i < fleet->nr_devs; i++) {
+		snap = fleet->devs[i].priv;
+		if (!snap)
+			continue;
+		printf("%s\n  {\"device\": \"%s\"", n++ ? "," : "",
+		       fleet->devs[i].name);
+		if (snap->st_err)
+			printf(", \"error\": \"%s\"", strerror(snap->st_err));
+		else
+			printf(", \"flags\": %u, \"locking_enabled\": %s, "
+			       "\"locked\": %s, \"mbr_enabled\": %s, "
+			       "\"mbr_done\": %s, \"sum\": %s", snap->st.flags,
+			       snap->st.flags & OPAL_FL_LOCKING_ENABLED ? "true" : "false",
+			       snap->st.flags & OPAL_FL_LOCKED ? "true" : "false",
+			       snap->st.flags & OPAL_FL_MBR_ENABLED ? "true" : "false",
+			       snap->st.flags & OPAL_FL_MBR_DONE ? "true" : "false",
+			       snap->st.flags & OPAL_FL_SUM_SUPPORTED ? "true" : "false");
+		if (req->ranges) {
+			printf(", \"ranges\": [");
+			for (j = 0; j < req->nr_lrs; j++) {
+				lr = req->lrs[j];
+				lrs = &snap->lr[lr];
+				printf("%s\n    {\"lr\": %d", j ? "," : "", lr);
+				if (snap->lr_err[lr])
+					printf(", \"error\": \"%s\"}",
+					       strerror(snap->lr_err[lr]));
+				else
+					printf(", \"start\": %llu, \"length\": %llu, "
+					       "\"rle\": %s, \"wle\": %s, \"state\": \"%s\"}",
+					       lrs->range_start, lrs->range_length,
+					       lrs->RLE ? "true" : "false",
+					       lrs->WLE ? "true" : "false",
+					       status_lock_str(lrs->l_state));
+			}
+			printf("\n  ]");
+		}
+		printf("}");
+	}
+	printf("\n]\n");
+}
+
+int sed_status(int argc, char **argv, struct command *cmd, struct plugin *plugin)
+{
+	const char *desc = "Show the locking and MBR flags of each device and, "\
+		"given credentials, the range, RLE/WLE and lock state of its LRs.";
+	const char *lrs_d = "LRs to report, e.g. 1-5,8 (default: all)";
+	const char *json_d = "Print JSON instead of a table";
+	struct config {
+		char *lr;
+		char *user;
+		char *password;
+		bool sum;
+		bool json;
+	};
+	struct config cfg = { };
+	const struct argconfig_commandline_options command_line_options[] = {
+		{"lr", 'l', "LIST",      CFG_STRING, &cfg.lr, required_argument, lrs_d},
+		{"user", 'u', "FMT",     CFG_STRING, &cfg.user, required_argument, user_d},
+		{"password", 'p', "FMT", CFG_STRING, &cfg.password, required_argument, pw_d},
+		{"sum",      's', ""   , CFG_NONE, &cfg.sum, no_argument, sum_d},
+		{"json",     'j', ""   , CFG_NONE, &cfg.json, no_argument, json_d},
+		{NULL}
+	};
+	struct status_req req = { };
+	struct fleet fleet;
+	unsigned int i;
+	int err;
+
+	err = parse_and_open(argc, argv, desc, command_line_options, &cfg, sizeof(cfg), &fleet);
+	if (err)
+		return err;
+	err = fleet_check_ioctl(&fleet, IOC_OPAL_GET_STATUS);
+	if (err)
+		return err;
+
+	if (cfg.lr) {
+		if (get_lr_list(cfg.lr, req.lrs, &req.nr_lrs)) {
+			fleet_free(&fleet);
+			return EINVAL;
+		}
+	} else {
+		for (i = 0; i < OPAL_MAX_LRS; i++)
+			req.lrs[i] = i;
+		req.nr_lrs = OPAL_MAX_LRS;
+	}
+
+	req.ranges = cfg.sum || cfg.user;
+	if (req.ranges) {
+		if (cfg.password == NULL)
+			cfg.password = read_password ();
+		if (cfg.password == NULL) {
+			fprintf(stderr, "Must Provide a password for LR status\n");
+			fleet_free(&fleet);
+			return EINVAL;
+		}
+		req.session.sum = cfg.sum;
+		if (!cfg.sum && get_user(cfg.user, &req.session.who)) {
+			fleet_free(&fleet);
+			return EINVAL;
+		}
+		req.session.opal_key.key_len = snprintf((char *)req.session.opal_key.key,
+							sizeof(req.session.opal_key.key),
+							"%s", cfg.password);
+	}
+
+	err = fleet_run(&fleet, status_one, &req);
+	if (err) {
+		fleet_free(&fleet);
+		return -err;
+	}
+
+	if (cfg.json)
+		status_print_json(&fleet, &req);
+	else
+		status_print_table(&fleet, &req);
+
+	err = 0;
+	for (i = 0; i < fleet.nr_devs; i++) {
+		if (fleet.devs[i].result && !err)
+			err = fleet.devs[i].err;
+		free(fleet.devs[i].priv);
+		fleet.devs[i].priv = NULL;
+	}
+	fleet_free(&fleet);
+	return err;
+}
+
+struct lrpool_req {
+	const char *tenant;
+	struct opal_key admin;		/* Admin1's password */
+	bool wait;
+};
+
+struct lrpool_grant {
+	__u8 lr;
+	char key[2 * LRPOOL_KEY_BYTES + 1];
+};
+
+static void lrpool_session(struct opal_session_info *s,
+			   const struct opal_key *admin, __u8 lr)
+{
+	memset(s, 0, sizeof(*s));
+	s->who = OPAL_ADMIN1;
+	s->opal_key = *admin;
+	s->opal_key.lr = lr;
+}
+
+/* give userN a fresh random password; hex may be NULL to throw it away */
+static int lrpool_rekey(struct fleet_dev *dev, const struct opal_key *admin,
+			__u8 lr, char *hex)
+{
+	unsigned char raw[LRPOOL_KEY_BYTES];
+	char buf[2 * LRPOOL_KEY_BYTES + 1];
+	struct opal_new_pw pw = { };
+	unsigned int i;
+
+	if (getrandom(raw, sizeof(raw), 0) != sizeof(raw))
+		return -1;
+	for (i = 0; i < sizeof(raw); i++)
+		sprintf(&buf[2 * i], "%02x", raw[i]);
+	memset(raw, 0, sizeof(raw));
+
+	lrpool_session(&pw.session, admin, 0);
+	pw.new_user_pw.who = lr;
+	pw.new_user_pw.opal_key.lr = lr;
+	pw.new_user_pw.opal_key.key_len = 2 * LRPOOL_KEY_BYTES;
+	memcpy(pw.new_user_pw.opal_key.key, buf, 2 * LRPOOL_KEY_BYTES);
+	if (ioctl(dev->fd, IOC_OPAL_SET_PW, &pw))
+		return -1;
+	if (hex)
+		memcpy(hex, buf, sizeof(buf));
+	return 0;
+}
+
+/*
+ * Every step runs as Admin1 except the final unlock, which proves the new
+ * key works. LR N always goes with UserN.
+ */
+static int lrpool_alloc_steps(struct fleet_dev *dev, struct lrpool_req *req,
+			      __u8 lr, enum lrpool_state prev,
+			      struct lrpool_grant *grant)
+{
+	struct opal_user_lr_setup setup = { };
+	struct opal_session_info session;
+	struct opal_lock_unlock oln = { };
+	struct devindex_lr range;
+
+	if (devindex_get_lr(dev->name, lr, &range)) {
+		errno = ENOENT;
+		return -1;
+	}
+
+	/* whatever the last user left behind must not reach the next one */
+	if (prev != LRPOOL_CLEAN) {
+		lrpool_session(&session, &req->admin, lr);
+		if (ioctl(dev->fd, IOC_OPAL_SECURE_ERASE_LR, &session))
+			return -1;
+		erase_done(dev, &session);
+	}
+
+	lrpool_session(&setup.session, &req->admin, lr);
+	setup.range_start = range.range_start;
+	setup.range_length = range.range_length;
+	setup.RLE = setup.WLE = 1;
+	if (ioctl(dev->fd, IOC_OPAL_LR_SETUP, &setup))
+		return -1;
+	setuplr_done(dev, &setup);
+
+	lrpool_session(&session, &req->admin, 0);
+	session.who = lr;
+	if (ioctl(dev->fd, IOC_OPAL_ACTIVATE_USR, &session))
+		return -1;
+	if (lrpool_rekey(dev, &req->admin, lr, grant->key))
+		return -1;
+
+	lrpool_session(&oln.session, &req->admin, lr);
+	oln.session.who = lr;
+	oln.l_state = OPAL_RO;
+	if (ioctl(dev->fd, IOC_OPAL_ADD_USR_TO_LR, &oln))
+		return -1;
+	oln.l_state = OPAL_RW;
+	if (ioctl(dev->fd, IOC_OPAL_ADD_USR_TO_LR, &oln))
+		return -1;
+
+	oln.session.opal_key.key_len = 2 * LRPOOL_KEY_BYTES;
+	memcpy(oln.session.opal_key.key, grant->key, 2 * LRPOOL_KEY_BYTES);
+	if (ioctl(dev->fd, IOC_OPAL_LOCK_UNLOCK, &oln))
+		return -1;
+	lkul_done(dev, &oln);
+	return 0;
+}
+
+static int lrpool_alloc_one(struct fleet_dev *dev, void *data)
+{
+	struct lrpool_req *req = data;
+	struct lrpool_grant *grant;
+	enum lrpool_state prev;
+	struct devindex_lr range;
+	__u32 eligible = 0;
+	int ret, err;
+	__u8 lr;
+
+	for (lr = 1; lr < OPAL_MAX_LRS; lr++)
+		if (!devindex_get_lr(dev->name, lr, &range) && range.range_length)
+			eligible |= 1U << lr;
+	if (!eligible) {
+		dev->note = "no LR ranges recorded, set them up with sed-setuplr first";
+		errno = ENOENT;
+		return -1;
+	}
+
+	err = lrpool_claim(dev->name, eligible, req->tenant, &lr, &prev);
+	if (err) {
+		dev->note = err == -ENOSPC ? "no free LR" :
+			err == -EPERM ? "no LR enrolled, add them with sed-lr-pool --add" :
+			"can't update the LR pool";
+		errno = -err;
+		return -1;
+	}
+
+	grant = calloc(1, sizeof(*grant));
+	if (!grant) {
+		lrpool_set(dev->name, lr, LRPOOL_DIRTY, -ENOMEM);
+		errno = ENOMEM;
+		return -1;
+	}
+	grant->lr = lr;
+	ret = lrpool_alloc_steps(dev, req, lr, prev, grant);
+	if (ret) {
+		err = errno;
+		lrpool_set(dev->name, lr, LRPOOL_DIRTY, ret > 0 ? ret : -err);
+		memset(grant, 0, sizeof(*grant));
+		free(grant);
+		errno = err;
+		return ret;
+	}
+	dev->priv = grant;
+	return 0;
+}
+
+/*
+ * The old tenant's data goes with the media key, the old tenant's password
+ * with a random one nobody ever sees, and the LR ends up locked.
+ */
+static int lrpool_release_one(struct fleet_dev *dev, void *data)
+{
+	struct lrpool_req *req = data;
+	struct opal_session_info session;
+	struct opal_lock_unlock oln = { };
+	__u8 lr = (uintptr_t)dev->priv;
+	int ret;
+
+	if (!lr)
+		return 0;
+
+	/* a tenant still holding the LR's dm device keeps it */
+	ret = dmlr_remove(dev->name, lr);
+	if (ret) {
+		lrpool_set(dev->name, lr, LRPOOL_ALLOCATED, ret);
+		dev->note = "dm device still open, not released";
+		errno = -ret;
+		return -1;
+	}
+
+	lrpool_session(&session, &req->admin, lr);
+	ret = ioctl(dev->fd, IOC_OPAL_SECURE_ERASE_LR, &session);
+	if (!ret) {
+		erase_done(dev, &session);
+		ret = lrpool_rekey(dev, &req->admin, lr, NULL);
+	}
+	if (!ret) {
+		lrpool_session(&oln.session, &req->admin, lr);
+		oln.l_state = OPAL_LK;
+		ret = ioctl(dev->fd, IOC_OPAL_LOCK_UNLOCK, &oln);
+		if (!ret)
+			lkul_done(dev, &oln);
+	}
+	lrpool_set(dev->name, lr, ret ? LRPOOL_DIRTY : LRPOOL_CLEAN,
+		   ret > 0 ? ret : (ret ? -errno : 0));
+	return ret;
+}
+
+static const unsigned long lrpool_ioctls[] = {
+	IOC_OPAL_SECURE_ERASE_LR, IOC_OPAL_LR_SETUP, IOC_OPAL_ACTIVATE_USR,
+	IOC_OPAL_SET_PW, IOC_OPAL_ADD_USR_TO_LR, IOC_OPAL_LOCK_UNLOCK,
+};
+
+static int lrpool_prepare(struct fleet *fleet, struct lrpool_req *req,
+			  char *password)
+{
+	unsigned int i;
+	int err;
+
+	for (i = 0; i < ARRAY_SIZE(lrpool_ioctls); i++) {
+		err = fleet_check_ioctl(fleet, lrpool_ioctls[i]);
+		if (err)
+			return err;
+	}
+	if (!password)
+		password = read_password();
+	if (!password) {
+		fprintf(stderr, "Need the Admin1 password\n");
+		fleet_free(fleet);
+		return EINVAL;
+	}
+	req->admin.key_len = snprintf((char *)req->admin.key,
+				      sizeof(req->admin.key), "%s", password);
+	return 0;
+}
+
+int sed_lr_alloc(int argc, char **argv, struct command *cmd, struct plugin *plugin)
+{
+	const char *desc = "Hand a locking range out of the device's pool to a "\
+		"tenant: set it up, enable its user with a fresh random password "\
+		"and unlock it. The password is printed once and not kept.";
+	const char *tenant_d = "Name the LR is allocated to";
+	struct config {
+		char *tenant;
+		char *password;
+	};
+	struct config cfg = { };
+	const struct argconfig_commandline_options command_line_options[] = {
+		{"tenant", 't', "NAME",  CFG_STRING, &cfg.tenant, required_argument, tenant_d},
+		{"password", 'p', "FMT", CFG_STRING, &cfg.password, required_argument, admin_pw_d},
+		{NULL}
+	};
+	struct lrpool_req req = { };
+	struct lrpool_grant *grant;
+	struct fleet_dev *dev;
+	struct fleet fleet;
+	unsigned int i;
+	int err;
+
+	err = parse_and_open(argc, argv, desc, command_line_options, &cfg, sizeof(cfg), &fleet);
+	if (err)
+		return err;
+	if (!cfg.tenant || !*cfg.tenant) {
+		fprintf(stderr, "--tenant is required\n");
+		fleet_free(&fleet);
+		return EINVAL;
+	}
+	err = lrpool_prepare(&fleet, &req, cfg.password);
+	if (err)
+		return err;
+	req.tenant = cfg.tenant;
+
+	err = fleet_run(&fleet, lrpool_alloc_one, &req);
+	memset(&req.admin, 0, sizeof(req.admin));
+	if (err) {
+		fleet_free(&fleet);
+		return -err;
+	}
+	for (i = 0; i < fleet.nr_devs; i++) {
+		dev = &fleet.devs[i];
+		grant = dev->priv;
+		if (!grant)
+			continue;
+		printf("%s: LR %u for %s, user%u key %s\n", dev->name, grant->lr,
+		       cfg.tenant, grant->lr, grant->key);
+		memset(grant, 0, sizeof(*grant));
+		free(grant);
+		dev->priv = NULL;
+	}
+	return fleet_report(&fleet);
+}
+
+/*
+ * The erase runs in a child of its own so the next allocation, from this
+ * or any other process, never waits on it: the pool hands out other LRs
+ * while this one is marked releasing.
+ */
+int sed_lr_release(int argc, char **argv, struct command *cmd, struct plugin *plugin)
+{
+	const char *desc = "Give a tenant's locking range back to the pool: "\
+		"secure erase it, re-key its user and lock it, in the background.";
+	const char *tenant_d = "Release the LR allocated to this tenant";
+	const char *rlr_d = "Release this LR";
+	const char *wait_d = "Wait for the release to finish";
+	struct config {
+		__u8 lr;
+		char *tenant;
+		char *password;
+		bool wait;
+	};
+	struct config cfg = { };
+	const struct argconfig_commandline_options command_line_options[] = {
+		{"lr", 'l', "NUM",       CFG_POSITIVE, &cfg.lr, required_argument, rlr_d},
+		{"tenant", 't', "NAME",  CFG_STRING, &cfg.tenant, required_argument, tenant_d},
+		{"password", 'p', "FMT", CFG_STRING, &cfg.password, required_argument, admin_pw_d},
+		{"wait", 'w', "",        CFG_NONE, &cfg.wait, no_argument, wait_d},
+		{NULL}
+	};
+	struct lrpool_req req = { };
+	struct fleet_dev *dev;
+	struct fleet fleet;
+	unsigned int i, nr = 0;
+	int err, ret = 0, null;
+	pid_t pid, parent;
+	__u8 lr;
+
+	err = parse_and_open(argc, argv, desc, command_line_options, &cfg, sizeof(cfg), &fleet);
+	if (err)
+		return err;
+	if (!cfg.lr == !cfg.tenant) {
+		fprintf(stderr, "Need exactly one of --lr and --tenant\n");
+		fleet_free(&fleet);
+		return EINVAL;
+	}
+	err = lrpool_prepare(&fleet, &req, cfg.password);
+	if (err)
+		return err;
+
+	for (i = 0; i < fleet.nr_devs; i++) {
+		dev = &fleet.devs[i];
+		lr = cfg.lr;
+		err = cfg.tenant ? lrpool_find(dev->name, cfg.tenant, &lr) : 0;
+		if (!err)
+			err = lrpool_begin_release(dev->name, lr);
+		if (err) {
+			fprintf(stderr, "%s: %s\n", dev->name,
+				err == -ENOENT ? "tenant has no LR here" :
+				err == -EBUSY ? "LR is already being released" :
+				err == -EINVAL ? "LR isn't allocated" : strerror(-err));
+			ret = -err;
+			continue;
+		}
+		dev->priv = (void *)(uintptr_t)lr;
+		nr++;
+	}
+	if (!nr) {
+		fleet_free(&fleet);
+		return ret;
+	}
+
+	if (cfg.wait) {
+		err = fleet_run(&fleet, lrpool_release_one, &req);
+		memset(&req.admin, 0, sizeof(req.admin));
+		if (err) {
+			fleet_free(&fleet);
+			return -err;
+		}
+		err = fleet_report(&fleet);
+		return err ? err : ret;
+	}
+
+	parent = getpid();
+	fflush(NULL);
+	pid = fork();
+	if (pid < 0) {
+		err = errno;
+		perror("fork");
+		for (i = 0; i < fleet.nr_devs; i++)
+			if (fleet.devs[i].priv)
+				lrpool_set(fleet.devs[i].name,
+					   (uintptr_t)fleet.devs[i].priv,
+					   LRPOOL_ALLOCATED, -err);
+		fleet_free(&fleet);
+		return err;
+	}
+	if (!pid) {
+		setsid();
+		null = open("/dev/null", O_RDWR);
+		if (null >= 0) {
+			dup2(null, STDIN_FILENO);
+			dup2(null, STDOUT_FILENO);
+			dup2(null, STDERR_FILENO);
+			close(null);
+		}
+		/* an LR our parent died holding is dirty now, not ours */
+		for (i = 0; i < fleet.nr_devs; i++)
+			if (fleet.devs[i].priv &&
+			    lrpool_set_pid(fleet.devs[i].name,
+					   (uintptr_t)fleet.devs[i].priv,
+					   parent, getpid()))
+				fleet.devs[i].priv = NULL;
+		fleet_run(&fleet, lrpool_release_one, &req);
+		fleet_free(&fleet);
+		exit(0);
+	}
+
+	memset(&req.admin, 0, sizeof(req.admin));
+	for (i = 0; i < fleet.nr_devs; i++) {
+		dev = &fleet.devs[i];
+		if (!dev->priv)
+			continue;
+		lrpool_set_pid(dev->name, (uintptr_t)dev->priv, parent, pid);
+		printf("%s: LR %u releasing in the background (pid %d)\n",
+		       dev->name, (unsigned int)(uintptr_t)dev->priv, pid);
+	}
+	fleet_free(&fleet);
+	return ret;
+}
+
+int sed_lr_pool(int argc, char **argv, struct command *cmd, struct plugin *plugin)
+{
+	const char *desc = "Show which of the device's locking ranges are free, "\
+		"allocated or being released. Only LRs enrolled with --add are "\
+		"ever handed out, and enrolling one gives up its data: it is "\
+		"erased before its first tenant gets it.";
+	const char *tenant_d = "Only show LRs allocated to this tenant";
+	const char *plr_d = "LR to --add or --remove";
+	const char *add_d = "Enrol the LR in the pool";
+	const char *remove_d = "Take the LR out of the pool once no tenant holds it";
+	struct config {
+		char *tenant;
+		__u32 lr;
+		bool add;
+		bool remove;
+	};
+	struct config cfg = { };
+	const struct argconfig_commandline_options command_line_options[] = {
+		{"tenant", 't', "NAME", CFG_STRING, &cfg.tenant, required_argument, tenant_d},
+		{"lr", 'l', "NUM",      CFG_POSITIVE, &cfg.lr, required_argument, plr_d},
+		{"add", 'a', "",        CFG_NONE, &cfg.add, no_argument, add_d},
+		{"remove", 'r', "",     CFG_NONE, &cfg.remove, no_argument, remove_d},
+		{NULL}
+	};
+	struct devindex_lr range;
+	struct fleet_dev *dev;
+	struct lrpool_lr *l;
+	struct fleet fleet;
+	struct lrpool p;
+	unsigned int i, lr;
+	char since[32];
+	int err, ret = 0;
+
+	err = parse_and_open(argc, argv, desc, command_line_options, &cfg, sizeof(cfg), &fleet);
+	if (err)
+		return err;
+	if (cfg.add && cfg.remove) {
+		fprintf(stderr, "--add or --remove, not both\n");
+		fleet_free(&fleet);
+		return EINVAL;
+	}
+	if ((cfg.add || cfg.remove) && (!cfg.lr || cfg.lr >= OPAL_MAX_LRS)) {
+		fprintf(stderr, "--%s needs an --lr from 1 to %u\n",
+			cfg.add ? "add" : "remove", OPAL_MAX_LRS - 1);
+		fleet_free(&fleet);
+		return EINVAL;
+	}
+
+	for (i = 0; i < fleet.nr_devs && (cfg.add || cfg.remove); i++) {
+		dev = &fleet.devs[i];
+		if (cfg.add && (devindex_get_lr(dev->name, cfg.lr, &range) ||
+				!range.range_length)) {
+			fprintf(stderr, "%s: LR %u has no range recorded, set it up "
+				"with sed-setuplr first\n", dev->name, cfg.lr);
+			ret = ENOENT;
+			continue;
+		}
+		err = lrpool_enrol(dev->name, cfg.lr, cfg.add);
+		if (err) {
+			fprintf(stderr, "%s: %s\n", dev->name, err == -EBUSY ?
+				"LR is held by a tenant, release it first" :
+				strerror(-err));
+			ret = -err;
+		}
+	}
+
+	for (i = 0; i < fleet.nr_devs; i++) {
+		dev = &fleet.devs[i];
+		err = lrpool_read(dev->name, &p);
+		if (err) {
+			fprintf(stderr, "%s: %s\n", dev->name, strerror(-err));
+			ret = -err;
+			continue;
+		}
+		printf("%s:\n", dev->name);
+		for (lr = 1; lr < OPAL_MAX_LRS; lr++) {
+			l = &p.lr[lr];
+			if (cfg.tenant && strcmp(l->tenant, cfg.tenant))
+				continue;
+			if (devindex_get_lr(dev->name, lr, &range) || !range.range_length) {
+				printf("  LR %u: no range recorded\n", lr);
+				continue;
+			}
+			if (!l->enrolled && !l->tenant[0]) {
+				printf("  LR %u: %llu+%llu not in the pool\n", lr,
+				       range.range_start, range.range_length);
+				continue;
+			}
+			since[0] = '\0';
+			if (l->since)
+				strftime(since, sizeof(since), " since %F %T",
+					 localtime(&(time_t){ l->since }));
+			printf("  LR %u: %llu+%llu %s%s%s%s", lr, range.range_start,
+			       range.range_length, lrpool_state_name(l->state),
+			       l->tenant[0] ? " to " : "", l->tenant, since);
+			if (l->state == LRPOOL_RELEASING && l->pid)
+				printf(" (pid %d)", l->pid);
+			if (l->state == LRPOOL_DIRTY && l->err)
+				printf(" (last error: %s)", l->err > 0 ?
+				       opal_strerror(l->err, 0) : strerror(-l->err));
+			printf("\n");
+		}
+	}
+	fleet_free(&fleet);
+	return ret;
+}
+
+struct relayout_run {
+	const char *disk;
+	__u8 lr;
+	struct relayout_state *st;
+};
+
+/* keeps the LR's read and write locking as they are, where we can tell */
+static int relayout_setup(struct fleet_dev *dev, struct opal_user_lr_setup *setup,
+			  const struct relayout_state *st)
+{
+	struct opal_lr_status lrs = { .session = setup->session };
+	struct ioctlcaps caps;
+	int err;
+
+	if (!ioctlcaps_get(dev->fd, &caps) &&
+	    ioctlcaps_has(&caps, IOC_OPAL_GET_LR_STATUS) > 0 &&
+	    !ioctl(dev->fd, IOC_OPAL_GET_LR_STATUS, &lrs)) {
+		setup->RLE = lrs.RLE;
+		setup->WLE = lrs.WLE;
+	}
+	memset(&lrs, 0, sizeof(lrs));
+	setup->range_start = st->new_start;
+	setup->range_length = st->new_length;
+	err = ioctl(dev->fd, IOC_OPAL_LR_SETUP, setup);
+	if (err) {
+		printf("%s: LR_SETUP: ", dev->name);
+		return opal_error_to_human(err);
+	}
+	setuplr_done(dev, setup);
+	printf("%s: LR %u now %llu+%llu\n", dev->name, setup->session.opal_key.lr,
+	       st->new_start, st->new_length);
+	return 0;
+}
+
+static int relayout_checkpoint(void *arg, __u64 done)
+{
+	struct relayout_run *run = arg;
+
+	run->st->done = done;
+	return relayout_save(run->disk, run->lr, run->st);
+}
+
+static int relayout_phase(struct relayout_run *run, struct relayout_copy *c,
+			  const char *what)
+{
+	struct timespec start, end;
+	double ms;
+	int err;
+
+	c->done = run->st->done;
+	c->checkpoint = relayout_checkpoint;
+	c->arg = run;
+	if (c->done)
+		printf("%s: resuming %s at %llu of %llu bytes\n", run->disk, what,
+		       c->done, c->len);
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	err = relayout_copy(c);
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	ms = ts_ms(&start, &end);
+	if (err) {
+		fprintf(stderr, "%s: %s failed at %llu of %llu bytes: %s\n",
+			run->disk, what, c->done, c->len, strerror(-err));
+		return -err;
+	}
+	printf("%s: %s %llu bytes in %.1fs (%.0f MB/s)\n", run->disk, what,
+	       c->len - run->st->done, ms / 1000,
+	       ms > 0 ? (c->len - run->st->done) / ms / 1000 : 0);
+	return 0;
+}
+
+/*
+ * Moving an LR's boundaries doesn't move its data, and LBAs that change LR
+ * are read with the other LR's key afterwards. So the data leaves through
+ * the unlocked LR into a stage file, the LR is set up over the new extent
+ * and the data comes back through it. Each step is checkpointed; running
+ * the same command again resumes an interrupted one. An LR that keeps its
+ * first LBA keeps its data where it is, under the same key, so growing or
+ * truncating it is just the LR_SETUP.
+ */
+int sed_relayout(int argc, char **argv, struct command *cmd, struct plugin *plugin)
+{
+	const char *desc = "Move a locking range to a new extent and take its "\
+		"data along, through a stage file. The LR has to be unlocked. "\
+		"Rerun to resume an interrupted re-layout. An LR that keeps its "\
+		"first LBA is resized in place, without a stage file.";
+	const char *ns_d = "New first LBA";
+	const char *nl_d = "New length in LBAs";
+	const char *stage_d = "File to hold the LR's data while it moves; it is "\
+		"plaintext, so put it on encrypted storage";
+	const char *qd_d = "I/Os in flight (default 32)";
+	const char *bs_d = "Bytes per I/O, a multiple of 4K (default 1M)";
+	const char *rle_d = "Enable read locking, if the kernel can't tell us the current setting";
+	const char *wle_d = "Enable write locking, if the kernel can't tell us the current setting";
+	const char *truncate_d = "Allow a new length shorter than the current one; "\
+		"the LR's data past it is lost";
+	struct config {
+		__u32 lr;
+		char *user;
+		char *password;
+		bool sum;
+		char *new_start;
+		char *new_length;
+		char *stage;
+		__u32 qd;
+		long bs;
+		bool RLE;
+		bool WLE;
+		bool truncate;
+	};
+	struct config cfg = { .qd = RELAYOUT_DEF_QD, .bs = RELAYOUT_DEF_BS };
+	const struct argconfig_commandline_options command_line_options[] = {
+		{"lr", 'l', "NUM",       CFG_POSITIVE, &cfg.lr, required_argument, lr_d},
+		{"user", 'u', "FMT",     CFG_STRING, &cfg.user, required_argument, user_d},
+		{"password", 'p', "FMT", CFG_STRING, &cfg.password, required_argument, pw_d},
+		{"sum",      's', ""   , CFG_NONE, &cfg.sum, no_argument, sum_d},
+		{"newStart", 'z', "NUM", CFG_STRING, &cfg.new_start, required_argument, ns_d},
+		{"newLength", 'y', "NUM", CFG_STRING, &cfg.new_length, required_argument, nl_d},
+		{"stage", 'S', "FILE",   CFG_STRING, &cfg.stage, required_argument, stage_d},
+		{"queueDepth", 'q', "NUM", CFG_POSITIVE, &cfg.qd, required_argument, qd_d},
+		{"bufferSize", 'b', "NUM", CFG_LONG_SUFFIX, &cfg.bs, required_argument, bs_d},
+		{"readLockEnabled", 'r', "", CFG_NONE, &cfg.RLE, no_argument, rle_d},
+		{"writeLockEnabled", 'w', "", CFG_NONE, &cfg.WLE, no_argument, wle_d},
+		{"truncate", 't', "",    CFG_NONE, &cfg.truncate, no_argument, truncate_d},
+		{NULL}
+	};
+	struct opal_user_lr_setup setup = { };
+	struct relayout_copy c = { };
+	struct relayout_state st = { };
+	struct relayout_run run;
+	struct devindex_lr old;
+	struct lrplan_geom g;
+	struct fleet_dev *dev;
+	struct fleet fleet;
+	int fd = -1, stage = -1, stage_buf = -1, err;
+	__u64 new_start = 0, new_length = 0, len, end;
+
+	err = parse_and_open(argc, argv, desc, command_line_options, &cfg, sizeof(cfg), &fleet);
+	if (err)
+		return err;
+	err = EINVAL;
+	if (fleet.nr_devs != 1) {
+		fprintf(stderr, "One device at a time\n");
+		goto out;
+	}
+	dev = &fleet.devs[0];
+	if (!cfg.lr || cfg.lr >= OPAL_MAX_LRS) {
+		fprintf(stderr, "--lr must be 1-%d\n", OPAL_MAX_LRS - 1);
+		goto out;
+	}
+	if (cfg.bs <= 0 || cfg.bs % RELAYOUT_ALIGN || !cfg.qd) {
+		fprintf(stderr, "--bufferSize must be a multiple of %d and --queueDepth at least 1\n",
+			RELAYOUT_ALIGN);
+		goto out;
+	}
+	if (get_u64("newStart", cfg.new_start, false, &new_start) ||
+	    get_u64("newLength", cfg.new_length, false, &new_length))
+		goto out;
+	if ((!cfg.sum && !cfg.user) || (!cfg.password && !(cfg.password = read_password()))) {
+		fprintf(stderr, "Need user and password\n");
+		goto out;
+	}
+	if (!cfg.sum && get_user(cfg.user, &setup.session.who))
+		goto out;
+	setup.session.sum = cfg.sum;
+	setup.session.opal_key.lr = cfg.lr;
+	setup.RLE = cfg.RLE;
+	setup.WLE = cfg.WLE;
+	setup.session.opal_key.key_len = snprintf((char *)setup.session.opal_key.key,
+						  sizeof(setup.session.opal_key.key),
+						  "%s", cfg.password);
+
+	err = -lrplan_geometry(dev->name, dev->fd, &g);
+	if (err)
+		goto out;
+	err = EINVAL;
+	if (!relayout_load(dev->name, cfg.lr, &st)) {
+		if ((new_length && (new_start != st.new_start ||
+					new_length != st.new_length)) ||
+		    (cfg.stage && strcmp(cfg.stage, st.stage)) || st.lbs != g.lbs) {
+			fprintf(stderr, "%s: LR %u is halfway through a re-layout to "
+				"%llu+%llu via %s, finish that first\n", dev->name,
+				cfg.lr, st.new_start, st.new_length, st.stage);
+			goto out;
+		}
+	} else {
+		if (!new_length) {
+			fprintf(stderr, "Need --newLength\n");
+			goto out;
+		}
+		if (devindex_get_lr(dev->name, cfg.lr, &old) || !old.range_length) {
+			fprintf(stderr, "%s: LR %u's current range is unknown, run sed-status first\n",
+				dev->name, cfg.lr);
+			goto out;
+		}
+		if (new_length < old.range_length && !cfg.truncate) {
+			fprintf(stderr, "%s: LR %u is %llu LBAs, the last %llu of them "
+				"would be lost; --truncate if that's what you want\n",
+				dev->name, cfg.lr, old.range_length,
+				old.range_length - new_length);
+			goto out;
+		}
+		if (new_start != old.range_start && !cfg.stage) {
+			fprintf(stderr, "Need --stage to move the LR's first LBA\n");
+			goto out;
+		}
+		end = new_start + new_length;
+		if (end < new_start || end > g.nr_lbas) {
+			fprintf(stderr, "%s: new range goes past the end of the device\n", dev->name);
+			goto out;
+		}
+		if (!lrplan_aligned(&g, new_start, g.required) ||
+		    (end < g.nr_lbas && !lrplan_aligned(&g, end, g.required))) {
+			fprintf(stderr, "%s: new range not on the drive's alignment granularity\n",
+				dev->name);
+			goto out;
+		}
+		st.phase = RELAYOUT_STAGING;
+		st.lbs = g.lbs;
+		st.old_start = old.range_start;
+		st.old_length = old.range_length;
+		st.new_start = new_start;
+		st.new_length = new_length;
+		if (new_start == old.range_start) {
+			err = relayout_setup(dev, &setup, &st);
+			goto out;
+		}
+		snprintf(st.stage, sizeof(st.stage), "%s", cfg.stage);
+		err = -relayout_save(dev->name, cfg.lr, &st);
+		if (err)
+			goto out;
+		err = EINVAL;
+	}
+	len = (st.old_length < st.new_length ? st.old_length : st.new_length) * st.lbs;
+
+	fd = open(dev->path, O_RDWR | O_DIRECT | O_CLOEXEC);
+	stage = open(st.stage, O_RDWR | O_CREAT | O_DIRECT | O_CLOEXEC, 0600);
+	if (stage < 0 && errno == EINVAL)
+		stage = open(st.stage, O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+	stage_buf = open(st.stage, O_RDWR | O_CLOEXEC);
+	if (fd < 0 || stage < 0 || stage_buf < 0) {
+		err = errno;
+		perror(fd < 0 ? dev->path : st.stage);
+		goto out;
+	}
+
+	run = (struct relayout_run) { .disk = dev->name, .lr = cfg.lr, .st = &st };
+	c.qd = cfg.qd;
+	c.bs = cfg.bs;
+	c.len = len;
+
+	if (st.phase == RELAYOUT_STAGING) {
+		err = posix_fallocate(stage_buf, 0, len);
+		if (err && err != EOPNOTSUPP && err != EINVAL) {
+			fprintf(stderr, "%s: %s\n", st.stage, strerror(err));
+			goto out;
+		}
+		c.in_fd = c.in_tail_fd = fd;
+		c.out_fd = stage;
+		c.out_tail_fd = stage_buf;
+		c.in_off = st.old_start * st.lbs;
+		c.out_off = 0;
+		err = relayout_phase(&run, &c, "staged");
+		if (err) {
+			if (err == EIO)
+				fprintf(stderr, "%s: is LR %u unlocked?\n", dev->name, cfg.lr);
+			goto out;
+		}
+		st.phase = RELAYOUT_STAGED;
+		st.done = 0;
+		err = -relayout_save(dev->name, cfg.lr, &st);
+		if (err)
+			goto out;
+	}
+
+	if (st.phase == RELAYOUT_STAGED) {
+		err = relayout_setup(dev, &setup, &st);
+		if (err)
+			goto out;
+		st.phase = RELAYOUT_RESTORING;
+		st.done = 0;
+		err = -relayout_save(dev->name, cfg.lr, &st);
+		if (err)
+			goto out;
+	}
+
+	c.in_fd = stage;
+	c.in_tail_fd = stage_buf;
+	c.out_fd = c.out_tail_fd = fd;
+	c.in_off = 0;
+	c.out_off = st.new_start * st.lbs;
+	err = relayout_phase(&run, &c, "restored");
+	if (err)
+		goto out;
+	relayout_finish(dev->name, cfg.lr);
+	if (unlink(st.stage))
+		perror(st.stage);
+ out:
+	memset(&setup, 0, sizeof(setup));
+	if (fd >= 0)
+		close(fd);
+	if (stage >= 0)
+		close(stage);
+	if (stage_buf >= 0)
+		close(stage_buf);
+	fleet_free(&fleet);
+	return err;
+}
+
+struct provision_req {
+	struct opal_key admin;		/* SID's, and so Admin1's once activated */
+	struct opal_key user;		/* every LR user's */
+	struct setuplr_req lr;
+};
+
+static void provision_session(struct opal_session_info *s,
+			      struct provision_req *req, __u8 lr)
+{
+	memset(s, 0, sizeof(*s));
+	s->who = OPAL_ADMIN1;
+	s->opal_key = req->admin;
+	s->opal_key.lr = lr;
+}
+
+static int provision_ownership(struct fleet_dev *dev, void *data)
+{
+	struct provision_req *req = data;
+
+	return ioctl(dev->fd, IOC_OPAL_TAKE_OWNERSHIP, &req->admin);
+}
+
+static int provision_activate(struct fleet_dev *dev, void *data)
+{
+	struct provision_req *req = data;
+	struct opal_lr_act act = { .key = req->admin, .num_lrs = 1 };
+
+	return ioctl(dev->fd, IOC_OPAL_ACTIVATE_LSP, &act);
+}
+
+/* how many LRs a device got is up to its GPT; the later stages need it */
+static int provision_setuplr(struct fleet_dev *dev, void *data)
+{
+	struct provision_req *req = data;
+	unsigned int nr = 0;
+	int ret;
+
+	ret = setuplr_lrs(dev, &req->lr, &nr);
+	dev->priv = (void *)(uintptr_t)nr;
+	return ret;
+}
+
+/* LR N goes with UserN, as with the LR pool */
+static int provision_users(struct fleet_dev *dev, void *data)
+{
+	struct provision_req *req = data;
+	__u8 first = req->lr.setup.session.opal_key.lr;
+	unsigned int nr = (uintptr_t)dev->priv;
+	struct opal_session_info session;
+	__u8 lr;
+
+	for (lr = first; lr < first + nr; lr++) {
+		provision_session(&session, req, 0);
+		session.who = lr;
+		if (ioctl(dev->fd, IOC_OPAL_ACTIVATE_USR, &session))
+			return -1;
+	}
+	return 0;
+}
+
+static int provision_setpw(struct fleet_dev *dev, void *data)
+{
+	struct provision_req *req = data;
+	__u8 first = req->lr.setup.session.opal_key.lr;
+	unsigned int nr = (uintptr_t)dev->priv;
+	struct opal_new_pw pw;
+	__u8 lr;
+	int ret = 0;
+
+	for (lr = first; !ret && lr < first + nr; lr++) {
+		memset(&pw, 0, sizeof(pw));
+		provision_session(&pw.session, req, 0);
+		pw.new_user_pw.who = lr;
+		pw.new_user_pw.opal_key = req->user;
+		pw.new_user_pw.opal_key.lr = lr;
+		ret = ioctl(dev->fd, IOC_OPAL_SET_PW, &pw);
+	}
+	memset(&pw, 0, sizeof(pw));
+	return ret;
+}
+
+static int provision_acl(struct fleet_dev *dev, void *data)
+{
+	struct provision_req *req = data;
+	__u8 first = req->lr.setup.session.opal_key.lr;
+	unsigned int nr = (uintptr_t)dev->priv;
+	struct opal_lock_unlock oln = { };
+	__u8 lr;
+
+	for (lr = first; lr < first + nr; lr++) {
+		provision_session(&oln.session, req, lr);
+		oln.session.who = lr;
+		oln.l_state = OPAL_RO;
+		if (ioctl(dev->fd, IOC_OPAL_ADD_USR_TO_LR, &oln))
+			return -1;
+		oln.l_state = OPAL_RW;
+		if (ioctl(dev->fd, IOC_OPAL_ADD_USR_TO_LR, &oln))
+			return -1;
+	}
+	return 0;
+}
+
+static struct pipeline_stage provision_stages[] = {
+	{ .name = "ownership",	.fn = provision_ownership },
+	{ .name = "activate",	.fn = provision_activate },
+	{ .name = "setuplr",	.fn = provision_setuplr },
+	{ .name = "users",	.fn = provision_users },
+	{ .name = "setpw",	.fn = provision_setpw },
+	{ .name = "acl",	.fn = provision_acl },
+};
+
+static const unsigned long provision_ioctls[] = {
+	IOC_OPAL_TAKE_OWNERSHIP, IOC_OPAL_ACTIVATE_LSP, IOC_OPAL_LR_SETUP,
+	IOC_OPAL_ACTIVATE_USR, IOC_OPAL_SET_PW, IOC_OPAL_ADD_USR_TO_LR,
+};
+
+/* "N" for every stage, or "stage=N,..." to size some of them */
+static int provision_workers(char *list, unsigned int nr_stages)
+{
+	char *tok, *eq, *end, *save = NULL;
+	unsigned long n;
+	unsigned int i;
+
+	for (tok = strtok_r(list, ",", &save); tok; tok = strtok_r(NULL, ",", &save)) {
+		eq = strchr(tok, '=');
+		n = strtoul(eq ? eq + 1 : tok, &end, 10);
+		if (*end || !n || n > 1024)
+			goto bad;
+		if (eq)
+			*eq = '\0';
+		for (i = 0; i < nr_stages; i++)
+			if (!eq || !strcmp(tok, provision_stages[i].name))
+				provision_stages[i].workers = n;
+		if (!eq)
+			continue;
+		for (i = 0; i < nr_stages; i++)
+			if (!strcmp(tok, provision_stages[i].name))
+				break;
+		if (i == nr_stages)
+			goto bad;
+	}
+	return 0;
+ bad:
+	fprintf(stderr, "Bad --workers, want N or STAGE=N,... with stages");
+	for (i = 0; i < nr_stages; i++)
+		fprintf(stderr, " %s", provision_stages[i].name);
+	fprintf(stderr, "\n");
+	return EINVAL;
+}
+
+/*
+ * What each stage did and how fast it could go: a stage with W workers
+ * that takes T per device manages W/T devices at best, and the line as a
+ * whole no more than its slowest stage does.
+ */
+static int provision_report(struct fleet *fleet, unsigned int nr_stages,
+			    double ms)
+{
+	struct pipeline_stage *stage, *slowest = NULL;
+	double per, rate, min = 0;
+	unsigned int i, j, ok;
+	struct fleet_dev *dev;
+	int ret = 0;
+
+	printf("%-10s %7s %6s %6s %10s %10s %12s\n", "stage", "workers", "done",
+	       "failed", "s/device", "queued s", "devices/min");
+	for (i = 0; i < nr_stages; i++) {
+		stage = &provision_stages[i];
+		j = stage->done + stage->nr_failed;
+		per = j ? stage->busy_ms / j : 0;
+		rate = per && stage->done ? stage->workers * 60000.0 / per : 0;
+		printf("%-10s %7u %6u %6u %10.2f %10.2f %12.1f\n", stage->name,
+		       stage->workers, stage->done, stage->nr_failed, per / 1000,
+		       j ? stage->wait_ms / j / 1000 : 0, rate);
+		if (rate && (!slowest || rate < min)) {
+			slowest = stage;
+			min = rate;
+		}
+	}
+	ok = provision_stages[nr_stages - 1].done;
+	printf("Provisioned %u of %u device(s) in %.1fs", ok, fleet->nr_devs,
+	       ms / 1000);
+	if (ms > 0 && ok)
+		printf(", %.1f devices/min", ok * 60000.0 / ms);
+	if (slowest)
+		printf(", slowest stage %s", slowest->name);
+	printf("\n");
+
+	for (i = 0; i < nr_stages; i++) {
+		stage = &provision_stages[i];
+		if (!stage->nr_failed)
+			continue;
+		printf("Failed in %s:\n", stage->name);
+		for (j = 0; j < stage->nr_failed; j++) {
+			dev = &fleet->devs[stage->failed[j]];
+			printf("  %s: ", dev->name);
+			if (dev->note)
+				printf("(%s) ", dev->note);
+			errno = dev->err;
+			if (!ret)
+				ret = opal_error_to_human(dev->result);
+			else
+				opal_error_to_human(dev->result);
+		}
+	}
+	return ret;
+}
+
+int sed_provision(int argc, char **argv, struct command *cmd, struct plugin *plugin)
+{
+	const char *desc = "Provision new drives as a pipeline: take ownership, "\
+		"activate the Locking SP and, with --split or --from-gpt, set up "\
+		"the LRs and enable UserN for LR N with --newUserPW as its password "\
+		"and read/write access to it. Every stage has its own workers, so "\
+		"different drives are in different stages at the same time.";
+	const char *password_d = "SID password to set, which Admin1 inherits";
+	const char *newpw_d = "Password for the users of the LRs";
+	const char *first_d = "First LR to set up (default 1)";
+	const char *rle_d = "Enable read locking on the LRs";
+	const char *wle_d = "Enable write locking on the LRs";
+	const char *split_d = "Split the device into this many equal aligned LRs, starting at --lr";
+	const char *gpt_d = "Set up one LR per GPT partition, starting at --lr";
+	const char *parts_d = "Partitions for --from-gpt, e.g. 1,3,4 (default: all)";
+	const char *align_d = "Shrink the partitions onto the drive's preferred LBA alignment";
+	const char *workers_d = "Workers per stage: N for all of them, or e.g. "\
+		"setuplr=8,acl=8 (default 4)";
+	const char *perctrl_d = "Devices in any stage at the same time behind one controller";
+	struct config {
+		char *password;
+		char *new_pw;
+		__u32 lr;
+		bool RLE;
+		bool WLE;
+		__u32 split;
+		bool from_gpt;
+		char *parts;
+		bool align;
+		char *workers;
+		__u32 per_ctrl;
+		struct throttle throttle;
+	};
+	struct config cfg = { };
+	const struct argconfig_commandline_options command_line_options[] = {
+		{"password", 'p', "FMT", CFG_STRING, &cfg.password, required_argument, password_d},
+		{"newUserPW", 'n', "FMT", CFG_STRING, &cfg.new_pw, required_argument, newpw_d},
+		{"lr", 'l', "NUM",       CFG_POSITIVE, &cfg.lr, required_argument, first_d},
+		{"readLockEnabled", 'r', "", CFG_NONE, &cfg.RLE, no_argument, rle_d},
+		{"writeLockEnabled", 'w', "", CFG_NONE, &cfg.WLE, no_argument, wle_d},
+		{"split", 'x', "NUM",    CFG_POSITIVE, &cfg.split, required_argument, split_d},
+		{"from-gpt", 'g', "",    CFG_NONE, &cfg.from_gpt, no_argument, gpt_d},
+		{"partitions", 'P', "LIST", CFG_STRING, &cfg.parts, required_argument, parts_d},
+		{"align", 'a', "",       CFG_NONE, &cfg.align, no_argument, align_d},
+		{"workers", 'W', "LIST", CFG_STRING, &cfg.workers, required_argument, workers_d},
+		{"perCtrl", 'c', "NUM",  CFG_POSITIVE, &cfg.per_ctrl, required_argument, perctrl_d},
+		THROTTLE_OPTIONS(cfg.throttle),
+		{NULL}
+	};
+	struct provision_req req = { };
+	struct opal_user_lr_setup *setup = &req.lr.setup;
+	unsigned int i, nr_stages = ARRAY_SIZE(provision_stages);
+	struct timespec start, end;
+	struct fleet fleet;
+	int err;
+
+	err = parse_and_open(argc, argv, desc, command_line_options, &cfg, sizeof(cfg), &fleet);
+	if (err)
+		return err;
+	err = EINVAL;
+	if (cfg.split && cfg.from_gpt) {
+		fprintf(stderr, "--split or --from-gpt, not both\n");
+		goto out;
+	}
+	if ((cfg.parts || cfg.align) && !cfg.from_gpt) {
+		fprintf(stderr, "--partitions and --align go with --from-gpt\n");
+		goto out;
+	}
+	if (!cfg.split && !cfg.from_gpt) {
+		if (cfg.lr || cfg.new_pw || cfg.RLE || cfg.WLE) {
+			fprintf(stderr, "LRs and users need --split or --from-gpt\n");
+			goto out;
+		}
+		nr_stages = 2;
+	}
+	if (cfg.lr >= OPAL_MAX_LRS || cfg.split >= OPAL_MAX_LRS) {
+		fprintf(stderr, "Only LRs 1-%d can be set up\n", OPAL_MAX_LRS - 1);
+		goto out;
+	}
+	if (!cfg.lr)
+		cfg.lr = 1;
+	if (cfg.split && cfg.lr + cfg.split > OPAL_MAX_LRS) {
+		fprintf(stderr, "Only LRs 1-%d can be set up\n", OPAL_MAX_LRS - 1);
+		goto out;
+	}
+	if (cfg.parts && get_part_list(cfg.parts, cfg.lr, &req.lr))
+		goto out;
+	if (cfg.workers && provision_workers(cfg.workers, nr_stages))
+		goto out;
+	if (nr_stages > 2 && !cfg.new_pw) {
+		fprintf(stderr, "Need --newUserPW for the LR users\n");
+		goto out;
+	}
+	for (i = 0; i < (nr_stages > 2 ? ARRAY_SIZE(provision_ioctls) : 2); i++) {
+		err = fleet_check_ioctl(&fleet, provision_ioctls[i]);
+		if (err)
+			return err;
+	}
+	err = fleet_throttle(&fleet, &cfg.throttle);
+	if (err)
+		return err;
+	if (!cfg.password)
+		cfg.password = read_password();
+	if (!cfg.password) {
+		fprintf(stderr, "Need the password to take ownership with\n");
+		err = EINVAL;
+		goto out;
+	}
+
+	req.admin.key_len = snprintf((char *)req.admin.key, sizeof(req.admin.key),
+				     "%s", cfg.password);
+	if (cfg.new_pw)
+		req.user.key_len = snprintf((char *)req.user.key, sizeof(req.user.key),
+					    "%s", cfg.new_pw);
+	provision_session(&setup->session, &req, cfg.lr);
+	setup->RLE = cfg.RLE;
+	setup->WLE = cfg.WLE;
+	req.lr.split = cfg.split;
+	req.lr.from_gpt = cfg.from_gpt;
+	req.lr.align = cfg.align;
+	fleet.per_ctrl = cfg.per_ctrl;
+
+	printf("Provisioning %u device(s) behind %u controller(s) in %u stages\n",
+	       fleet.nr_devs, fleet.nr_ctrls, nr_stages);
+	fflush(stdout);
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	err = -pipeline_run(&fleet, provision_stages, nr_stages, &req);
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	if (!err)
+		err = provision_report(&fleet, nr_stages, ts_ms(&start, &end));
+	pipeline_free(provision_stages, nr_stages);
+ out:
+	memset(&req, 0, sizeof(req));
+	fleet_free(&fleet);
+	return err;
+}
+
+int sed_batch(int argc, char **argv, struct command *cmd, struct plugin *plugin)
+{
+	const char *desc = "Run a file of sed-opal command lines (default: stdin) "\
+		"after dropping the ones a later line repeats or overwrites and "\
+		"grouping the rest by device and authority.";
+	const char *dry_run_d = "Only print the plan";
+	const char *keep_order_d = "Drop redundant lines but don't reorder the rest";
+	struct config {
+		bool dry_run;
+		bool keep_order;
+	};
+	struct config cfg = { };
+	const struct argconfig_commandline_options command_line_options[] = {
+		{"dry-run", 'n', "",    CFG_NONE, &cfg.dry_run, no_argument, dry_run_d},
+		{"keep-order", 'k', "", CFG_NONE, &cfg.keep_order, no_argument, keep_order_d},
+		{NULL}
+	};
+	struct batch_op *op;
+	struct batch b;
+	unsigned int i;
+	FILE *f = stdin;
+	int err;
+
+	err = argconfig_parse(argc, argv, desc, command_line_options, &cfg, sizeof(cfg));
+	if (err)
+		return -err;
+	if (optind < argc && strcmp(argv[optind], "-")) {
+		f = fopen(argv[optind], "r");
+		if (!f) {
+			perror(argv[optind]);
+			return errno;
+		}
+	}
+	err = batch_load(f, &b);
+	if (f != stdin)
+		fclose(f);
+	if (err)
+		return -err;
+
+	batch_plan(&b, !cfg.keep_order);
+	batch_print(&b);
+	if (cfg.dry_run) {
+		batch_free(&b);
+		return 0;
+	}
+
+	for (i = 0; i < b.nr_planned; i++) {
+		op = &b.ops[b.plan[i]];
+		printf("line %u: %s\n", op->line, op->text);
+		fflush(stdout);
+		err = handle_plugin(op->argc, op->argv, plugin);
+		if (err) {
+			fprintf(stderr, "line %u failed, stopping\n", op->line);
+			break;
+		}
+	}
+	batch_free(&b);
+	return err;
+}
+
+int sed_index(int argc, char **argv, struct command *cmd, struct plugin *plugin)
+{
+	const char *desc = "Rebuild the index mapping device serial/WWN/EUI-64 to "\
+		"its current path, so that commands can be given serial:<id>, "\
+		"wwn:<id> or eui:<id> in place of a device.";
+	const char *list_d = "Only list the current index, don't rebuild it";
+	struct config {
+		bool list;
+	};
+	struct config cfg = { };
+	const struct argconfig_commandline_options command_line_options[] = {
+		{"list", 'L', "", CFG_NONE, &cfg.list, no_argument, list_d},
+		{NULL}
+	};
+	int err;
+
+	err = argconfig_parse(argc, argv, desc, command_line_options, &cfg, sizeof(cfg));
+	if (err)
+		return -err;
+
+	if (!cfg.list) {
+		err = devindex_rebuild();
+		if (err)
+			return -err;
+	}
+	devindex_list();
+	return 0;
 }
 
 int main(int argc, char **argv)
@@ -0,0 +1,154 @@
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/file.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+#include <stdbool.h>
+
+#include "statecache.h"
+#include "devindex.h"
+
+/* two reads of the suspended time a few instructions apart never differ more */
+#define STATECACHE_SLACK_MS 100
+
+struct statecache {
+	__s64 suspended_ms;
+	__u32 l_state[OPAL_MAX_LRS];
+};
+
+/* time spent suspended since boot: CLOCK_MONOTONIC stops, CLOCK_BOOTTIME doesn't */
+static __s64 suspended_ms(void)
+{
+	struct timespec boot, mono;
+
+	clock_gettime(CLOCK_BOOTTIME, &boot);
+	clock_gettime(CLOCK_MONOTONIC, &mono);
+	return (boot.tv_sec - mono.tv_sec) * 1000LL +
+		(boot.tv_nsec - mono.tv_nsec) / 1000000;
+}
+
+static int statecache_open(const char *disk, bool create)
+{
+	char boot_id[64], key[DEVINDEX_KEY_LEN], dir[128], path[PATH_MAX];
+	struct devid id;
+	FILE *f;
+	char *p;
+	int fd;
+
+	f = fopen("/proc/sys/kernel/random/boot_id", "r");
+	if (!f)
+		return -errno;
+	p = fgets(boot_id, sizeof(boot_id), f);
+	fclose(f);
+	if (!p)
+		return -EINVAL;
+	boot_id[strcspn(boot_id, "\n")] = '\0';
+
+	if (devid_read(disk, &id))
+		return -ENOENT;
+	devid_key(&id, key);
+	for (p = key; *p; p++)
+		if (*p == '/')
+			*p = '_';
+
+	snprintf(dir, sizeof(dir), "%s/%s", STATECACHE_DIR, boot_id);
+	if (create && mkdir_parents(dir))
+		return -errno;
+	snprintf(path, sizeof(path), "%s/%s", dir, key);
+
+	fd = open(path, O_RDWR | O_CLOEXEC | (create ? O_CREAT : 0), 0600);
+	if (fd < 0)
+		return -errno;
+	if (flock(fd, LOCK_EX)) {
+		close(fd);
+		return -errno;
+	}
+	return fd;
+}
+
+static int statecache_read(int fd, struct statecache *sc)
+{
+	__s64 delta;
+
+	if (pread(fd, sc, sizeof(*sc), 0) != sizeof(*sc))
+		goto invalid;
+
+	delta = sc->suspended_ms - suspended_ms();
+	if (delta < -STATECACHE_SLACK_MS || delta > STATECACHE_SLACK_MS)
+		goto invalid;
+	return 0;
+ invalid:
+	memset(sc, 0, sizeof(*sc));
+	return -ESTALE;
+}
+
+static void statecache_write(int fd, struct statecache *sc)
+{
+	sc->suspended_ms = suspended_ms();
+	if (pwrite(fd, sc, sizeof(*sc), 0) != sizeof(*sc))
+		ftruncate(fd, 0);
+}
+
+int statecache_get(const char *disk, __u8 lr, __u32 *l_state)
+{
+	struct statecache sc;
+	int fd, err;
+
+	if (lr >= OPAL_MAX_LRS)
+		return -EINVAL;
+
+	fd = statecache_open(disk, false);
+	if (fd < 0)
+		return fd;
+	err = statecache_read(fd, &sc);
+	close(fd);
+	if (err)
+		return err;
+
+	*l_state = sc.l_state[lr];
+	return *l_state ? 0 : -ENOENT;
+}
+
+void statecache_set(const char *disk, __u8 lr, __u32 l_state)
+{
+	struct statecache sc;
+	int fd;
+
+	if (lr >= OPAL_MAX_LRS)
+		return;
+
+	fd = statecache_open(disk, true);
+	if (fd < 0)
+		return;
+	statecache_read(fd, &sc);
+	sc.l_state[lr] = l_state;
+	statecache_write(fd, &sc);
+	close(fd);
+}
+
+/* lr < 0 forgets every LR of the drive */
+void statecache_forget(const char *disk, int lr)
+{
+	struct statecache sc;
+	int fd;
+
+	if (lr >= OPAL_MAX_LRS)
+		return;
+
+	fd = statecache_open(disk, false);
+	if (fd < 0)
+		return;
+	statecache_read(fd, &sc);
+	if (lr < 0)
+		memset(sc.l_state, 0, sizeof(sc.l_state));
+	else
+		sc.l_state[lr] = 0;
+	statecache_write(fd, &sc);
+	close(fd);
+}
@@ -0,0 +1,17 @@
+#ifndef _STATECACHE_H
+#define _STATECACHE_H
+
+#include <linux/types.h>
+
+/*
+ * Last lock state we successfully put each LR of a drive into, kept on tmpfs
+ * under the current boot ID and keyed by the drive's serial. A suspend since
+ * the state was recorded (the drive lost power and relocked) invalidates it.
+ */
+#define STATECACHE_DIR	"/run/sed-opal/lkstate"
+
+int statecache_get(const char *disk, __u8 lr, __u32 *l_state);
+void statecache_set(const char *disk, __u8 lr, __u32 l_state);
+void statecache_forget(const char *disk, int lr);
+
+#endif
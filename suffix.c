@@ -32,6 +32,7 @@
 #include "suffix.h"
 
 #include <stdlib.h>
+#include <string.h>
 #include <ctype.h>
 #include <errno.h>
 #include <math.h>
@@ -130,3 +131,65 @@ long long suffix_binary_parse(const char *value)
 
 	return ret;
 }
+
+/*
+ * Scale a count by its unit: K, M, G, T, P or E on their own or followed
+ * by "i"/"iB" are powers of 1024, followed by "B" powers of 1000.
+ */
+static int suffix_scale(const char *suffix, unsigned long long *value)
+{
+	static const char units[] = "KMGTPE";
+	unsigned long long mult = 1, base;
+	const char *u;
+	int i;
+
+	if (!suffix[0])
+		return 0;
+	u = strchr(units, toupper(suffix[0]));
+	if (!u)
+		return -EINVAL;
+	suffix++;
+	if (!strcmp(suffix, "B"))
+		base = 1000;
+	else if (!suffix[0] || !strcmp(suffix, "i") || !strcmp(suffix, "iB"))
+		base = 1024;
+	else
+		return -EINVAL;
+	for (i = 0; i <= u - units; i++)
+		mult *= base;
+	if (__builtin_mul_overflow(*value, mult, value))
+		return -ERANGE;
+	return 0;
+}
+
+/*
+ * A decimal count with an optional unit, see suffix_scale(). errno is set
+ * to ERANGE on overflow, EINVAL on anything else that doesn't parse.
+ */
+unsigned long long suffix_u64_parse(const char *value)
+{
+	unsigned long long ret;
+	char *suffix;
+	int err;
+
+	while (isspace((unsigned char)*value))
+		value++;
+	if (*value == '-' || *value == '+') {
+		errno = EINVAL;
+		return 0;
+	}
+	errno = 0;
+	ret = strtoull(value, &suffix, 10);
+	if (errno)
+		return 0;
+	if (suffix == value) {
+		errno = EINVAL;
+		return 0;
+	}
+	err = suffix_scale(suffix, &ret);
+	if (err) {
+		errno = -err;
+		return 0;
+	}
+	return ret;
+}
@@ -35,5 +35,6 @@ const char *suffix_si_get(double *value);
 const char *suffix_binary_get(long long *value);
 const char *suffix_dbinary_get(double *value);
 long long suffix_binary_parse(const char *value);
+unsigned long long suffix_u64_parse(const char *value);
 
 #endif
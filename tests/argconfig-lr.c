@@ -0,0 +1,122 @@
+/*
+ * CFG_POSITIVE stores a whole uint32_t, so an --lr parsed into anything
+ * narrower overwrites whatever follows it in the config. These parse the
+ * erase commands' options the way they are laid out in sed.c and check
+ * that every flag given survives --lr, wherever it comes on the line.
+ */
+#include <stdio.h>
+#include <stdbool.h>
+#include <getopt.h>
+#include <linux/types.h>
+
+#include "argconfig.h"
+
+/* as in sed_erase_lr() */
+struct erase_cfg {
+	__u32 lr;
+	char *user;
+	char *password;
+	bool sum;
+	bool discard;
+	long range_start;
+	long range_length;
+};
+
+/* as in sed_secure_erase_lr() */
+struct secure_erase_cfg {
+	char *user;
+	char *password;
+	__u32 lr;
+	bool sum;
+	bool verify;
+	bool discard;
+	unsigned int samples;
+	long range_start;
+	long range_length;
+};
+
+struct lr_case {
+	const char *name;
+	int argc;
+	char *argv[8];
+	__u32 lr;
+	bool verify;
+	bool discard;
+};
+
+static const struct lr_case cases[] = {
+	{ "--verify before --lr", 4,
+	  { "sed-secure-eraselr", "--verify", "--lr", "5" }, 5, true, false },
+	{ "--verify after --lr", 4,
+	  { "sed-secure-eraselr", "--lr", "5", "--verify" }, 5, true, false },
+	{ "--verify --discard --lr", 5,
+	  { "sed-secure-eraselr", "--verify", "--discard", "--lr", "1" }, 1, true, true },
+	{ "--lr past a __u8 stays whole", 3,
+	  { "sed-secure-eraselr", "--lr", "257" }, 257, false, false },
+};
+
+/* --discard with an LR other than 0 */
+static int erase_discard(void)
+{
+	struct erase_cfg cfg = { };
+	const struct argconfig_commandline_options opts[] = {
+		{"lr", 'l', "NUM",       CFG_POSITIVE, &cfg.lr, required_argument, ""},
+		{"user", 'u', "FMT",     CFG_STRING, &cfg.user, required_argument, ""},
+		{"password", 'p', "FMT", CFG_STRING, &cfg.password, required_argument, ""},
+		{"sum",      's', "",    CFG_NONE, &cfg.sum, no_argument, ""},
+		{"discard",  'd', "",    CFG_NONE, &cfg.discard, no_argument, ""},
+		{"rangeStart", 'z', "NUM", CFG_LONG, &cfg.range_start, required_argument, ""},
+		{"rangeLength", 'y', "NUM", CFG_LONG, &cfg.range_length, required_argument, ""},
+		{NULL}
+	};
+	char *argv[] = { "sed-eraselr", "--discard", "--lr", "3", "-u", "admin1", NULL };
+
+	optind = 0;
+	if (argconfig_parse(6, argv, "", opts, &cfg, sizeof(cfg)) ||
+	    cfg.lr != 3 || !cfg.discard || cfg.sum || !cfg.user) {
+		printf("FAIL sed-eraselr --discard --lr: lr %u discard %d sum %d\n",
+		       cfg.lr, cfg.discard, cfg.sum);
+		return 1;
+	}
+	printf("ok   sed-eraselr --discard --lr\n");
+	return 0;
+}
+
+int main(void)
+{
+	struct secure_erase_cfg cfg;
+	const struct argconfig_commandline_options opts[] = {
+		{"user", 'u', "FMT",     CFG_STRING, &cfg.user, required_argument, ""},
+		{"password", 'p', "FMT", CFG_STRING, &cfg.password, required_argument, ""},
+		{"lr", 'l', "NUM",       CFG_POSITIVE, &cfg.lr, required_argument, ""},
+		{"sum",      's', "",    CFG_NONE, &cfg.sum, no_argument, ""},
+		{"verify",   'V', "",    CFG_NONE, &cfg.verify, no_argument, ""},
+		{"samples",  0, "NUM",   CFG_POSITIVE, &cfg.samples, required_argument, ""},
+		{"discard",  'd', "",    CFG_NONE, &cfg.discard, no_argument, ""},
+		{"rangeStart", 'z', "NUM", CFG_LONG, &cfg.range_start, required_argument, ""},
+		{"rangeLength", 'y', "NUM", CFG_LONG, &cfg.range_length, required_argument, ""},
+		{NULL}
+	};
+	char *argv[8];
+	unsigned int i, j, failed = 0;
+	const struct lr_case *c;
+
+	for (i = 0; i < sizeof(cases) / sizeof(cases[0]); i++) {
+		c = &cases[i];
+		cfg = (struct secure_erase_cfg) { .samples = 1 };
+		for (j = 0; j < (unsigned int)c->argc; j++)
+			argv[j] = c->argv[j];
+		argv[j] = NULL;
+		optind = 0;
+		if (argconfig_parse(c->argc, argv, "", opts, &cfg, sizeof(cfg)) ||
+		    cfg.lr != c->lr || cfg.verify != c->verify ||
+		    cfg.discard != c->discard || cfg.sum) {
+			printf("FAIL %s: lr %u verify %d discard %d sum %d\n",
+			       c->name, cfg.lr, cfg.verify, cfg.discard, cfg.sum);
+			failed++;
+		} else
+			printf("ok   %s\n", c->name);
+	}
+	failed += erase_discard();
+	return failed ? 1 : 0;
+}
@@ -0,0 +1,142 @@
+/*
+ * Table-driven checks of the sed-batch planner: what batch_plan() drops and
+ * the order it schedules the rest in. Nothing here touches a device.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+
+#include "batch.h"
+
+struct batch_case {
+	const char *name;
+	bool reorder;
+	const char *input;
+	const char *plan;	/* line numbers, in execution order */
+	const char *dropped;	/* "L=M": L repeats M, "L>M": M overwrites L */
+};
+
+#define LK(lr, st, pw, dev) \
+	"sed-lock-state --lr " lr " -u admin1 -t " st " -p " pw " " dev "\n"
+
+static const struct batch_case cases[] = {
+	{ "exact repeat is dropped", true,
+	  LK("1", "rw", "a", "/dev/x")
+	  LK("1", "rw", "a", "/dev/x"),
+	  "1", "2=1" },
+	{ "later lock state overwrites", true,
+	  LK("1", "rw", "a", "/dev/x")
+	  LK("1", "lk", "a", "/dev/x"),
+	  "2", "1>2" },
+	{ "no overwrite across a conflicting op", true,
+	  LK("1", "rw", "a", "/dev/x")
+	  "sed-setuplr --lr 1 -u admin1 -p a -z 0 -y 8 /dev/x\n"
+	  LK("1", "lk", "a", "/dev/x"),
+	  "1 2 3", "" },
+	{ "other devices don't block an overwrite", true,
+	  LK("1", "rw", "a", "/dev/x")
+	  LK("1", "rw", "a", "/dev/y")
+	  LK("1", "lk", "a", "/dev/x"),
+	  "2 3", "1>3" },
+	{ "reorder groups by device", true,
+	  LK("1", "rw", "a", "/dev/x")
+	  LK("1", "rw", "a", "/dev/y")
+	  LK("2", "rw", "a", "/dev/x"),
+	  "1 3 2", "" },
+	{ "--keep-order keeps the file's order", false,
+	  LK("1", "rw", "a", "/dev/x")
+	  LK("1", "rw", "a", "/dev/y")
+	  LK("2", "rw", "a", "/dev/x"),
+	  "1 2 3", "" },
+	{ "a device-wide op is a barrier", true,
+	  LK("1", "rw", "a", "/dev/x")
+	  "sed-status /dev/x\n"
+	  LK("2", "rw", "a", "/dev/x"),
+	  "1 2 3", "" },
+	{ "setpw stays before a login with the new password", true,
+	  LK("3", "rw", "a", "/dev/x")
+	  "sed-setpw -u user1 -p admin1 -a a -n b /dev/x\n"
+	  "sed-lock-state --lr 1 -u user1 -t rw -p b /dev/x\n"
+	  LK("4", "rw", "a", "/dev/x"),
+	  "1 2 4 3", "" },
+	{ "setpw logging in with the earlier password keeps both", true,
+	  "sed-setpw -u user1 -p admin1 -a a -n b /dev/x\n"
+	  "sed-setpw -u user1 -p user1 -a b -n c /dev/x\n",
+	  "1 2", "" },
+	{ "setpw for the same user as the same authority overwrites", true,
+	  "sed-setpw -u user1 -p admin1 -a a -n b /dev/x\n"
+	  "sed-setpw -u user1 -p admin1 -a a -n c /dev/x\n",
+	  "2", "1>2" },
+	{ "SUM lock logs in as User(lr + 1)", true,
+	  "sed-lock-state -s --lr 3 -t rw -p a /dev/x\n"
+	  "sed-setpw -s -u user2 -p user2 -a a -n b /dev/x\n"
+	  "sed-lock-state -s --lr 1 -t rw -p b /dev/x\n",
+	  "1 2 3", "" },
+	{ "SUM locks on different LRs don't conflict", true,
+	  "sed-lock-state --sum --lr 1 -t rw -p a /dev/x\n"
+	  LK("1", "rw", "a", "/dev/y")
+	  "sed-lock-state --sum --lr 2 -t rw -p a /dev/x\n",
+	  "1 3 2", "" },
+	{ "a different password is not a repeat", true,
+	  LK("1", "rw", "a", "/dev/x")
+	  LK("1", "rw", "b", "/dev/x"),
+	  "2", "1>2" },
+	{ "saves as different users are both kept", true,
+	  "sed-save --lr 1 -u user1 -t rw -p a /dev/x\n"
+	  "sed-save --lr 1 -u user2 -t rw -p a /dev/x\n",
+	  "1 2", "" },
+};
+
+static void batch_result(const struct batch *b, char *plan, char *dropped,
+			 size_t len)
+{
+	const struct batch_op *op;
+	unsigned int i;
+
+	plan[0] = dropped[0] = '\0';
+	for (i = 0; i < b->nr_planned; i++)
+		snprintf(plan + strlen(plan), len - strlen(plan), "%s%u",
+			 i ? " " : "", b->ops[b->plan[i]].line);
+	for (i = 0; i < b->nr_ops; i++) {
+		op = &b->ops[i];
+		if (op->dropped_for < 0)
+			continue;
+		snprintf(dropped + strlen(dropped), len - strlen(dropped),
+			 "%s%u%c%u", dropped[0] ? " " : "", op->line,
+			 op->duplicate ? '=' : '>', b->ops[op->dropped_for].line);
+	}
+}
+
+int main(void)
+{
+	char plan[256], dropped[256];
+	const struct batch_case *c;
+	unsigned int i, failed = 0;
+	struct batch b;
+	FILE *f;
+
+	for (i = 0; i < sizeof(cases) / sizeof(cases[0]); i++) {
+		c = &cases[i];
+		f = fmemopen((void *)c->input, strlen(c->input), "r");
+		if (!f || batch_load(f, &b)) {
+			printf("FAIL %s: couldn't load\n", c->name);
+			failed++;
+			if (f)
+				fclose(f);
+			continue;
+		}
+		fclose(f);
+		batch_plan(&b, c->reorder);
+		batch_result(&b, plan, dropped, sizeof(plan));
+		if (strcmp(plan, c->plan) || strcmp(dropped, c->dropped)) {
+			printf("FAIL %s: plan \"%s\" dropped \"%s\", want \"%s\" "
+			       "and \"%s\"\n", c->name, plan, dropped, c->plan,
+			       c->dropped);
+			failed++;
+		} else
+			printf("ok   %s\n", c->name);
+		batch_free(&b);
+	}
+	return failed ? 1 : 0;
+}
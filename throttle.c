@@ -0,0 +1,158 @@
+#include <sys/syscall.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <time.h>
+
+#include "throttle.h"
+
+#define IOPRIO_CLASS_SHIFT	13
+#define IOPRIO_CLASS_IDLE	3
+#define IOPRIO_WHO_PROCESS	1
+
+#define THROTTLE_SAMPLE_MS	100
+#define THROTTLE_BACKOFF_MAX_MS	5000
+
+struct disk_sample {
+	unsigned long long ios;
+	unsigned long long ticks;	/* ms spent on completed ios */
+	unsigned int inflight;
+};
+
+static void throttle_sleep(unsigned int ms)
+{
+	struct timespec ts = {
+		.tv_sec = ms / 1000,
+		.tv_nsec = (ms % 1000) * 1000000L,
+	};
+
+	while (nanosleep(&ts, &ts) && errno == EINTR)
+		;
+}
+
+static int disk_sample(const char *disk, struct disk_sample *s)
+{
+	unsigned long long rd_ios, rd_merges, rd_sec, rd_ticks;
+	unsigned long long wr_ios, wr_merges, wr_sec, wr_ticks;
+	unsigned int rd_inflight, wr_inflight;
+	char path[128];
+	FILE *f;
+	int ret;
+
+	snprintf(path, sizeof(path), "/sys/block/%s/stat", disk);
+	f = fopen(path, "r");
+	if (!f)
+		return -errno;
+	ret = fscanf(f, "%llu %llu %llu %llu %llu %llu %llu %llu",
+		     &rd_ios, &rd_merges, &rd_sec, &rd_ticks,
+		     &wr_ios, &wr_merges, &wr_sec, &wr_ticks);
+	fclose(f);
+	if (ret != 8)
+		return -EINVAL;
+
+	snprintf(path, sizeof(path), "/sys/block/%s/inflight", disk);
+	f = fopen(path, "r");
+	if (!f)
+		return -errno;
+	ret = fscanf(f, "%u %u", &rd_inflight, &wr_inflight);
+	fclose(f);
+	if (ret != 2)
+		return -EINVAL;
+
+	s->ios = rd_ios + wr_ios;
+	s->ticks = rd_ticks + wr_ticks;
+	s->inflight = rd_inflight + wr_inflight;
+	return 0;
+}
+
+/*
+ * Idle I/O priority only affects the block I/O we issue ourselves (reads for
+ * verification and the like); security send/receive bypass the scheduler.
+ */
+int throttle_setup(struct throttle *throttle)
+{
+	char path[4096];
+	FILE *f;
+	int err;
+
+	if (throttle->max_inflight || throttle->max_latency)
+		throttle->enabled = true;
+	if (!throttle->max_inflight)
+		throttle->max_inflight = THROTTLE_DEF_INFLIGHT;
+	if (!throttle->max_latency)
+		throttle->max_latency = THROTTLE_DEF_LATENCY;
+	if (!throttle->max_wait)
+		throttle->max_wait = THROTTLE_DEF_MAX_WAIT;
+
+	if (throttle->idle_io &&
+	    syscall(SYS_ioprio_set, IOPRIO_WHO_PROCESS, 0,
+		    IOPRIO_CLASS_IDLE << IOPRIO_CLASS_SHIFT) < 0) {
+		err = errno;
+		fprintf(stderr, "ioprio_set: %s\n", strerror(err));
+		return err;
+	}
+
+	if (throttle->cgroup) {
+		snprintf(path, sizeof(path), "%s/cgroup.procs", throttle->cgroup);
+		f = fopen(path, "w");
+		err = f ? 0 : errno;
+		if (f && fprintf(f, "%d\n", getpid()) < 0)
+			err = errno;
+		if (f && fclose(f) && !err)
+			err = errno;
+		if (err) {
+			fprintf(stderr, "%s: %s\n", path, strerror(err));
+			return err;
+		}
+	}
+	return 0;
+}
+
+/*
+ * Backing off is capped per round and in total: a device that stays busy
+ * for max_wait seconds fails with ETIMEDOUT rather than holding the run
+ * up for good.
+ */
+int throttle_wait(struct throttle *throttle, const char *disk)
+{
+	struct disk_sample a, b;
+	unsigned int backoff = THROTTLE_SAMPLE_MS;
+	unsigned long long waited = 0;	/* ms */
+	unsigned int latency;
+
+	if (!throttle || !throttle->enabled)
+		return 0;
+
+	for (;;) {
+		if (disk_sample(disk, &a))
+			return 0;
+		throttle_sleep(THROTTLE_SAMPLE_MS);
+		waited += THROTTLE_SAMPLE_MS;
+		if (disk_sample(disk, &b))
+			return 0;
+
+		latency = 0;
+		if (b.ios > a.ios)
+			latency = (b.ticks - a.ticks) / (b.ios - a.ios);
+
+		if (b.inflight <= throttle->max_inflight &&
+		    latency <= throttle->max_latency)
+			return 0;
+
+		if (waited >= throttle->max_wait * 1000ULL) {
+			fprintf(stderr, "%s: still busy after %us, giving up\n",
+				disk, throttle->max_wait);
+			return -ETIMEDOUT;
+		}
+		fprintf(stderr, "%s: busy (%u in flight, %ums latency), backing off %ums\n",
+			disk, b.inflight, latency, backoff);
+		throttle_sleep(backoff);
+		waited += backoff;
+		backoff *= 2;
+		if (backoff > THROTTLE_BACKOFF_MAX_MS)
+			backoff = THROTTLE_BACKOFF_MAX_MS;
+	}
+}
@@ -0,0 +1,46 @@
+#ifndef _THROTTLE_H
+#define _THROTTLE_H
+
+#include <stdbool.h>
+
+#define THROTTLE_DEF_INFLIGHT	4
+#define THROTTLE_DEF_LATENCY	10	/* ms */
+#define THROTTLE_DEF_MAX_WAIT	600	/* s */
+
+/*
+ * Hold management commands back while a device is busy serving foreground
+ * I/O. OPAL commands can't be paused once issued, so we wait before each
+ * one until the device's in-flight count and average completion latency
+ * (sampled from /sys/block/<disk>/{inflight,stat}) drop below the limits.
+ */
+struct throttle {
+	bool enabled;
+	bool idle_io;
+	unsigned int max_inflight;
+	unsigned int max_latency;	/* ms */
+	unsigned int max_wait;		/* s, before giving up on a device */
+	char *cgroup;
+};
+
+/* the command line options filling in a struct throttle, for argconfig */
+#define THROTTLE_OPTIONS(t)						\
+	{"throttle", 0, "", CFG_NONE, &(t).enabled, no_argument,		\
+	 "Hold off while the device is busy with foreground I/O"},	\
+	{"maxInflight", 0, "NUM", CFG_POSITIVE, &(t).max_inflight,	\
+	 required_argument, "Back off while more than this many I/Os "	\
+	 "are in flight (implies --throttle)"},				\
+	{"maxLatency", 0, "MS", CFG_POSITIVE, &(t).max_latency,		\
+	 required_argument, "Back off while average I/O latency exceeds "	\
+	 "this many ms (implies --throttle)"},				\
+	{"maxWait", 0, "S", CFG_POSITIVE, &(t).max_wait,		\
+	 required_argument, "Give up on a device that is still busy after "	\
+	 "this many seconds (default 600)"},				\
+	{"idleIO", 0, "", CFG_NONE, &(t).idle_io, no_argument,		\
+	 "Run with idle I/O priority"},					\
+	{"cgroup", 0, "PATH", CFG_STRING, &(t).cgroup, required_argument,	\
+	 "Move ourselves into this cgroup before touching the device"}
+
+int throttle_setup(struct throttle *throttle);
+int throttle_wait(struct throttle *throttle, const char *disk);
+
+#endif
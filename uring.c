@@ -0,0 +1,136 @@
+#include <sys/types.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+
+#include "uring.h"
+
+static int io_uring_setup(unsigned int entries, struct io_uring_params *p)
+{
+	return syscall(__NR_io_uring_setup, entries, p);
+}
+
+static int io_uring_enter(int fd, unsigned int to_submit,
+			  unsigned int min_complete, unsigned int flags)
+{
+	return syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags,
+		       NULL, 0);
+}
+
+int uring_init(struct uring *r, unsigned int entries)
+{
+	struct io_uring_params p;
+	void *sq, *cq;
+	int err;
+
+	memset(r, 0, sizeof(*r));
+	memset(&p, 0, sizeof(p));
+	r->fd = io_uring_setup(entries, &p);
+	if (r->fd < 0)
+		return -errno;
+
+	r->sq_size = p.sq_off.array + p.sq_entries * sizeof(unsigned int);
+	r->cq_size = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+	if (p.features & IORING_FEAT_SINGLE_MMAP) {
+		if (r->cq_size > r->sq_size)
+			r->sq_size = r->cq_size;
+		r->cq_size = r->sq_size;
+	}
+
+	sq = mmap(NULL, r->sq_size, PROT_READ | PROT_WRITE,
+		  MAP_SHARED | MAP_POPULATE, r->fd, IORING_OFF_SQ_RING);
+	if (sq == MAP_FAILED)
+		goto fail;
+	r->sq_ring = sq;
+	if (p.features & IORING_FEAT_SINGLE_MMAP) {
+		cq = sq;
+	} else {
+		cq = mmap(NULL, r->cq_size, PROT_READ | PROT_WRITE,
+			  MAP_SHARED | MAP_POPULATE, r->fd, IORING_OFF_CQ_RING);
+		if (cq == MAP_FAILED)
+			goto fail;
+		r->cq_ring = cq;
+	}
+
+	r->sqes_size = p.sq_entries * sizeof(struct io_uring_sqe);
+	r->sqes = mmap(NULL, r->sqes_size, PROT_READ | PROT_WRITE,
+		       MAP_SHARED | MAP_POPULATE, r->fd, IORING_OFF_SQES);
+	if (r->sqes == MAP_FAILED) {
+		r->sqes = NULL;
+		goto fail;
+	}
+
+	r->sq_head = sq + p.sq_off.head;
+	r->sq_tail = sq + p.sq_off.tail;
+	r->sq_mask = sq + p.sq_off.ring_mask;
+	r->sq_array = sq + p.sq_off.array;
+	r->cq_head = cq + p.cq_off.head;
+	r->cq_tail = cq + p.cq_off.tail;
+	r->cq_mask = cq + p.cq_off.ring_mask;
+	r->cqes = cq + p.cq_off.cqes;
+	return 0;
+ fail:
+	err = -errno;
+	uring_exit(r);
+	return err;
+}
+
+/* a zeroed SQE to fill in, or NULL when the ring is full */
+struct io_uring_sqe *uring_sqe(struct uring *r)
+{
+	unsigned int head = __atomic_load_n(r->sq_head, __ATOMIC_ACQUIRE);
+	unsigned int tail = *r->sq_tail + r->to_submit;
+	struct io_uring_sqe *sqe;
+
+	if (tail - head > *r->sq_mask)
+		return NULL;
+	sqe = &r->sqes[tail & *r->sq_mask];
+	memset(sqe, 0, sizeof(*sqe));
+	r->sq_array[tail & *r->sq_mask] = tail & *r->sq_mask;
+	r->to_submit++;
+	return sqe;
+}
+
+int uring_submit_wait(struct uring *r, unsigned int wait_nr)
+{
+	unsigned int tail = *r->sq_tail + r->to_submit;
+	int ret;
+
+	__atomic_store_n(r->sq_tail, tail, __ATOMIC_RELEASE);
+	r->to_submit = 0;
+	do {
+		ret = io_uring_enter(r->fd,
+				     tail - __atomic_load_n(r->sq_head, __ATOMIC_ACQUIRE),
+				     wait_nr, wait_nr ? IORING_ENTER_GETEVENTS : 0);
+	} while (ret < 0 && errno == EINTR);
+	return ret < 0 ? -errno : 0;
+}
+
+/* 1 and the oldest completion if there is one, else 0 */
+int uring_peek(struct uring *r, struct io_uring_cqe *cqe)
+{
+	unsigned int head = *r->cq_head;
+
+	if (head == __atomic_load_n(r->cq_tail, __ATOMIC_ACQUIRE))
+		return 0;
+	*cqe = r->cqes[head & *r->cq_mask];
+	__atomic_store_n(r->cq_head, head + 1, __ATOMIC_RELEASE);
+	return 1;
+}
+
+void uring_exit(struct uring *r)
+{
+	if (r->sqes)
+		munmap(r->sqes, r->sqes_size);
+	if (r->cq_ring)
+		munmap(r->cq_ring, r->cq_size);
+	if (r->sq_ring)
+		munmap(r->sq_ring, r->sq_size);
+	if (r->fd >= 0)
+		close(r->fd);
+	memset(r, 0, sizeof(*r));
+	r->fd = -1;
+}
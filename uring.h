@@ -0,0 +1,27 @@
+#ifndef _URING_H
+#define _URING_H
+
+#include <linux/io_uring.h>
+
+/*
+ * Just enough of io_uring for a copy loop, on the raw syscalls so there's
+ * no library to depend on: one submission and one completion ring.
+ */
+struct uring {
+	int fd;
+	unsigned int *sq_head, *sq_tail, *sq_mask, *sq_array;
+	unsigned int *cq_head, *cq_tail, *cq_mask;
+	struct io_uring_sqe *sqes;
+	struct io_uring_cqe *cqes;
+	unsigned int to_submit;
+	void *sq_ring, *cq_ring;
+	size_t sq_size, cq_size, sqes_size;
+};
+
+int uring_init(struct uring *r, unsigned int entries);
+struct io_uring_sqe *uring_sqe(struct uring *r);
+int uring_submit_wait(struct uring *r, unsigned int wait_nr);
+int uring_peek(struct uring *r, struct io_uring_cqe *cqe);
+void uring_exit(struct uring *r);
+
+#endif
@@ -0,0 +1,200 @@
+#include <sys/types.h>
+#include <sys/ioctl.h>
+#include <sys/random.h>
+#include <linux/fs.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <math.h>
+#include <pthread.h>
+
+#include "verify.h"
+
+#define VERIFY_BS 4096
+
+/*
+ * Chi-square of a byte histogram against a uniform distribution has 255
+ * degrees of freedom: mean 255, stddev ~22.6. Anything past mean + 5 sigma
+ * is structured data rather than the output of a fresh media key.
+ */
+#define VERIFY_CHI2_MAX (255.0 + 5 * 22.6)
+
+/* wide enough for the compiler to use whatever vector unit the target has */
+typedef unsigned long long vu64 __attribute__((vector_size(32)));
+
+struct verify_read {
+	struct verify *v;
+	unsigned char *buf;
+	unsigned int first;
+	int threaded;
+	int err;
+};
+
+static void *verify_read_worker(void *arg)
+{
+	struct verify_read *r = arg;
+	struct verify *v = r->v;
+	unsigned int i;
+
+	for (i = r->first; i < v->nr; i += VERIFY_THREADS) {
+		if (pread(v->fd, r->buf + (size_t)i * v->bs, v->bs,
+			  v->offsets[i]) != v->bs) {
+			r->err = errno ? errno : EIO;
+			break;
+		}
+	}
+	return NULL;
+}
+
+static int verify_read(struct verify *v, unsigned char *buf)
+{
+	struct verify_read r[VERIFY_THREADS];
+	pthread_t threads[VERIFY_THREADS];
+	unsigned int i, started;
+	int err = 0;
+
+	for (started = 0; started < VERIFY_THREADS && started < v->nr; started++) {
+		r[started] = (struct verify_read) {
+			.v = v, .buf = buf, .first = started, .threaded = 1,
+		};
+		if (pthread_create(&threads[started], NULL, verify_read_worker,
+				   &r[started])) {
+			/* this thread's share is picked up inline */
+			r[started].threaded = 0;
+			verify_read_worker(&r[started]);
+		}
+	}
+	for (i = 0; i < started; i++) {
+		if (r[i].threaded)
+			pthread_join(threads[i], NULL);
+		if (r[i].err && !err)
+			err = r[i].err;
+	}
+	return -err;
+}
+
+/* branch-free so the whole block goes through the vector unit */
+static int block_differs(const unsigned char *a, const unsigned char *b,
+			 unsigned int len)
+{
+	const vu64 *va = (const vu64 *)a, *vb = (const vu64 *)b;
+	vu64 acc = { 0 };
+	unsigned int i;
+
+	for (i = 0; i < len / sizeof(vu64); i++)
+		acc |= va[i] ^ vb[i];
+	return (acc[0] | acc[1] | acc[2] | acc[3]) != 0;
+}
+
+static int block_is_noise(const unsigned char *buf, unsigned int len)
+{
+	unsigned int hist[256] = { 0 }, i;
+	double expect = len / 256.0, chi2 = 0, d;
+
+	for (i = 0; i < len; i++)
+		hist[buf[i]]++;
+	for (i = 0; i < 256; i++) {
+		d = hist[i] - expect;
+		chi2 += d * d / expect;
+	}
+	return chi2 < VERIFY_CHI2_MAX;
+}
+
+/*
+ * Pick samples uniformly over [start, start + length) and read them while the
+ * old key is still in place. The range has to be unlocked for read.
+ */
+int verify_prepare(struct verify *v, const char *path, __u64 start,
+		   __u64 length, unsigned int samples)
+{
+	__u64 span, rnd, start_lba, nr_lbas;
+	unsigned int lbs, i;
+	int err;
+
+	memset(v, 0, sizeof(*v));
+	v->fd = open(path, O_RDONLY | O_DIRECT | O_CLOEXEC);
+	if (v->fd < 0)
+		return -errno;
+	if (ioctl(v->fd, BLKSSZGET, &lbs) || !lbs) {
+		err = -errno;
+		goto out;
+	}
+
+	start_lba = (start + lbs - 1) / lbs;
+	nr_lbas = (start + length) / lbs;
+	nr_lbas = nr_lbas > start_lba ? nr_lbas - start_lba : 0;
+	if (!nr_lbas || !samples) {
+		err = -EINVAL;
+		goto out;
+	}
+	v->bs = VERIFY_BS < lbs ? lbs : VERIFY_BS;
+	if ((__u64)v->bs / lbs > nr_lbas)
+		v->bs = lbs;
+	span = nr_lbas - v->bs / lbs + 1;
+
+	v->nr = samples;
+	v->offsets = calloc(samples, sizeof(*v->offsets));
+	if (!v->offsets ||
+	    posix_memalign((void **)&v->before, VERIFY_BS, (size_t)samples * v->bs) ||
+	    posix_memalign((void **)&v->after, VERIFY_BS, (size_t)samples * v->bs)) {
+		err = -ENOMEM;
+		goto out;
+	}
+
+	for (i = 0; i < samples; i++) {
+		if (getrandom(&rnd, sizeof(rnd), 0) != sizeof(rnd)) {
+			err = -errno;
+			goto out;
+		}
+		v->offsets[i] = (start_lba + rnd % span) * lbs;
+	}
+
+	err = verify_read(v, v->before);
+	if (!err)
+		return 0;
+ out:
+	verify_free(v);
+	return err;
+}
+
+/*
+ * If a fraction p of the range kept its old contents, all k samples missing
+ * it has probability (1 - p)^k; report the complement for p = 1%.
+ */
+int verify_check(struct verify *v, struct verify_result *res)
+{
+	unsigned int i;
+	int err;
+
+	memset(res, 0, sizeof(*res));
+	err = verify_read(v, v->after);
+	if (err)
+		return err;
+
+	res->total = v->nr;
+	for (i = 0; i < v->nr; i++) {
+		const unsigned char *a = v->before + (size_t)i * v->bs;
+		const unsigned char *b = v->after + (size_t)i * v->bs;
+
+		res->changed += block_differs(a, b, v->bs);
+		res->noise += block_is_noise(b, v->bs);
+	}
+	if (res->changed == res->total && res->noise == res->total)
+		res->confidence = 1 - pow(1 - VERIFY_UNCHANGED_PCT / 100, v->nr);
+	return 0;
+}
+
+void verify_free(struct verify *v)
+{
+	if (v->fd >= 0)
+		close(v->fd);
+	free(v->offsets);
+	free(v->before);
+	free(v->after);
+	memset(v, 0, sizeof(*v));
+	v->fd = -1;
+}
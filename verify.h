@@ -0,0 +1,36 @@
+#ifndef _VERIFY_H
+#define _VERIFY_H
+
+#include <linux/types.h>
+
+#define VERIFY_DEF_SAMPLES	512
+#define VERIFY_THREADS		8
+#define VERIFY_UNCHANGED_PCT	1.0
+
+/*
+ * Sampled evidence that a range was crypto-erased: read a random sample of
+ * blocks with O_DIRECT before the erase, read them again afterwards and
+ * check every one of them changed and now looks like ciphertext noise.
+ */
+struct verify {
+	int fd;
+	unsigned int bs;		/* bytes per sample */
+	unsigned int nr;
+	__u64 *offsets;			/* byte offsets */
+	unsigned char *before;
+	unsigned char *after;
+};
+
+struct verify_result {
+	unsigned int total;
+	unsigned int changed;
+	unsigned int noise;
+	double confidence;		/* that <= VERIFY_UNCHANGED_PCT is unchanged */
+};
+
+int verify_prepare(struct verify *v, const char *path, __u64 start,
+		   __u64 length, unsigned int samples);
+int verify_check(struct verify *v, struct verify_result *res);
+void verify_free(struct verify *v);
+
+#endif